@@ -0,0 +1,446 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <sys/wait.h>
+
+#include "deals_cheapest.hpp"
+#include "deals_cheapest_by_country.hpp"
+#include "deals_cheapest_by_date.hpp"
+#include "deals_database.hpp"
+#include "timing.hpp"
+
+#define BENCH_REPEATS 5
+#define BENCH_APPEND_PROCESSES 8
+
+//------------------------------------------------------------------------
+// Scan benchmark: the same deals in PageLayout::ROWS and PageLayout::COLUMNS
+// tables and the same queries over both of them
+//------------------------------------------------------------------------
+namespace deals {
+static const std::string bench_origins[] = {"MOW", "LED", "KZN", "SVX", "OVB", "AER", "KRR",
+                                            "UFA", "ROV", "KUF", "MRV", "IKT", "KJA", "VVO"};
+
+//------------------------------------------------------------------------
+// random deal, every third one is from MOW
+//------------------------------------------------------------------------
+i::DealInfo getBenchDeal(uint32_t timestamp) {
+  const uint16_t origins_count = sizeof(bench_origins) / sizeof(bench_origins[0]);
+  const uint16_t place = rand() % 3 == 0 ? 0 : rand() % origins_count;
+
+  // destinations AAA..ZZZ (first 300)
+  const uint32_t dst = rand() % 300;
+  const std::string destination = {char('A' + dst / 26 / 26 % 26), char('A' + dst / 26 % 26),
+                                   char('A' + dst % 26)};
+
+  const types::Date departure(types::int_to_date(20170000 + (rand() % 12 + 1) * 100 +
+                                                 rand() % 28 + 1));
+  const types::Date ret(types::int_to_date(20180000 + (rand() % 12 + 1) * 100 + rand() % 28 + 1));
+  const bool roundtrip = rand() % 4 != 0;
+
+  i::DealInfo info;
+  std::memset(&info, 0, sizeof(info));
+  info.timestamp = timestamp - rand() % 3600;
+  info.origin = types::origin_to_code(bench_origins[place]);
+  info.destination = types::origin_to_code(destination);
+  info.destination_country = dst % types::COUNTRIES.size();
+  info.departure_date = departure.get_days();
+  info.return_date = roundtrip ? ret.get_days() : 0;
+  info.stay_days = roundtrip ? std::min(ret.days_after(departure), (uint32_t)UINT8_MAX) : UINT8_MAX;
+  info.departure_day_of_week = types::Weekdays(departure).get_bitmask();
+  info.return_day_of_week = roundtrip ? types::Weekdays(ret).get_bitmask() : 0;
+  info.direct = rand() % 2;
+  info.overriden = false;
+  info.price = 1000 + rand() % 50000;
+  info.index = rand();
+  info.page_id = 0;
+  return info;
+}
+
+//------------------------------------------------------------------------
+// build query from url-like parameters, the same way DealsServer::getTop() does
+//------------------------------------------------------------------------
+template <typename QueryClass>
+std::vector<i::DealInfo> runBenchQuery(shared_mem::Table<i::DealInfo>& table,
+                                       types::ObjectMap params) {
+  using namespace types;
+  Optional<Date> departure_date_from(params, "departure_date_from");
+  Optional<Date> departure_date_to(params, "departure_date_to");
+  Optional<Date> return_date_from(params, "return_date_from");
+  Optional<Date> return_date_to(params, "return_date_to");
+
+  QueryClass query(table);
+  query.origin(Required<IATACode>(params, "origin"));
+  query.destinations(Optional<IATACodes>(params, "destinations"));
+  query.destination_countries(Optional<CountryCodes>(params, "destination_countries"));
+  query.departure_dates(departure_date_from, departure_date_to);
+  query.return_dates(return_date_from, return_date_to);
+  query.departure_weekdays(Optional<Weekdays>(params, "departure_days_of_week"));
+  query.return_weekdays(Optional<Weekdays>(params, "return_days_of_week"));
+  query.stay_days(Optional<Number>(params, "stay_from"), Optional<Number>(params, "stay_to"));
+  query.direct_flights(Optional<Boolean>(params, "direct_flights"));
+  query.roundtrip_flights(Optional<Boolean>(params, "roundtrip_flights"));
+  query.max_lifetime_sec(Optional<Number>(params, "timelimit"));
+  query.result_limit(Optional<Number>(params, "deals_limit"));
+  query.exact_departure_or_return_date(Optional<Date>(params, "departure_or_return_date"));
+  query.calc_departue_return_max_duration(departure_date_from, departure_date_to,
+                                          return_date_from, return_date_to);
+  query.all_combinations(Optional<Boolean>(params, "all_combinations"));
+  return query.execute();
+}
+
+//------------------------------------------------------------------------
+types::ObjectMap getBenchParams(const std::string& query_string) {
+  types::ObjectMap params;
+  for (const auto& param : ::utils::split_string(query_string, "&")) {
+    const auto key_value = ::utils::split_string(param, "=");
+    params.add_object({key_value[0], key_value[1]});
+  }
+  return params;
+}
+
+//------------------------------------------------------------------------
+struct BenchCase {
+  std::string name;
+  std::string query;
+  std::function<std::vector<i::DealInfo>(shared_mem::Table<i::DealInfo>&, types::ObjectMap)> run;
+};
+
+//------------------------------------------------------------------------
+// execute case BENCH_REPEATS times, return average time in microseconds
+//------------------------------------------------------------------------
+uint64_t runBenchCase(const BenchCase& bench, shared_mem::Table<i::DealInfo>& table,
+                      std::vector<i::DealInfo>& result) {
+  const auto params = getBenchParams(bench.query);
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+    result = bench.run(table, params);
+  }
+
+  const auto finish = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() /
+         BENCH_REPEATS;
+}
+
+//------------------------------------------------------------------------
+// data TLB load misses of this process, -1 when cpu or kernel can't count them
+//------------------------------------------------------------------------
+class TlbMisses {
+ public:
+  TlbMisses() {
+#ifdef __linux__
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+  ~TlbMisses() {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  void start() {
+#ifdef __linux__
+    if (fd != -1) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  int64_t stop() {
+    int64_t count = -1;
+#ifdef __linux__
+    if (fd != -1) {
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        count = -1;
+      }
+    }
+#endif
+    return count;
+  }
+
+ private:
+  int fd = -1;
+};
+
+//------------------------------------------------------------------------
+// full scan by name BENCH_REPEATS times, return average time in microseconds
+//------------------------------------------------------------------------
+uint64_t runScan(const std::string& name, shared_mem::Table<i::DealInfo>& table, TlbMisses& tlb,
+                 int64_t& tlb_misses) {
+  const auto params = getBenchParams("origin=MOW");
+  const auto start = std::chrono::steady_clock::now();
+  tlb.start();
+
+  for (int repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+    if (name == "stats") {
+      getStatsRoutine({&table}, 0);
+    } else if (name == "uniqueRoutes") {
+      getUniqueRoutesRoutine({&table});
+    } else {
+      runBenchQuery<SimplyCheapest>(table, params);
+    }
+  }
+
+  tlb_misses = tlb.stop();
+  const auto finish = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() /
+         BENCH_REPEATS;
+}
+
+//------------------------------------------------------------------------
+// first query of a restarted process: attach to the filled table and search,
+// return time in microseconds
+//------------------------------------------------------------------------
+uint64_t runAttachCase(const std::string& table_name, shared_mem::SharedContext& context,
+                       shared_mem::PageStorage storage) {
+  const auto start = std::chrono::steady_clock::now();
+  shared_mem::Table<i::DealInfo> table{table_name, DEALINFO_PAGES, DEALINFO_ELEMENTS,
+                                       DEALS_EXPIRES, context, shared_mem::PageLayout::ROWS,
+                                       storage};
+  runBenchQuery<SimplyCheapest>(table, getBenchParams("origin=MOW"));
+  const auto finish = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+}
+
+//------------------------------------------------------------------------
+// marks deals found in table by their index
+//------------------------------------------------------------------------
+class AppendChecker : public shared_mem::TableProcessor<i::DealInfo> {
+ public:
+  AppendChecker(uint32_t deals_count) : seen(deals_count, false) {
+  }
+  void process_element(const i::DealInfo& deal) final override {
+    if (deal.index < seen.size()) {
+      seen[deal.index] = true;
+    }
+  }
+  std::vector<bool> seen;
+};
+
+//------------------------------------------------------------------------
+// ingest at peak: BENCH_APPEND_PROCESSES processes add deals to one table at once
+// while this one queries it. return time in microseconds, lost is count of deals
+// not found in table after that
+//------------------------------------------------------------------------
+uint64_t runAppendCase(shared_mem::Table<i::DealInfo>& table, uint32_t deals_count,
+                       uint32_t& lost, uint32_t& queries) {
+  const uint32_t per_process = deals_count / BENCH_APPEND_PROCESSES;
+  const auto now = timing::getTimestampSec();
+  const auto start = std::chrono::steady_clock::now();
+
+  for (uint32_t process = 0; process < BENCH_APPEND_PROCESSES; ++process) {
+    if (fork() == 0) {
+      shared_mem::SharedContext context{"Bench"};
+      shared_mem::Table<i::DealInfo> writer{"BenchAppend", DEALINFO_PAGES, DEALINFO_ELEMENTS,
+                                            DEALS_EXPIRES, context, shared_mem::PageLayout::ROWS,
+                                            DEALS_STORAGE};
+      srand(process);
+      for (uint32_t idx = 0; idx < per_process; ++idx) {
+        auto deal = getBenchDeal(now);
+        deal.index = process * per_process + idx;
+        writer.addRecord(&deal);
+      }
+      _exit(0);
+    }
+  }
+
+  // readers don't wait for writers and never see elements that are not written yet
+  queries = 0;
+  const auto params = getBenchParams("origin=MOW");
+  for (uint32_t finished = 0; finished < BENCH_APPEND_PROCESSES;) {
+    while (waitpid(-1, nullptr, WNOHANG) > 0) {
+      ++finished;
+    }
+    for (const auto& deal : runBenchQuery<SimplyCheapest>(table, params)) {
+      assert(deal.price >= 1000 && deal.index < deals_count);
+    }
+    ++queries;
+  }
+  const auto finish = std::chrono::steady_clock::now();
+
+  AppendChecker checker{per_process * BENCH_APPEND_PROCESSES};
+  table.processRecords(checker);
+  lost = std::count(checker.seen.begin(), checker.seen.end(), false);
+  return std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+}
+
+//------------------------------------------------------------------------
+void benchmark(uint32_t deals_count) {
+  shared_mem::SharedContext context{"Bench"};
+  shared_mem::Table<i::DealInfo> rows{"BenchRows", DEALINFO_PAGES, DEALINFO_ELEMENTS,
+                                      DEALS_EXPIRES, context,        shared_mem::PageLayout::ROWS,
+                                      DEALS_STORAGE};
+  shared_mem::Table<i::DealInfo> columns{"BenchCols", DEALINFO_PAGES,
+                                         DEALINFO_ELEMENTS, DEALS_EXPIRES,
+                                         context,        shared_mem::PageLayout::COLUMNS,
+                                         DEALS_STORAGE};
+  // the same rows in page per shared memory object
+  shared_mem::Table<i::DealInfo> files{"BenchFiles", DEALINFO_PAGES, DEALINFO_ELEMENTS,
+                                       DEALS_EXPIRES, context, shared_mem::PageLayout::ROWS,
+                                       shared_mem::PageStorage::FILES};
+  // the same rows in huge pages, if system has them (MEMPAGE_HUGEPAGES_PATH)
+  shared_mem::setHugePages(true);
+  shared_mem::Table<i::DealInfo> huge{"BenchHuge", DEALINFO_PAGES, DEALINFO_ELEMENTS,
+                                      DEALS_EXPIRES, context, shared_mem::PageLayout::ROWS,
+                                      shared_mem::PageStorage::ARENA};
+  shared_mem::setHugePages(false);
+  shared_mem::Table<i::DealInfo> append{"BenchAppend", DEALINFO_PAGES, DEALINFO_ELEMENTS,
+                                        DEALS_EXPIRES, context, shared_mem::PageLayout::ROWS,
+                                        DEALS_STORAGE};
+  rows.cleanup();
+  append.cleanup();
+  columns.cleanup();
+  files.cleanup();
+  huge.cleanup();
+
+  std::cout << "BENCH: adding " << deals_count << " deals to both tables..." << std::endl;
+  srand(1);
+  const auto now = timing::getTimestampSec();
+  for (uint32_t idx = 0; idx < deals_count; ++idx) {
+    auto deal = getBenchDeal(now);
+    rows.addRecord(&deal);
+    columns.addRecord(&deal);
+    files.addRecord(&deal);
+    if (huge.usesHugePages()) {
+      huge.addRecord(&deal);
+    }
+  }
+
+  using cheapest = SimplyCheapest;
+  std::vector<BenchCase> cases = {
+      {"origin", "origin=MOW", runBenchQuery<cheapest>},
+      {"small origin", "origin=VVO", runBenchQuery<cheapest>},
+      {"origin+dates",
+       "origin=MOW&departure_date_from=2017-05-01&departure_date_to=2017-05-31",
+       runBenchQuery<cheapest>},
+      {"origin+dates+destinations",
+       "origin=MOW&departure_date_from=2017-05-01&departure_date_to=2017-06-30&destinations=AAA,"
+       "ABA,ACA,ADA,AEA,AFA,AGA,AHA",
+       runBenchQuery<cheapest>},
+      {"origin+exact_date", "origin=MOW&departure_or_return_date=2017-07-15",
+       runBenchQuery<cheapest>},
+      {"origin+stay+weekdays+direct",
+       "origin=MOW&stay_from=3&stay_to=14&departure_days_of_week=fri,sat&direct_flights=true",
+       runBenchQuery<cheapest>},
+      {"by_date",
+       "origin=MOW&departure_date_from=2017-03-01&departure_date_to=2017-08-31&roundtrip_"
+       "flights=true",
+       runBenchQuery<CheapestByDay>},
+      {"by_country", "origin=LED&roundtrip_flights=false", runBenchQuery<CheapestByCountry>},
+  };
+
+  std::cout << "BENCH: query | rows, us | columns, us | rows/columns" << std::endl;
+  for (const auto& bench : cases) {
+    std::vector<i::DealInfo> rows_result, columns_result;
+    const auto rows_time = runBenchCase(bench, rows, rows_result);
+    const auto columns_time = runBenchCase(bench, columns, columns_result);
+
+    // layouts must give the same answer
+    assert(rows_result.size() == columns_result.size());
+    for (uint32_t idx = 0; idx < rows_result.size(); ++idx) {
+      assert(rows_result[idx].price == columns_result[idx].price);
+    }
+
+    std::cout << "BENCH: " << bench.name << " | " << rows_time << " | " << columns_time << " | "
+              << (columns_time ? (float)rows_time / columns_time : 0) << std::endl;
+  }
+
+  // scan parts of scan threads must give the same answer as the caller alone
+  const uint32_t scan_threads = std::max(std::thread::hardware_concurrency(), 2u);
+  std::cout << "BENCH: query | 1 scan thread, us | " << scan_threads
+            << " scan threads, us | speedup" << std::endl;
+  for (const auto& bench : cases) {
+    std::vector<i::DealInfo> single_result, parts_result;
+    shared_mem::setScanThreads(1);
+    const auto single_time = runBenchCase(bench, rows, single_result);
+    shared_mem::setScanThreads(scan_threads);
+    const auto parts_time = runBenchCase(bench, rows, parts_result);
+
+    assert(single_result.size() == parts_result.size());
+    assert(std::memcmp(single_result.data(), parts_result.data(),
+                       single_result.size() * sizeof(i::DealInfo)) == 0);
+
+    std::cout << "BENCH: " << bench.name << " | " << single_time << " | " << parts_time << " | "
+              << (parts_time ? (float)single_time / parts_time : 0) << std::endl;
+  }
+  shared_mem::setScanThreads(std::thread::hardware_concurrency());
+
+  // full scans without filters
+  for (const auto& name : {"uniqueRoutes", "stats"}) {
+    uint64_t times[2];
+    shared_mem::Table<i::DealInfo>* tables[2] = {&rows, &columns};
+    for (int t = 0; t < 2; ++t) {
+      const auto start = std::chrono::steady_clock::now();
+      for (int repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+        std::string(name) == "stats" ? getStatsRoutine({tables[t]}, 0)
+                                     : getUniqueRoutesRoutine({tables[t]});
+      }
+      const auto finish = std::chrono::steady_clock::now();
+      times[t] = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() /
+                 BENCH_REPEATS;
+    }
+    std::cout << "BENCH: " << name << " | " << times[0] << " | " << times[1] << " | "
+              << (times[1] ? (float)times[0] / times[1] : 0) << std::endl;
+  }
+
+  if (huge.usesHugePages()) {
+    TlbMisses tlb;
+    std::cout << "BENCH: scan | 4k pages, us | huge pages, us | 4k/huge | dTLB misses 4k | "
+                 "dTLB misses huge"
+              << std::endl;
+    for (const auto& name : {"origin", "uniqueRoutes", "stats"}) {
+      int64_t rows_misses, huge_misses;
+      const auto rows_time = runScan(name, rows, tlb, rows_misses);
+      const auto huge_time = runScan(name, huge, tlb, huge_misses);
+      std::cout << "BENCH: " << name << " | " << rows_time << " | " << huge_time << " | "
+                << (huge_time ? (float)rows_time / huge_time : 0) << " | "
+                << (rows_misses < 0 ? "n/a" : std::to_string(rows_misses)) << " | "
+                << (huge_misses < 0 ? "n/a" : std::to_string(huge_misses)) << std::endl;
+    }
+  } else {
+    std::cout << "BENCH: huge pages are not available at " MEMPAGE_HUGEPAGES_PATH << std::endl;
+  }
+
+  const auto files_attach = runAttachCase("BenchFiles", context, shared_mem::PageStorage::FILES);
+  const auto arena_attach = runAttachCase("BenchRows", context, shared_mem::PageStorage::ARENA);
+  std::cout << "BENCH: attach+first query | files, us | arena, us | files/arena" << std::endl;
+  std::cout << "BENCH: origin | " << files_attach << " | " << arena_attach << " | "
+            << (arena_attach ? (float)files_attach / arena_attach : 0) << std::endl;
+
+  uint32_t lost, queries;
+  const auto append_time = runAppendCase(append, deals_count, lost, queries);
+  std::cout << "BENCH: append | processes | deals | us | lost | queries meanwhile" << std::endl;
+  std::cout << "BENCH: append | " << BENCH_APPEND_PROCESSES << " | " << deals_count << " | "
+            << append_time << " | " << lost << " | " << queries << std::endl;
+  assert(lost == 0);
+
+  rows.drop();
+  columns.drop();
+  files.drop();
+  huge.drop();
+  append.drop();
+}
+}  // namespace deals
@@ -11,37 +11,35 @@ void SimplyCheapest::pre_search() {
 
 //---------------------------------------------------------
 void SimplyCheapest::process_deal(const i::DealInfo &deal) {
-  auto &dst_deal = grouped_destinations[deal.destination];
+  grouped_destinations[deal.destination].add(deal);
+}
 
-  if (dst_deal.price == 0 || deal.price <= dst_deal.price) {
-    // ignore same route and dates with lower price, but older timestamp
-    if (utils::equal(deal, dst_deal) && dst_deal.timestamp > deal.timestamp) {
-      return;
-    }
-    dst_deal = deal;
-    // save for price history analysis
-    grouped_destinations_hist[deal.destination].push_back(deal);
-    return;
-  }
+//---------------------------------------------------------
+bool SimplyCheapest::partition_groups(uint32_t partitions) {
+  grouped_destinations.set_partitions(partitions);
+  return true;
+}
 
-  // if  not cheaper but same dates and direct/stops, replace with newer results
-  if (utils::equal(deal, dst_deal) && dst_deal.timestamp < deal.timestamp) {
-    dst_deal = deal;
-    dst_deal.overriden = true;
-    // save for price history analysis
-    grouped_destinations_hist[deal.destination].push_back(deal);
-  }
+//---------------------------------------------------------
+bool SimplyCheapest::share_groups(i::ScanGroups &groups) const {
+  groups = {i::SCAN_GROUP_DESTINATION, 0, true, filter_result_limit};
+  return true;
 }
 
 //----------------------------------------------------------------
 void SimplyCheapest::post_search() {
-  for (auto &v : grouped_destinations_hist) {
-    exec_result.push_back(utils::findCheapestAndLast(v.second));
-  }
+  exec_result.reserve(grouped_destinations.size());
+  grouped_destinations.for_each([this](uint32_t, const utils::CheapestAndLast &group) {
+    exec_result.push_back(group.get());
+  });
 
-  // sort by price ASC
-  std::sort(exec_result.begin(), exec_result.end(),
-            [](const i::DealInfo &a, const i::DealInfo &b) { return a.price < b.price; });
+  // sort by price ASC, only deals which execute() returns. groups come in order of
+  // their partitions, so equal prices are ordered by destination
+  query::sort_limited(exec_result, filter_result_limit,
+                      [](const i::DealInfo &a, const i::DealInfo &b) {
+                        return a.price < b.price ||
+                               (a.price == b.price && a.destination < b.destination);
+                      });
 }
 
 //----------------------------------------------------------------
@@ -1,10 +1,10 @@
 #ifndef SRC_DEALS_CHEAPEST_HPP
 #define SRC_DEALS_CHEAPEST_HPP
 
-#include <unordered_map>
 #include <unordered_set>
 #include "deals_query.hpp"
 #include "deals_types.hpp"
+#include "flat_map.hpp"
 #include "search_query.hpp"
 
 namespace deals {
@@ -20,11 +20,18 @@ class SimplyCheapest : public DealsSearchQuery {
   void pre_search() final override;
   void post_search() final override;
   const std::vector<i::DealInfo> get_result() const final override;
+  bool partition_groups(uint32_t partitions) final override;
+  uint64_t group_key(const i::DealInfo& deal) const final override {
+    return deal.destination;
+  }
+  bool share_groups(i::ScanGroups& groups) const final override;
+  static const bool uses_best_deals = true;
 
  private:
   std::vector<i::DealInfo> exec_result;
-  std::unordered_map<uint32_t, i::DealInfo> grouped_destinations;
-  std::unordered_map<uint32_t, std::vector<i::DealInfo>> grouped_destinations_hist;
+  using Groups = flat_map::PartitionedMap<uint32_t, utils::CheapestAndLast>;
+  flat_map::ThreadMap<SimplyCheapest, Groups> groups;
+  Groups& grouped_destinations = groups.get();
 };
 }  // namespace deals
 
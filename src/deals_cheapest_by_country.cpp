@@ -15,35 +15,35 @@ void CheapestByCountry::pre_search() {
 
 //---------------------------------------------------------
 void CheapestByCountry::process_deal(const i::DealInfo &deal) {
-  auto &dst_deal = grouped_by_country[deal.destination_country];
-
-  if (dst_deal.price == 0 || deal.price <= dst_deal.price) {
-    // ignore same route and dates with lower price, but older timestamp
-    if (utils::equal(deal, dst_deal) && dst_deal.timestamp > deal.timestamp) {
-      return;
-    }
-    dst_deal = deal;
-    grouped_by_country_hist[deal.destination_country].push_back(deal);
-    return;
-  }
+  grouped_by_country[deal.destination_country].add(deal);
+}
 
-  // if  not cheaper but same  destination & dates, replace with newer results
-  if (utils::equal(deal, dst_deal) && dst_deal.timestamp < deal.timestamp) {
-    dst_deal = deal;
-    grouped_by_country_hist[deal.destination_country].push_back(deal);
-    dst_deal.overriden = true;  // it is used in tests
-  }
+//---------------------------------------------------------
+bool CheapestByCountry::partition_groups(uint32_t partitions) {
+  grouped_by_country.set_partitions(partitions);
+  return true;
+}
+
+//---------------------------------------------------------
+bool CheapestByCountry::share_groups(i::ScanGroups &groups) const {
+  groups = {i::SCAN_GROUP_COUNTRY, 0, true, filter_result_limit};
+  return true;
 }
 
 //----------------------------------------------------------------
 void CheapestByCountry::post_search() {
-  for (const auto &deal : grouped_by_country_hist) {
-    exec_result.push_back(utils::findCheapestAndLast(deal.second));
-  }
-
-  // sort by departure_date ASC
-  std::sort(exec_result.begin(), exec_result.end(),
-            [](const i::DealInfo &a, const i::DealInfo &b) { return a.price < b.price; });
+  exec_result.reserve(grouped_by_country.size());
+  grouped_by_country.for_each([this](uint32_t, const utils::CheapestAndLast &group) {
+    exec_result.push_back(group.get());
+  });
+
+  // sort by price ASC, only deals which execute() returns. groups come in order of
+  // their partitions, so equal prices are ordered by country
+  query::sort_limited(exec_result, filter_result_limit,
+                      [](const i::DealInfo &a, const i::DealInfo &b) {
+                        return a.price < b.price || (a.price == b.price &&
+                                                     a.destination_country < b.destination_country);
+                      });
 }
 
 //----------------------------------------------------------------
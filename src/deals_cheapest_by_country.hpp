@@ -1,10 +1,10 @@
 #ifndef SRC_DEALS_CHEAPEST_BY_COUNTRY_HPP
 #define SRC_DEALS_CHEAPEST_BY_COUNTRY_HPP
 
-#include <unordered_map>
 #include <vector>
 #include "deals_query.hpp"
 #include "deals_types.hpp"
+#include "flat_map.hpp"
 #include "search_query.hpp"
 
 namespace deals {
@@ -21,11 +21,17 @@ class CheapestByCountry : public DealsSearchQuery {
   void pre_search() final override;
   void post_search() final override;
   const std::vector<i::DealInfo> get_result() const final override;
+  bool partition_groups(uint32_t partitions) final override;
+  uint64_t group_key(const i::DealInfo& deal) const final override {
+    return deal.destination_country;
+  }
+  bool share_groups(i::ScanGroups& groups) const final override;
 
  private:
   std::vector<i::DealInfo> exec_result;
-  std::unordered_map<uint32_t, i::DealInfo> grouped_by_country;
-  std::unordered_map<uint32_t, std::vector<i::DealInfo>> grouped_by_country_hist;
+  using Groups = flat_map::PartitionedMap<uint32_t, utils::CheapestAndLast>;
+  flat_map::ThreadMap<CheapestByCountry, Groups> groups;
+  Groups& grouped_by_country = groups.get();
 };
 }  // namespace deals
 #endif
\ No newline at end of file
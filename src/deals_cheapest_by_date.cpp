@@ -4,6 +4,7 @@ namespace deals {
 //----------------------------------------------------------------
 void CheapestByDay::pre_search() {
   checkInputParams();
+  prepareGroups();
 
   if (filter_exact_date) {
     if (departure_return_max_duration) {
@@ -17,8 +18,7 @@ void CheapestByDay::pre_search() {
     return;
   }
 
-  if (departure_date_values.duration <= 1) {
-    group_by_return_date = true;
+  if (group_by_return_date) {
     if (return_date_values.duration) {
       filter_result_limit = return_date_values.duration;
     }
@@ -61,19 +61,76 @@ void CheapestByDay::checkInputParams() {
 }
 
 //---------------------------------------------------------
-query::DateValue CheapestByDay::getDateToGroup(const i::DealInfo &deal) {
+// days of dates intervals are known before search, so deals are grouped
+// by offset of their day in interval, the exact date or open intervals
+// leave unknown days range and groups are found by hash then
+void CheapestByDay::prepareGroups() {
+  group_by_return_date =
+      !filter_exact_date && !filter_all_combinations && departure_date_values.duration <= 1;
+
+  // days of limited interval (query dates are days at this point)
+  const auto days = [](bool filter, const query::DateInterval &dates) -> uint32_t {
+    if (!filter || dates.from == 0 || dates.to == UINT32_MAX || dates.from > dates.to ||
+        dates.to - dates.from >= 367) {
+      return 0;
+    }
+    return dates.to - dates.from + 1;
+  };
+
+  if (filter_exact_date) {
+    return;
+  }
+
+  if (filter_all_combinations || !group_by_return_date) {
+    departure_days = days(filter_departure_date, departure_date_values);
+  }
+  if (filter_all_combinations || group_by_return_date) {
+    return_days = days(filter_return_date, return_date_values);
+  }
+
+  if (filter_all_combinations) {
+    dense_groups = departure_days && return_days;
+  } else {
+    dense_groups = group_by_return_date ? return_days : departure_days;
+  }
+
+  if (dense_groups) {
+    groups.resize(std::max(departure_days, 1u) * std::max(return_days, 1u));
+  }
+}
+
+//---------------------------------------------------------
+utils::CheapestAndLast &CheapestByDay::getDateGroup(const i::DealInfo &deal) {
+  if (dense_groups) {
+    return groups[getDenseSlot(deal)];
+  }
+  return groups_by_days[getDaysToGroup(deal)];
+}
+
+//---------------------------------------------------------
+// deals passed DealsFilter, so their days are inside dense intervals
+uint32_t CheapestByDay::getDenseSlot(const i::DealInfo &deal) const {
+  uint32_t slot = departure_days ? deal.departure_date - departure_date_values.from : 0;
+  if (return_days) {
+    slot = slot * return_days + deal.return_date - return_date_values.from;
+  }
+  return slot;
+}
+
+//---------------------------------------------------------
+uint32_t CheapestByDay::getDaysToGroup(const i::DealInfo &deal) const {
   if (filter_exact_date) {
     if (exact_date_value == deal.return_date) {
       return deal.departure_date;
     }
 
     // exact_date_value == deal.departure_date
-    // set first bit to 1 for group return dates separately
-    return deal.return_date | 0x80000000;
+    // days are 16 bits, set bit 16 to group return dates separately
+    return deal.return_date | 0x10000;
   }
 
   if (filter_all_combinations) {
-    return (deal.departure_date << 18) ^ (deal.return_date);
+    return ((uint32_t)deal.departure_date << 16) | deal.return_date;
   }
 
   if (group_by_return_date) {
@@ -85,61 +142,87 @@ query::DateValue CheapestByDay::getDateToGroup(const i::DealInfo &deal) {
 
 //---------------------------------------------------------
 void CheapestByDay::process_deal(const i::DealInfo &deal) {
-  //
-  const auto &date = getDateToGroup(deal);
-  auto &dst_deal = grouped_by_date[date];
-
-  if (dst_deal.price == 0 || deal.price <= dst_deal.price) {
-    // ignore same route and dates with lower price, but older timestamp
-    if (utils::equal(deal, dst_deal) && dst_deal.timestamp > deal.timestamp) {
-      return;
-    }
-    dst_deal = deal;
-    grouped_by_date_hist[date].push_back(deal);
-    return;
-  }
+  getDateGroup(deal).add(deal);
+}
+
+//---------------------------------------------------------
+// dense groups are different slots, any partition of them is changed by one thread
+bool CheapestByDay::partition_groups(uint32_t partitions) {
+  groups_by_days.set_partitions(partitions);
+  return true;
+}
 
-  // if  not cheaper but same destination & dates, replace with newer results
-  if (utils::equal(deal, dst_deal) && dst_deal.timestamp < deal.timestamp) {
-    dst_deal = deal;
-    grouped_by_date_hist[date].push_back(deal);
-    dst_deal.overriden = true;  // it is used in tests
+//---------------------------------------------------------
+uint64_t CheapestByDay::group_key(const i::DealInfo &deal) const {
+  return dense_groups ? getDenseSlot(deal) : getDaysToGroup(deal);
+}
+
+//---------------------------------------------------------
+// groups by days of getDaysToGroup(), dense groups are the same days.
+// result is ordered by them in both cases
+bool CheapestByDay::share_groups(i::ScanGroups &groups) const {
+  groups = {i::SCAN_GROUP_DEPARTURE_DATE, 0, false, filter_result_limit};
+  if (filter_exact_date) {
+    groups.key = i::SCAN_GROUP_EXACT_DATE;
+    groups.exact_date = exact_date_value;
+  } else if (filter_all_combinations) {
+    groups.key = i::SCAN_GROUP_DATES;
+  } else if (group_by_return_date) {
+    groups.key = i::SCAN_GROUP_RETURN_DATE;
   }
+  return true;
 }
 
 //----------------------------------------------------------------
+// dense groups are already ordered by days, so result is one walk over them
 void CheapestByDay::post_search() {
-  for (const auto &deal : grouped_by_date_hist) {
-    exec_result.push_back(utils::findCheapestAndLast(deal.second));
+  if (!dense_groups) {
+    exec_result.reserve(groups_by_days.size());
+    groups_by_days.for_each([this](uint32_t, const utils::CheapestAndLast &group) {
+      exec_result.push_back(group.get());
+    });
+    sortResult();
+    return;
   }
+
+  exec_result.reserve(groups.size());
+  for (const auto &group : groups) {
+    if (!group.empty()) {
+      exec_result.push_back(group.get());
+    }
+  }
+}
+
+//----------------------------------------------------------------
+void CheapestByDay::sortResult() {
   const auto exact_date = exact_date_value;
 
   if (filter_exact_date) {
-    std::sort(exec_result.begin(), exec_result.end(),
-              [&exact_date](const i::DealInfo &a, const i::DealInfo &b) {
-                if (exact_date == a.return_date && exact_date == b.return_date) {
-                  return a.departure_date < b.departure_date;
-                }
-                if (exact_date == a.departure_date && exact_date == b.departure_date) {
-                  return a.return_date < b.return_date;
-                }
-                if (exact_date == a.return_date) {
-                  return true;
-                }
-                return false;
-              });
+    query::sort_limited(exec_result, filter_result_limit,
+                        [&exact_date](const i::DealInfo &a, const i::DealInfo &b) {
+                          if (exact_date == a.return_date && exact_date == b.return_date) {
+                            return a.departure_date < b.departure_date;
+                          }
+                          if (exact_date == a.departure_date && exact_date == b.departure_date) {
+                            return a.return_date < b.return_date;
+                          }
+                          if (exact_date == a.return_date) {
+                            return true;
+                          }
+                          return false;
+                        });
   } else if (group_by_return_date) {
-    std::sort(
-        exec_result.begin(), exec_result.end(),
+    query::sort_limited(
+        exec_result, filter_result_limit,
         [](const i::DealInfo &a, const i::DealInfo &b) { return a.return_date < b.return_date; });
   } else {
-    std::sort(exec_result.begin(), exec_result.end(),
-              [](const i::DealInfo &a, const i::DealInfo &b) {
-                if (a.departure_date == b.departure_date) {
-                  return a.return_date < b.return_date;
-                }
-                return a.departure_date < b.departure_date;
-              });
+    query::sort_limited(exec_result, filter_result_limit,
+                        [](const i::DealInfo &a, const i::DealInfo &b) {
+                          if (a.departure_date == b.departure_date) {
+                            return a.return_date < b.return_date;
+                          }
+                          return a.departure_date < b.departure_date;
+                        });
   }
 }
 
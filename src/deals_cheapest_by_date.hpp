@@ -1,10 +1,10 @@
 #ifndef SRC_DEALS_CHEAPEST_BY_DATE_HPP
 #define SRC_DEALS_CHEAPEST_BY_DATE_HPP
 
-#include <unordered_map>
 #include <vector>
 #include "deals_query.hpp"
 #include "deals_types.hpp"
+#include "flat_map.hpp"
 #include "search_query.hpp"
 
 namespace deals {
@@ -21,14 +21,30 @@ class CheapestByDay : public DealsSearchQuery {
   void pre_search() final override;
   void post_search() final override;
   const std::vector<i::DealInfo> get_result() const final override;
+  bool partition_groups(uint32_t partitions) final override;
+  uint64_t group_key(const i::DealInfo& deal) const final override;
+  bool share_groups(i::ScanGroups& groups) const final override;
+  static const bool uses_best_deals = true;
 
  private:
   void checkInputParams();
-  query::DateValue getDateToGroup(const i::DealInfo& deal);
+  void prepareGroups();
+  utils::CheapestAndLast& getDateGroup(const i::DealInfo& deal);
+  uint32_t getDenseSlot(const i::DealInfo& deal) const;
+  uint32_t getDaysToGroup(const i::DealInfo& deal) const;
+  void sortResult();
 
   std::vector<i::DealInfo> exec_result;
-  std::unordered_map<uint32_t, i::DealInfo> grouped_by_date;
-  std::unordered_map<uint32_t, std::vector<i::DealInfo>> grouped_by_date_hist;
+  // groups are indexed by days offset in query dates intervals (dense_groups),
+  // so they are in result order, or found by days of deal in groups_by_days
+  // when intervals are open and sorted after search
+  std::vector<utils::CheapestAndLast> groups;
+  using Groups = flat_map::PartitionedMap<uint32_t, utils::CheapestAndLast>;
+  flat_map::ThreadMap<CheapestByDay, Groups> groups_map;
+  Groups& groups_by_days = groups_map.get();
+  bool dense_groups = false;
+  uint32_t departure_days = 0;  // dense groups of every departure day, 0 - not grouped by it
+  uint32_t return_days = 0;     // dense groups of every return day, 0 - not grouped by it
   bool group_by_return_date = false;
 };
 }  // namespace deals
@@ -1,7 +1,9 @@
 #include <cassert>
 #include <cinttypes>
 #include <climits>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 
 #include "deals_database.hpp"
 #include "timing.hpp"
@@ -12,11 +14,25 @@ namespace deals {
 //---------------------------------------------------------
 DealsDatabase::DealsDatabase()
     : db_context{DEALS_DB_NAME},
-      db_index{DEALINFO_TABLENAME, DEALINFO_PAGES, DEALINFO_ELEMENTS, DEALS_EXPIRES, db_context},
-      db_data{DEALDATA_TABLENAME, DEALDATA_PAGES, DEALDATA_ELEMENTS, DEALS_EXPIRES, db_context} {
+      db_data{DEALDATA_TABLENAME, DEALDATA_PAGES,  DEALDATA_ELEMENTS, DEALS_EXPIRES,
+              db_context,         shared_mem::PageLayout::ROWS, DEALS_STORAGE},
+      postings{shards},
+      offers{shards, postings} {
+  for (uint16_t shard = 0; shard < DEALS_SHARDS; ++shard) {
+    shards.emplace_back(new DealsShard{shard, db_context});
+  }
+  if (scanSharing()) {
+    DealsTables tables;
+    for (auto &shard : shards) {
+      tables.push_back(&shard->index);
+      tables.push_back(&shard->best);
+    }
+    scan_queue.reset(new DealsScanQueue{DEALSCAN_NAME, tables});
+  }
   if (TEST_BUILD) {
     std::cout << "!!! TEST BUILD !!!!" << std::endl;
   }
+  migrate_legacy_tables();
 }
 
 //---------------------------------------------------------
@@ -24,7 +40,12 @@ DealsDatabase::DealsDatabase()
 //---------------------------------------------------------
 void DealsDatabase::truncate() {
   db_data.cleanup();
-  db_index.cleanup();
+  for (auto &shard : shards) {
+    shard->index.cleanup();
+    shard->best.cleanup();
+  }
+  postings.clear();
+  offers.clear();
 }
 
 //---------------------------------------------------------
@@ -37,13 +58,6 @@ void DealsDatabase::addDeal(const types::Required<types::IATACode> &origin,
                             const types::Optional<types::Date> &return_date,
                             const types::Required<types::Boolean> &direct_flight,
                             const types::Required<types::Number> &price, const std::string &data) {
-  // convert string to i::DealData (byte array)
-  const auto data_pointer = (deals::i::DealData *)data.c_str();
-  const uint32_t data_size = data.length();
-
-  // 1) Add data and get data offset in db page --------------------------
-  auto result = db_data.addRecord(data_pointer, data_size);
-
   const types::Weekdays departure_day_of_week(departure_date);
   const types::Weekdays return_day_of_week(return_date);
 
@@ -52,28 +66,49 @@ void DealsDatabase::addDeal(const types::Required<types::IATACode> &origin,
   info.origin = origin.get_code();
   info.destination = destination.get_code();
   info.destination_country = destination_country.get_code();
-  info.departure_date = departure_date.get_code();
+  info.departure_date = departure_date.get_days();
   info.overriden = false;
   info.direct = direct_flight.isTrue();
   info.departure_day_of_week = departure_day_of_week.get_bitmask();
   info.return_day_of_week = return_day_of_week.get_bitmask();
   info.price = price.get_value();
 
-  strncpy(info.page_name, result.page_name.c_str(), MEMPAGE_NAME_MAX_LEN);
-  info.index = result.index;
-  info.size = result.size;
-
   if (return_date.isUndefined()) {
     info.stay_days = UINT8_MAX;
     info.return_date = 0;
   } else {
-    info.return_date = return_date.get_code();
-    uint32_t days = return_date.days_after(departure_date);
+    info.return_date = return_date.get_days();
+    const uint32_t days = info.return_date - info.departure_date;
     info.stay_days = days > UINT8_MAX ? UINT8_MAX : days;
   }
 
-  // 2) Add deal to index, with data position information --------------------------
-  auto di_result = db_index.addRecord(&info);
+  add_deal(info, data);
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  add_deal
+//---------------------------------------------------------
+void DealsDatabase::add_deal(i::DealInfo &info, const std::string &data) {
+  // convert string to i::DealData (byte array) prefixed with its size
+  const uint32_t data_size = data.length();
+  std::string record(sizeof(data_size), 0);
+  std::memcpy(&record[0], &data_size, sizeof(data_size));
+  record += data;
+
+  // 1) Add data and get data offset in db page --------------------------
+  auto result = db_data.addRecord((i::DealData *)record.c_str(), record.length());
+
+  // 2) Update deal of the same offer, with data position information --------------
+  if (offers.upsert(info, result.page_id, result.index)) {
+    return;
+  }
+
+  // 3) No room for new offer: add deal to index and best deals as is -------------
+  info.page_id = result.page_id;
+  info.index = result.index;
+  auto &shard = *shards[getOriginShard(info.origin)];
+  postings.add(info, false, shard.index.addRecord(&info));
+  postings.add(info, true, shard.best.addRecord(&info));
 }
 
 /*---------------------------------------------------------
@@ -83,14 +118,23 @@ std::vector<DealInfo> DealsDatabase::fill_deals_with_data(std::vector<i::DealInf
   std::vector<DealInfo> result;
 
   for (const auto &deal : i_deals) {
-    auto deal_data = i::sharedDealData{db_data, deal.page_name, deal.index, deal.size};
+    // size of data is stored in front of it
+    uint16_t data_page_id = deal.page_id;
+    uint32_t data_index = deal.index;
+    if (deal.page_id == DEALOFFERS_PAGE_ID) {
+      offers.get_data(deal.index, data_page_id, data_index);
+    }
+    auto deal_data = i::sharedDealData{db_data, data_page_id, data_index, sizeof(uint32_t)};
     auto data_pointer = (char *)deal_data.get_element_data();
-    std::string data = {data_pointer, deal.size};
+    uint32_t data_size;
+    std::memcpy(&data_size, data_pointer, sizeof(data_size));
+    std::string data = {data_pointer + sizeof(data_size), data_size};
 
     if (TEST_BUILD) {
       std::shared_ptr<DealInfoTest> testdata(new DealInfoTest{
           types::code_to_origin(deal.origin), types::code_to_origin(deal.destination),
-          types::int_to_date(deal.departure_date), types::int_to_date(deal.return_date),
+          types::int_to_date(types::days_to_date(deal.departure_date)),
+          deal.return_date ? types::int_to_date(types::days_to_date(deal.return_date)) : "",
           deal.timestamp, deal.price, deal.stay_days, deal.departure_day_of_week,
           deal.return_day_of_week, deal.destination_country, deal.direct, deal.overriden});
       std::cout << "TEST MODE" << std::endl;
@@ -108,14 +152,173 @@ std::vector<DealInfo> DealsDatabase::fill_deals_with_data(std::vector<i::DealInf
 // DealsDatabase  getUniqueRoutesDeals
 //--------------------------------------------------------
 const std::string DealsDatabase::getUniqueRoutesDeals() {
-  return getUniqueRoutesRoutine(this->db_index);
+  return getUniqueRoutesRoutine(get_index_tables());
+}
+
+//---------------------------------------------------------
+// DealsDatabase  startUniqueRoutes
+//--------------------------------------------------------
+std::unique_ptr<DealsJob<std::string>> DealsDatabase::startUniqueRoutes() {
+  return std::unique_ptr<DealsJob<std::string>>{new UniqueRoutesScan(get_index_tables())};
 }
 
 //---------------------------------------------------------
 // DealsDatabase  stat
 //--------------------------------------------------------
 const std::string DealsDatabase::getStats() {
-  return getStatsRoutine(this->db_index);
+  return getStatsRoutine(get_index_tables(), this->db_data.getElementsCount());
+}
+
+//---------------------------------------------------------
+// DealsDatabase  runScanTasks
+//--------------------------------------------------------
+void DealsDatabase::runScanTasks() {
+  if (!scan_queue) {
+    return;
+  }
+  // the process has own requests to serve, not more than the queue holds
+  for (uint32_t task = 0; task < DEALSCAN_TASKS && scan_queue->run_task(); ++task) {
+  }
+}
+
+//---------------------------------------------------------
+// DealsDatabase  get_index_tables
+//--------------------------------------------------------
+DealsTables DealsDatabase::get_index_tables() {
+  DealsTables tables;
+  for (auto &shard : shards) {
+    tables.push_back(&shard->index);
+  }
+  return tables;
+}
+
+//---------------------------------------------------------
+// DealsDatabase  migrate_legacy_tables
+//---------------------------------------------------------
+namespace {
+// i::DealInfo of tables before DEALS_LAYOUT_VERSION 2
+struct LegacyDealInfo {
+  uint32_t timestamp;
+  uint32_t origin;
+  uint32_t destination;
+  uint32_t departure_date;
+  uint32_t return_date;
+  uint32_t price;
+  uint8_t stay_days;
+  uint8_t destination_country;
+  uint8_t departure_day_of_week;
+  uint8_t return_day_of_week;
+  bool direct;
+  bool overriden;
+  char page_name[MEMPAGE_NAME_MAX_LEN];
+  uint32_t index;
+  uint32_t size;
+};
+
+class LegacyDealsCollector : public shared_mem::TableProcessor<LegacyDealInfo> {
+ public:
+  LegacyDealsCollector(uint32_t min_timestamp) : min_timestamp(min_timestamp) {
+  }
+  std::vector<LegacyDealInfo> deals;
+
+ protected:
+  void process_element(const LegacyDealInfo &deal) final override {
+    if (deal.timestamp > min_timestamp) {
+      deals.push_back(deal);
+    }
+  }
+
+ private:
+  const uint32_t min_timestamp;
+};
+}  // namespace
+
+// first process of new version copies not expired deals of legacy tables,
+// processes of previous version could still work with them (rolling restart):
+// legacy tables are only read, layout version is set when deals are copied.
+// legacy tables are removed on start when nothing is written to them for DEALS_EXPIRES
+void DealsDatabase::migrate_legacy_tables() {
+  using LegacyIndex = shared_mem::LegacyTable<LegacyDealInfo>;
+  if (!LegacyIndex::exists(DEALS_LEGACY_INFO_TABLENAME)) {
+    db_context.shm.layout_version = DEALS_LAYOUT_VERSION;
+    return;
+  }
+
+  locks::CriticalSection migration_lock(DEALS_DB_NAME "Migration");
+  migration_lock.enter();
+  locks::AutoCloser guard(migration_lock);
+
+  try {
+    LegacyIndex legacy_index{DEALS_LEGACY_INFO_TABLENAME, DEALS_LEGACY_INFO_PAGES,
+                             DEALS_LEGACY_INFO_ELEMENTS};
+    shared_mem::LegacyTable<i::DealData> legacy_data{
+        DEALS_LEGACY_DATA_TABLENAME, DEALS_LEGACY_DATA_PAGES, DEALS_LEGACY_DATA_ELEMENTS};
+    const uint32_t min_timestamp =
+        std::max(db_context.shm.global_expire_at, timing::getTimestampSec()) - DEALS_EXPIRES;
+    LegacyDealsCollector legacy{min_timestamp};
+    legacy_index.processRecords(legacy, db_context.shm.global_expire_at);
+
+    if (db_context.shm.layout_version >= DEALS_LAYOUT_VERSION) {
+      if (legacy.deals.empty()) {
+        std::cout << "REMOVING legacy deals tables" << std::endl;
+        legacy_index.drop();
+        legacy_data.drop();
+      }
+      return;
+    }
+
+    uint32_t migrated = 0;
+    uint32_t skipped = 0;
+    for (const auto &deal : legacy.deals) {
+      i::DealInfo info;
+      uint16_t page_id;
+      // deal with broken page name or date out of i::DealInfo days is skipped,
+      // the others are still migrated
+      try {
+        // legacy page name is "DealsData:<page_id>"
+        const std::string page_name{deal.page_name,
+                                    strnlen(deal.page_name, MEMPAGE_NAME_MAX_LEN)};
+        page_id = std::stoul(page_name.substr(page_name.find(':') + 1));
+        info.departure_date = types::date_to_days(deal.departure_date);
+        info.return_date = deal.return_date ? types::date_to_days(deal.return_date) : 0;
+      } catch (types::Error &) {
+        ++skipped;
+        continue;
+      } catch (std::logic_error &) {
+        ++skipped;
+        continue;
+      }
+
+      const auto deal_data = legacy_data.getRecords(page_id, deal.index, deal.size);
+      if (deal_data == nullptr) {
+        continue;  // data page is released already
+      }
+      const std::string data = {(const char *)deal_data, deal.size};
+
+      info.timestamp = deal.timestamp;
+      info.origin = deal.origin;
+      info.destination = deal.destination;
+      info.price = deal.price;
+      info.stay_days = deal.stay_days;
+      info.destination_country = deal.destination_country;
+      info.departure_day_of_week = deal.departure_day_of_week;
+      info.return_day_of_week = deal.return_day_of_week;
+      info.direct = deal.direct;
+      info.overriden = false;
+      add_deal(info, data);
+      ++migrated;
+    }
+    if (skipped) {
+      std::cerr << "ERROR legacy deals skipped:" << skipped << std::endl;
+    }
+    std::cout << "MIGRATED legacy deals:" << migrated << std::endl;
+    db_context.shm.layout_version = DEALS_LAYOUT_VERSION;
+  } catch (types::Error err) {
+    // layout version is not set, next process of new version will try again
+    std::cerr << "ERROR legacy deals migration failed:" << err.message << std::endl;
+  } catch (std::exception &err) {
+    std::cerr << "ERROR legacy deals migration failed:" << err.what() << std::endl;
+  }
 }
 
 }  // deals namespace
@@ -4,6 +4,8 @@
 #include <unordered_map>
 #include "deals_cheapest.hpp"
 #include "deals_cheapest_by_date.hpp"
+#include "deals_offers.hpp"
+#include "deals_scan_queue.hpp"
 #include "deals_stats.hpp"
 #include "deals_types.hpp"
 #include "deals_unique_routes.hpp"
@@ -16,6 +18,7 @@ namespace deals {
 
 #define TEST_BUILD 0
 void unit_test();
+void benchmark(uint32_t deals_count);
 
 //------------------------------------------------------------
 // DealsDatabase
@@ -52,21 +55,74 @@ class DealsDatabase {
                                   const types::Optional<types::Date>& departure_or_return_date,
                                   const types::Optional<types::Boolean>& all_combinations);
 
+  // searchFor() by time slices, query is prepared already
+  template <typename QueryClass>
+  std::unique_ptr<DealsJob<std::vector<DealInfo>>> startSearch(
+      const types::Required<types::IATACode>& origin,
+      const types::Optional<types::IATACodes>& destinations,
+      const types::Optional<types::CountryCodes>& destination_countries,
+      const types::Optional<types::Date>& departure_date_from,
+      const types::Optional<types::Date>& departure_date_to,
+      const types::Optional<types::Weekdays>& departure_days_of_week,
+      const types::Optional<types::Date>& return_date_from,
+      const types::Optional<types::Date>& return_date_to,
+      const types::Optional<types::Weekdays>& return_days_of_week,
+      const types::Optional<types::Number>& stay_from,
+      const types::Optional<types::Number>& stay_to,
+      const types::Optional<types::Boolean>& direct_flights,
+      const types::Optional<types::Number>& limit,
+      const types::Optional<types::Number>& max_lifetime_sec,
+      const types::Optional<types::Boolean>& roundtrip_flights,
+      const types::Optional<types::Date>& departure_or_return_date,
+      const types::Optional<types::Boolean>& all_combinations);
+
   const std::string getUniqueRoutesDeals();
+  // getUniqueRoutesDeals() by time slices
+  std::unique_ptr<DealsJob<std::string>> startUniqueRoutes();
   const std::string getStats();
+  // scan parts of shared scans of sibling processes (setScanSharing()), called when idle
+  void runScanTasks();
 
   // clear database
   void truncate();
 
  private:
+  // query of startSearch(), its deals are filled with data when it is done
+  template <typename QueryClass>
+  class SearchJob : public DealsJob<std::vector<DealInfo>> {
+   public:
+    SearchJob(DealsDatabase& db, shared_mem::Table<i::DealInfo>& table) : db(db), query(table) {
+    }
+    bool resume(int64_t deadline_ms) final override {
+      if (!query.resume(deadline_ms)) {
+        return false;
+      }
+      result = db.fill_deals_with_data(query.finish());
+      return true;
+    }
+
+    DealsDatabase& db;
+    QueryClass query;
+  };
+
   // internal <i::DealInfo> contain shared memory page name and
   // information offsets. It's not useful anywhere outside
   // Let's transform internal format to external <DealInfo>
   std::vector<DealInfo> fill_deals_with_data(std::vector<i::DealInfo> i_deals);
+  // store data and deal pointing to it
+  void add_deal(i::DealInfo& info, const std::string& data);
+  // move deals from tables of previous DEALS_LAYOUT_VERSION
+  void migrate_legacy_tables();
+  // DealsInfo tables of all shards
+  DealsTables get_index_tables();
 
   shared_mem::SharedContext db_context;
-  shared_mem::Table<i::DealInfo> db_index;
+  DealsShards shards;  // deals by origin
   shared_mem::Table<i::DealData> db_data;
+  DealsPostings postings;
+  DealsOffers offers;
+  // index and best table of every shard, by shard. scanSharing() only
+  std::unique_ptr<DealsScanQueue> scan_queue;
 
   friend void unit_test();
 };
@@ -97,7 +153,50 @@ std::vector<DealInfo> DealsDatabase::searchFor(
     const types::Optional<types::Boolean>& roundtrip_flights,
     const types::Optional<types::Date>& departure_or_return_date,
     const types::Optional<types::Boolean>& all_combinations) {
-  QueryClass query(db_index);  // <- table processed by search class
+  return std::move(startSearch<QueryClass>(
+                       origin, destinations, destination_countries, departure_date_from,
+                       departure_date_to, departure_days_of_week, return_date_from, return_date_to,
+                       return_days_of_week, stay_from, stay_to, direct_flights, limit,
+                       max_lifetime_sec, roundtrip_flights, departure_or_return_date,
+                       all_combinations)
+                       ->run());
+}
+
+/*---------------------------------------------------------
+* DealsDatabase  startSearch
+*---------------------------------------------------------*/
+template <typename QueryClass>
+std::unique_ptr<DealsJob<std::vector<DealInfo>>> DealsDatabase::startSearch(
+    const types::Required<types::IATACode>& origin,
+    const types::Optional<types::IATACodes>& destinations,
+    const types::Optional<types::CountryCodes>& destination_countries,
+    const types::Optional<types::Date>& departure_date_from,
+    const types::Optional<types::Date>& departure_date_to,
+    const types::Optional<types::Weekdays>& departure_days_of_week,
+    const types::Optional<types::Date>& return_date_from,
+    const types::Optional<types::Date>& return_date_to,
+    const types::Optional<types::Weekdays>& return_days_of_week,
+    const types::Optional<types::Number>& stay_from,  //
+    const types::Optional<types::Number>& stay_to,
+    const types::Optional<types::Boolean>& direct_flights,
+    const types::Optional<types::Number>& limit,
+    const types::Optional<types::Number>& max_lifetime_sec,
+    const types::Optional<types::Boolean>& roundtrip_flights,
+    const types::Optional<types::Date>& departure_or_return_date,
+    const types::Optional<types::Boolean>& all_combinations) {
+  // best deals are enough for queries of cheapest deals, but there are no hidden
+  // deals of one direct flag which are needed if only this flag is searched
+  const bool use_best = QueryClass::uses_best_deals && direct_flights.isUndefined();
+  const uint16_t shard_id = getOriginShard(origin.get_code());
+  auto& shard = *shards[shard_id];
+  // table processed by search class
+  std::unique_ptr<SearchJob<QueryClass>> job{
+      new SearchJob<QueryClass>(*this, use_best ? shard.best : shard.index)};
+  auto& query = job->query;
+  query.use_postings(postings, use_best);
+  if (scan_queue) {
+    query.use_scan_queue(*scan_queue, shard_id * 2 + use_best);
+  }
 
   query.origin(origin);
   query.destinations(destinations);
@@ -115,8 +214,9 @@ std::vector<DealInfo> DealsDatabase::searchFor(
   query.calc_departue_return_max_duration(departure_date_from, departure_date_to, return_date_from,
                                           return_date_to);
   query.all_combinations(all_combinations);
-  // load deals data from data pages (DealData shared memory pagers)
-  return fill_deals_with_data(query.execute());
+  query.start();
+  // deals data are loaded from data pages (DealData shared memory pagers) at the end
+  return std::move(job);
 }
 }  // namespace deals
 #endif
\ No newline at end of file
@@ -0,0 +1,397 @@
+#include "deals_filter.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_HAS_AVX2 1
+#define FILTER_AVX2 __attribute__((target("avx2")))
+#else
+#define FILTER_HAS_AVX2 0
+#endif
+
+namespace deals {
+namespace {
+//------------------------------------------------------------
+// scalar predicates for values[from..count),
+// bit N of result is set when values[N] match
+//------------------------------------------------------------
+template <typename VALUE_T>
+uint64_t range_mask(const VALUE_T* values, uint32_t from, uint32_t count, uint32_t min,
+                    uint32_t max) {
+  uint64_t mask = 0;
+  for (uint32_t idx = from; idx < count; ++idx) {
+    mask |= (uint64_t)((values[idx] >= min) & (values[idx] <= max)) << idx;
+  }
+  return mask;
+}
+
+uint64_t bits_mask(const uint8_t* values, uint32_t from, uint32_t count, uint8_t bits) {
+  uint64_t mask = 0;
+  for (uint32_t idx = from; idx < count; ++idx) {
+    mask |= (uint64_t)((values[idx] & bits) != 0) << idx;
+  }
+  return mask;
+}
+
+template <typename VALUE_T>
+uint64_t either_mask(const VALUE_T* first, const VALUE_T* second, uint32_t from, uint32_t count,
+                     uint32_t value) {
+  uint64_t mask = 0;
+  for (uint32_t idx = from; idx < count; ++idx) {
+    mask |= (uint64_t)((first[idx] == value) | (second[idx] == value)) << idx;
+  }
+  return mask;
+}
+
+#if FILTER_HAS_AVX2
+//------------------------------------------------------------
+// AVX2 predicates: 8 x uint32, 32 x uint16 or 32 x uint8 values per step,
+// tail is checked by scalar code
+//------------------------------------------------------------
+FILTER_AVX2 uint64_t range_mask_avx2(const uint32_t* values, uint32_t count, uint32_t min,
+                                     uint32_t max) {
+  const __m256i min_value = _mm256_set1_epi32(min);
+  const __m256i max_value = _mm256_set1_epi32(max);
+  uint64_t mask = 0;
+  uint32_t idx = 0;
+
+  for (; idx + 8 <= count; idx += 8) {
+    const __m256i value = _mm256_loadu_si256((const __m256i*)(values + idx));
+    // unsigned compare: min <= value <=> max(value, min) == value
+    const __m256i above = _mm256_cmpeq_epi32(_mm256_max_epu32(value, min_value), value);
+    const __m256i below = _mm256_cmpeq_epi32(_mm256_min_epu32(value, max_value), value);
+    const __m256i inside = _mm256_and_si256(above, below);
+    const uint32_t matched = _mm256_movemask_ps(_mm256_castsi256_ps(inside));
+    mask |= (uint64_t)matched << idx;
+  }
+
+  return mask | range_mask(values, idx, count, min, max);
+}
+
+FILTER_AVX2 uint64_t range_mask_avx2(const uint8_t* values, uint32_t count, uint32_t min,
+                                     uint32_t max) {
+  const __m256i min_value = _mm256_set1_epi8((uint8_t)min);
+  const __m256i max_value = _mm256_set1_epi8((uint8_t)max);
+  uint64_t mask = 0;
+  uint32_t idx = 0;
+
+  for (; idx + 32 <= count; idx += 32) {
+    const __m256i value = _mm256_loadu_si256((const __m256i*)(values + idx));
+    const __m256i above = _mm256_cmpeq_epi8(_mm256_max_epu8(value, min_value), value);
+    const __m256i below = _mm256_cmpeq_epi8(_mm256_min_epu8(value, max_value), value);
+    const uint32_t matched = _mm256_movemask_epi8(_mm256_and_si256(above, below));
+    mask |= (uint64_t)matched << idx;
+  }
+
+  return mask | range_mask(values, idx, count, min, max);
+}
+
+// two vectors of 16 x uint16 compare results -> 32 bits mask
+FILTER_AVX2 uint32_t movemask_epi16x2(__m256i low, __m256i high) {
+  // packs works inside 128 bit lanes: [low0 high0 low1 high1] -> [low0 low1 high0 high1]
+  const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+  return _mm256_movemask_epi8(packed);
+}
+
+FILTER_AVX2 __m256i inside_epu16(__m256i value, __m256i min_value, __m256i max_value) {
+  const __m256i above = _mm256_cmpeq_epi16(_mm256_max_epu16(value, min_value), value);
+  const __m256i below = _mm256_cmpeq_epi16(_mm256_min_epu16(value, max_value), value);
+  return _mm256_and_si256(above, below);
+}
+
+FILTER_AVX2 __m256i either_epu16(const uint16_t* first, const uint16_t* second,
+                                 __m256i expected) {
+  const __m256i first_value = _mm256_loadu_si256((const __m256i*)first);
+  const __m256i second_value = _mm256_loadu_si256((const __m256i*)second);
+  return _mm256_or_si256(_mm256_cmpeq_epi16(first_value, expected),
+                         _mm256_cmpeq_epi16(second_value, expected));
+}
+
+FILTER_AVX2 uint64_t range_mask_avx2(const uint16_t* values, uint32_t count, uint32_t min,
+                                     uint32_t max) {
+  if (min > UINT16_MAX) {
+    return 0;
+  }
+  const __m256i min_value = _mm256_set1_epi16((uint16_t)min);
+  const __m256i max_value = _mm256_set1_epi16((uint16_t)std::min(max, (uint32_t)UINT16_MAX));
+  uint64_t mask = 0;
+  uint32_t idx = 0;
+
+  for (; idx + 32 <= count; idx += 32) {
+    const __m256i low = _mm256_loadu_si256((const __m256i*)(values + idx));
+    const __m256i high = _mm256_loadu_si256((const __m256i*)(values + idx + 16));
+    const uint32_t matched = movemask_epi16x2(inside_epu16(low, min_value, max_value),
+                                              inside_epu16(high, min_value, max_value));
+    mask |= (uint64_t)matched << idx;
+  }
+
+  return mask | range_mask(values, idx, count, min, max);
+}
+
+FILTER_AVX2 uint64_t bits_mask_avx2(const uint8_t* values, uint32_t count, uint8_t bits) {
+  const __m256i bits_value = _mm256_set1_epi8(bits);
+  const __m256i zero = _mm256_setzero_si256();
+  uint64_t mask = 0;
+  uint32_t idx = 0;
+
+  for (; idx + 32 <= count; idx += 32) {
+    const __m256i value = _mm256_loadu_si256((const __m256i*)(values + idx));
+    const __m256i none = _mm256_cmpeq_epi8(_mm256_and_si256(value, bits_value), zero);
+    const uint32_t matched = ~(uint32_t)_mm256_movemask_epi8(none);
+    mask |= (uint64_t)matched << idx;
+  }
+
+  return mask | bits_mask(values, idx, count, bits);
+}
+
+FILTER_AVX2 uint64_t either_mask_avx2(const uint16_t* first, const uint16_t* second,
+                                      uint32_t count, uint32_t value) {
+  if (value > UINT16_MAX) {
+    return 0;
+  }
+  const __m256i expected = _mm256_set1_epi16((uint16_t)value);
+  uint64_t mask = 0;
+  uint32_t idx = 0;
+
+  for (; idx + 32 <= count; idx += 32) {
+    const uint32_t matched =
+        movemask_epi16x2(either_epu16(first + idx, second + idx, expected),
+                         either_epu16(first + idx + 16, second + idx + 16, expected));
+    mask |= (uint64_t)matched << idx;
+  }
+
+  return mask | either_mask(first, second, idx, count, value);
+}
+#endif
+
+//------------------------------------------------------------
+// dispatchers
+//------------------------------------------------------------
+template <typename VALUE_T>
+uint64_t match_range(bool simd, const VALUE_T* values, uint32_t count, uint32_t min,
+                     uint32_t max) {
+#if FILTER_HAS_AVX2
+  if (simd) {
+    return range_mask_avx2(values, count, min, max);
+  }
+#endif
+  return range_mask(values, 0, count, min, max);
+}
+
+uint64_t match_bits(bool simd, const uint8_t* values, uint32_t count, uint8_t bits) {
+#if FILTER_HAS_AVX2
+  if (simd) {
+    return bits_mask_avx2(values, count, bits);
+  }
+#endif
+  return bits_mask(values, 0, count, bits);
+}
+
+template <typename VALUE_T>
+uint64_t match_either(bool simd, const VALUE_T* first, const VALUE_T* second, uint32_t count,
+                      uint32_t value) {
+#if FILTER_HAS_AVX2
+  if (simd) {
+    return either_mask_avx2(first, second, count, value);
+  }
+#endif
+  return either_mask(first, second, 0, count, value);
+}
+}  // namespace
+
+//------------------------------------------------------------
+// DealsFilter simd_available()
+//------------------------------------------------------------
+bool DealsFilter::simd_available() {
+#if FILTER_HAS_AVX2
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+#else
+  return false;
+#endif
+}
+
+//------------------------------------------------------------
+// DealsFilter match() for block of fields arrays
+// predicates go from the most selective one, stop when nothing left
+//------------------------------------------------------------
+uint64_t DealsFilter::match(const FilterBlock& block, uint32_t count) const {
+  uint64_t mask = match_range(use_simd, block.timestamp, count, timestamp.from, timestamp.to);
+
+  if (mask && (predicates & FILTER_ORIGIN)) {
+    mask &= match_range(use_simd, block.origin, count, origin.from, origin.to);
+  }
+
+  if (mask && (predicates & FILTER_DEPARTURE_DATE)) {
+    mask &= match_range(use_simd, block.departure_date, count, departure_date.from,
+                        departure_date.to);
+  }
+
+  if (mask && (predicates & FILTER_RETURN_DATE)) {
+    mask &= match_range(use_simd, block.return_date, count, return_date.from, return_date.to);
+  }
+
+  if (mask && (predicates & FILTER_EXACT_DATE)) {
+    mask &= match_either(use_simd, block.departure_date, block.return_date, count, exact_date);
+  }
+
+  if (mask && (predicates & FILTER_STAY_DAYS)) {
+    mask &= match_range(use_simd, block.stay_days, count, stay_days.from, stay_days.to);
+  }
+
+  if (mask && (predicates & FILTER_DIRECT)) {
+    mask &= match_range(use_simd, block.direct, count, direct.from, direct.to);
+  }
+
+  if (mask && (predicates & FILTER_DEPARTURE_WEEKDAYS)) {
+    mask &= match_bits(use_simd, block.departure_day_of_week, count, departure_weekdays);
+  }
+
+  if (mask && (predicates & FILTER_RETURN_WEEKDAYS)) {
+    mask &= match_bits(use_simd, block.return_day_of_week, count, return_weekdays);
+  }
+
+  return mask;
+}
+
+//------------------------------------------------------------
+// DealsFilter match_rows() for PageLayout::ROWS deals
+// copy fields of active predicates to arrays, then check them
+//------------------------------------------------------------
+uint64_t DealsFilter::match_rows(const i::DealInfo* deals, uint32_t count) {
+  for (uint32_t idx = 0; idx < count; ++idx) {
+    rows.timestamp[idx] = deals[idx].timestamp;
+  }
+
+  if (predicates & FILTER_ORIGIN) {
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      rows.origin[idx] = deals[idx].origin;
+    }
+  }
+
+  if (predicates & (FILTER_DEPARTURE_DATE | FILTER_EXACT_DATE)) {
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      rows.departure_date[idx] = deals[idx].departure_date;
+    }
+  }
+
+  if (predicates & (FILTER_RETURN_DATE | FILTER_EXACT_DATE)) {
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      rows.return_date[idx] = deals[idx].return_date;
+    }
+  }
+
+  if (predicates & FILTER_STAY_DAYS) {
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      rows.stay_days[idx] = deals[idx].stay_days;
+    }
+  }
+
+  if (predicates & FILTER_DIRECT) {
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      rows.direct[idx] = deals[idx].direct;
+    }
+  }
+
+  if (predicates & FILTER_DEPARTURE_WEEKDAYS) {
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      rows.departure_day_of_week[idx] = deals[idx].departure_day_of_week;
+    }
+  }
+
+  if (predicates & FILTER_RETURN_WEEKDAYS) {
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      rows.return_day_of_week[idx] = deals[idx].return_day_of_week;
+    }
+  }
+
+  return match(FilterBlock{rows.timestamp, rows.origin, rows.departure_date, rows.return_date,
+                           rows.stay_days, rows.direct, rows.departure_day_of_week,
+                           rows.return_day_of_week},
+               count);
+}
+
+//------------------------------------------------------------
+// DealsFilter match() for PageLayout::COLUMNS deals [from, from + count)
+// columns are already arrays
+//------------------------------------------------------------
+uint64_t DealsFilter::match(const shared_mem::PageColumns<i::DealInfo>& page, uint32_t from,
+                            uint32_t count) {
+  return match(FilterBlock{page.get<uint32_t>(i::COL_TIMESTAMP) + from,
+                           page.get<uint32_t>(i::COL_ORIGIN) + from,
+                           page.get<uint16_t>(i::COL_DEPARTURE_DATE) + from,
+                           page.get<uint16_t>(i::COL_RETURN_DATE) + from,
+                           page.get<uint8_t>(i::COL_STAY_DAYS) + from,
+                           page.get<uint8_t>(i::COL_DIRECT) + from,
+                           page.get<uint8_t>(i::COL_DEPARTURE_DAY_OF_WEEK) + from,
+                           page.get<uint8_t>(i::COL_RETURN_DAY_OF_WEEK) + from},
+               count);
+}
+//------------------------------------------------------------
+// DealsFilter match_rows_fixed() for PageLayout::ROWS deals
+// all predicates of one deal at once, without branches
+//------------------------------------------------------------
+template <uint32_t PREDICATES>
+uint64_t DealsFilter::match_rows_fixed(const i::DealInfo* deals, uint32_t count) {
+  const auto in = [](uint32_t value, const Range& range) {
+    return (value >= range.from) & (value <= range.to);
+  };
+  uint64_t mask = 0;
+
+  for (uint32_t idx = 0; idx < count; ++idx) {
+    const auto& deal = deals[idx];
+    bool matched = in(deal.timestamp, timestamp);
+
+    if (PREDICATES & FILTER_ORIGIN) {
+      matched &= deal.origin == origin.from;
+    }
+    if (PREDICATES & FILTER_DEPARTURE_DATE) {
+      matched &= in(deal.departure_date, departure_date);
+    }
+    if (PREDICATES & FILTER_RETURN_DATE) {
+      matched &= in(deal.return_date, return_date);
+    }
+    if (PREDICATES & FILTER_EXACT_DATE) {
+      matched &= (deal.departure_date == exact_date) | (deal.return_date == exact_date);
+    }
+    if (PREDICATES & FILTER_STAY_DAYS) {
+      matched &= in(deal.stay_days, stay_days);
+    }
+    if (PREDICATES & FILTER_DIRECT) {
+      matched &= deal.direct == direct.from;
+    }
+    if (PREDICATES & FILTER_DEPARTURE_WEEKDAYS) {
+      matched &= (deal.departure_day_of_week & departure_weekdays) != 0;
+    }
+    if (PREDICATES & FILTER_RETURN_WEEKDAYS) {
+      matched &= (deal.return_day_of_week & return_weekdays) != 0;
+    }
+
+    mask |= (uint64_t)matched << idx;
+  }
+
+  return mask;
+}
+
+//------------------------------------------------------------
+// DealsFilter specialize()
+//------------------------------------------------------------
+void DealsFilter::specialize() {
+#define FIXED_PREDICATES(predicates_set) \
+  case (predicates_set):                 \
+    rows_matcher = &DealsFilter::match_rows_fixed<(predicates_set)>;  \
+    break
+
+  switch (predicates) {
+    FIXED_PREDICATES(0);
+    FIXED_PREDICATES(FILTER_ORIGIN);
+    FIXED_PREDICATES(FILTER_ORIGIN | FILTER_DEPARTURE_DATE);
+    FIXED_PREDICATES(FILTER_ORIGIN | FILTER_RETURN_DATE);
+    FIXED_PREDICATES(FILTER_ORIGIN | FILTER_DEPARTURE_DATE | FILTER_RETURN_DATE);
+    FIXED_PREDICATES(FILTER_ORIGIN | FILTER_EXACT_DATE);
+    FIXED_PREDICATES(FILTER_ORIGIN | FILTER_RETURN_DATE | FILTER_EXACT_DATE);
+    default:
+      rows_matcher = &DealsFilter::match_rows;
+  }
+#undef FIXED_PREDICATES
+}
+}  // namespace deals
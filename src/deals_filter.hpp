@@ -0,0 +1,103 @@
+#ifndef SRC_DEALS_FILTER_HPP
+#define SRC_DEALS_FILTER_HPP
+
+#include "deals_types.hpp"
+#include "shared_memory.hpp"
+
+// deals checked by filter at once, result is a bitmask
+#define DEALS_FILTER_BLOCK 64
+
+namespace deals {
+//------------------------------------------------------------
+// FilterBlock
+// fields of DEALS_FILTER_BLOCK deals, one array per field
+//------------------------------------------------------------
+struct FilterBlock {
+  const uint32_t* timestamp;
+  const uint32_t* origin;
+  const uint16_t* departure_date;
+  const uint16_t* return_date;
+  const uint8_t* stay_days;
+  const uint8_t* direct;
+  const uint8_t* departure_day_of_week;
+  const uint8_t* return_day_of_week;
+};
+
+// DealsFilter predicates, timestamp is checked always
+enum FilterPredicate : uint32_t {
+  FILTER_ORIGIN = 1 << 0,
+  FILTER_DEPARTURE_DATE = 1 << 1,
+  FILTER_RETURN_DATE = 1 << 2,  // return dates and roundtrip flag
+  FILTER_EXACT_DATE = 1 << 3,
+  FILTER_STAY_DAYS = 1 << 4,
+  FILTER_DIRECT = 1 << 5,
+  FILTER_DEPARTURE_WEEKDAYS = 1 << 6,
+  FILTER_RETURN_WEEKDAYS = 1 << 7
+};
+
+//------------------------------------------------------------
+// DealsFilter
+// predicates of query::SearchQuery which are checked without branches
+// for a block of deals (AVX2 if cpu supports it). Destinations and
+// countries sets are not here, they are checked for matched deals only.
+// Filled by DealsSearchQuery::prepare_filter()
+//------------------------------------------------------------
+class DealsFilter {
+ public:
+  // choose rows matcher for active predicates, call after filling the filter
+  void specialize();
+
+  // bitmask of block deals (count <= DEALS_FILTER_BLOCK) matched all predicates
+  uint64_t match(const i::DealInfo* deals, uint32_t count) {
+    return (this->*rows_matcher)(deals, count);
+  }
+  uint64_t match(const shared_mem::PageColumns<i::DealInfo>& page, uint32_t from, uint32_t count);
+
+  // cpu support AVX2, use_simd = false forces scalar code
+  static bool simd_available();
+  bool use_simd = simd_available();
+
+ private:
+  uint64_t match(const FilterBlock& block, uint32_t count) const;
+  // any predicates: copy fields of the block to arrays and check them as columns
+  uint64_t match_rows(const i::DealInfo* deals, uint32_t count);
+  // frequent predicates combinations: one pass, inactive checks removed by compiler
+  template <uint32_t PREDICATES>
+  uint64_t match_rows_fixed(const i::DealInfo* deals, uint32_t count);
+
+  using RowsMatcher = uint64_t (DealsFilter::*)(const i::DealInfo* deals, uint32_t count);
+  RowsMatcher rows_matcher = &DealsFilter::match_rows;
+
+  struct Range {
+    uint32_t from;
+    uint32_t to;
+  };
+
+  uint32_t predicates = 0;  // FilterPredicate bits
+  Range timestamp;          // not expired and timelimit
+  Range origin;
+  Range departure_date;
+  Range return_date;
+  uint32_t exact_date;
+  Range stay_days;
+  Range direct;
+  uint8_t departure_weekdays;
+  uint8_t return_weekdays;
+
+  friend class DealsSearchQuery;
+  friend void filterTest();  // deals_test.cpp
+
+  // rows are copied here field by field before checking
+  struct {
+    uint32_t timestamp[DEALS_FILTER_BLOCK];
+    uint32_t origin[DEALS_FILTER_BLOCK];
+    uint16_t departure_date[DEALS_FILTER_BLOCK];
+    uint16_t return_date[DEALS_FILTER_BLOCK];
+    uint8_t stay_days[DEALS_FILTER_BLOCK];
+    uint8_t direct[DEALS_FILTER_BLOCK];
+    uint8_t departure_day_of_week[DEALS_FILTER_BLOCK];
+    uint8_t return_day_of_week[DEALS_FILTER_BLOCK];
+  } rows;
+};
+}  // namespace deals
+#endif
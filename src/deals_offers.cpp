@@ -0,0 +1,260 @@
+#include "deals_offers.hpp"
+
+#include <cstring>
+#include <iostream>
+
+#include "timing.hpp"
+
+namespace deals {
+//---------------------------------------------------------
+// DealsOffers constructor
+//---------------------------------------------------------
+DealsOffers::DealsOffers(DealsShards& shards, DealsPostings& postings)
+    : shards(shards),
+      postings(postings),
+      slots{DEALOFFERS_NAME, DEALOFFERS_STRIPES, DEALOFFERS_STRIPE_SLOTS * sizeof(i::DealOffer)} {
+  for (uint16_t stripe = 0; stripe < DEALOFFERS_STRIPES; ++stripe) {
+    locks.emplace_back(new locks::CriticalSection{DEALOFFERS_NAME ":" + std::to_string(stripe)});
+  }
+}
+
+//---------------------------------------------------------
+// DealsOffers upsert
+//---------------------------------------------------------
+// [offer A][offer B][expired][offer C][never used]...
+//    ^-- stripe slot of hash, offer is searched until never used slot,
+//        the first expired slot on the way is given to a new offer
+bool DealsOffers::upsert(i::DealInfo& info, uint16_t data_page_id, uint32_t data_index) {
+  const uint32_t key_hash = hash(info);
+  const uint32_t stripe = key_hash % DEALOFFERS_STRIPES;
+  const uint32_t first = key_hash / DEALOFFERS_STRIPES;
+  const uint32_t reuse_before =
+      timing::getTimestampSec() - DEALS_EXPIRES - DEALOFFERS_REUSE_DELAY_SEC;
+  const uint64_t data = ((uint64_t)data_page_id << 32) + data_index;
+
+  auto& lock = *locks[stripe];
+  lock.enter();
+  locks::AutoCloser guard(lock);
+
+  uint32_t offer_slot = UINT32_MAX;
+  uint32_t free_slot = UINT32_MAX;
+  i::DealOffer* other = nullptr;  // same route and dates, other direct flag
+  for (uint32_t probe = 0; probe < DEALOFFERS_MAX_PROBES; ++probe) {
+    const uint32_t slot =
+        stripe * DEALOFFERS_STRIPE_SLOTS + (first + probe) % DEALOFFERS_STRIPE_SLOTS;
+    auto& offer = get_slot(slot);
+
+    if (offer.origin == 0) {
+      if (free_slot == UINT32_MAX) {
+        free_slot = slot;
+      }
+      break;
+    }
+
+    if (is_same(offer, info)) {
+      offer_slot = slot;
+    } else if (is_same_route(offer, info) && offer.timestamp >= reuse_before) {
+      other = &offer;
+    } else if (free_slot == UINT32_MAX && offer.timestamp < reuse_before) {
+      free_slot = slot;
+    }
+  }
+
+  if (offer_slot != UINT32_MAX) {
+    auto& offer = get_slot(offer_slot);
+    offer.updates++;
+    std::memmove(&offer.history[1], &offer.history[0],
+                 sizeof(i::OfferPrice) * (DEALOFFERS_HISTORY - 1));
+    offer.history[0] = {info.timestamp, info.price};
+    offer.history_size = std::min(offer.history_size + 1, DEALOFFERS_HISTORY);
+
+    // queries show latest deal of offer, the cheapest one if there are several in a second
+    if (info.timestamp < offer.timestamp ||
+        (info.timestamp == offer.timestamp && info.price >= offer.price)) {
+      return true;
+    }
+    // latest, but not cheapest
+    info.overriden = info.price > offer.price;
+    info.page_id = DEALOFFERS_PAGE_ID;
+    info.index = offer_slot;
+    offer.timestamp = info.timestamp;
+    offer.price = info.price;
+    __atomic_store_n(&offer.data, data, __ATOMIC_RELEASE);
+
+    if (!get_shard(offer).index.updateRecord(offer.info_page_id, offer.info_index,
+                                             offer.info_page_version, info)) {
+      // page with offer deal was released
+      add_deal(offer, offer_slot, info);
+    }
+    update_best(offer, info, other);
+    return true;
+  }
+
+  if (free_slot == UINT32_MAX) {
+    return false;
+  }
+
+  auto& offer = get_slot(free_slot);
+  offer.origin = info.origin;
+  offer.destination = info.destination;
+  offer.departure_date = info.departure_date;
+  offer.return_date = info.return_date;
+  offer.direct = info.direct;
+  offer.updates = 1;
+  offer.history[0] = {info.timestamp, info.price};
+  offer.history_size = 1;
+  offer.timestamp = info.timestamp;
+  offer.price = info.price;
+  // expired deals of previous offer in the slot point here too, queries skip them
+  offer.best_page_id = UINT16_MAX;
+  offer.best_hidden = false;
+  __atomic_store_n(&offer.data, data, __ATOMIC_RELEASE);
+
+  info.page_id = DEALOFFERS_PAGE_ID;
+  info.index = free_slot;
+  add_deal(offer, free_slot, info);
+  update_best(offer, info, other);
+  return true;
+}
+
+//---------------------------------------------------------
+// DealsOffers get_data
+//---------------------------------------------------------
+void DealsOffers::get_data(uint32_t slot, uint16_t& data_page_id, uint32_t& data_index) const {
+  const uint64_t data = __atomic_load_n(&get_slot(slot).data, __ATOMIC_ACQUIRE);
+  data_page_id = data >> 32;
+  data_index = data & UINT32_MAX;
+}
+
+//---------------------------------------------------------
+// DealsOffers clear
+//---------------------------------------------------------
+void DealsOffers::clear() {
+  for (uint16_t stripe = 0; stripe < DEALOFFERS_STRIPES; ++stripe) {
+    locks[stripe]->enter();
+    locks::AutoCloser guard(*locks[stripe]);
+    slots.release_region(stripe);
+  }
+}
+
+//---------------------------------------------------------
+// DealsOffers add_deal
+//---------------------------------------------------------
+void DealsOffers::add_deal(i::DealOffer& offer, uint32_t slot, i::DealInfo& info) {
+  const auto result = get_shard(offer).index.addRecord(&info);
+  postings.add(info, false, result);
+  offer.info_page_id = result.page_id;
+  offer.info_index = result.index;
+  offer.info_page_version = result.page_version;
+}
+
+//---------------------------------------------------------
+// DealsOffers update_best
+//---------------------------------------------------------
+// offer deal was changed, it can hide deal of other offer or become hidden by it
+void DealsOffers::update_best(i::DealOffer& offer, const i::DealInfo& info,
+                              i::DealOffer* other) {
+  const uint32_t expired_before = timing::getTimestampSec() - DEALS_EXPIRES;
+  if (other == nullptr) {
+    set_best(offer, info, false);
+    return;
+  }
+
+  const bool other_hidden = is_dominated(*other, offer, expired_before);
+  if (other_hidden != other->best_hidden) {
+    i::DealInfo other_info;
+    // not read if page with other offer deal was released: deal is expired
+    if (get_shard(*other).index.readRecord(other->info_page_id, other->info_index,
+                                           other->info_page_version, other_info)) {
+      set_best(*other, other_info, other_hidden);
+    }
+  }
+  set_best(offer, info, is_dominated(offer, *other, expired_before));
+}
+
+//---------------------------------------------------------
+// DealsOffers set_best
+//---------------------------------------------------------
+void DealsOffers::set_best(i::DealOffer& offer, i::DealInfo info, bool hidden) {
+  offer.best_hidden = hidden;
+  if (hidden) {
+    if (offer.best_page_id == UINT16_MAX) {
+      return;
+    }
+    // queries skip expired deals
+    info.timestamp = 0;
+  }
+
+  auto& best = get_shard(offer).best;
+  if (offer.best_page_id != UINT16_MAX &&
+      best.updateRecord(offer.best_page_id, offer.best_index, offer.best_page_version, info)) {
+    return;
+  }
+  if (hidden) {
+    // page with deal was released
+    return;
+  }
+  const auto result = best.addRecord(&info);
+  postings.add(info, true, result);
+  offer.best_page_id = result.page_id;
+  offer.best_index = result.index;
+  offer.best_page_version = result.page_version;
+}
+
+//---------------------------------------------------------
+// DealsOffers get_slot
+//---------------------------------------------------------
+i::DealOffer& DealsOffers::get_slot(uint32_t slot) const {
+  auto stripe_slots = (i::DealOffer*)slots.get_region(slot / DEALOFFERS_STRIPE_SLOTS);
+  return stripe_slots[slot % DEALOFFERS_STRIPE_SLOTS];
+}
+
+//---------------------------------------------------------
+// DealsOffers get_shard
+//---------------------------------------------------------
+DealsShard& DealsOffers::get_shard(const i::DealOffer& offer) const {
+  return *shards[getOriginShard(offer.origin)];
+}
+
+//---------------------------------------------------------
+// DealsOffers hash
+//---------------------------------------------------------
+uint32_t DealsOffers::hash(const i::DealInfo& info) {
+  const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+  uint64_t key = ((uint64_t)info.origin << 32) + info.destination;
+  // direct flag is not hashed, offers with both flags are found together
+  key = key * multiplier ^ (((uint64_t)info.departure_date << 32) + info.return_date);
+  // final mix, all bits of key affect low bits
+  key ^= key >> 31;
+  key *= 0xBF58476D1CE4E5B9ULL;
+  key ^= key >> 29;
+  return key;
+}
+
+//---------------------------------------------------------
+// DealsOffers is_same
+//---------------------------------------------------------
+bool DealsOffers::is_same(const i::DealOffer& offer, const i::DealInfo& info) {
+  return is_same_route(offer, info) && offer.direct == info.direct;
+}
+
+//---------------------------------------------------------
+// DealsOffers is_same_route
+//---------------------------------------------------------
+bool DealsOffers::is_same_route(const i::DealOffer& offer, const i::DealInfo& info) {
+  return offer.origin == info.origin && offer.destination == info.destination &&
+         offer.departure_date == info.departure_date && offer.return_date == info.return_date;
+}
+
+//---------------------------------------------------------
+// DealsOffers is_dominated
+//---------------------------------------------------------
+// other deal passes every filter the offer deal passes except direct flag one
+// (it's newer, so timelimit too) and is the cheapest or last of them
+bool DealsOffers::is_dominated(const i::DealOffer& offer, const i::DealOffer& other,
+                               uint32_t expired_before) {
+  return other.timestamp > expired_before && other.price <= offer.price &&
+         other.timestamp >= offer.timestamp &&
+         (other.price < offer.price || other.timestamp > offer.timestamp);
+}
+}  // namespace deals
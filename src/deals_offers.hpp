@@ -0,0 +1,82 @@
+#ifndef SRC_DEALS_OFFERS_HPP
+#define SRC_DEALS_OFFERS_HPP
+
+#include <memory>
+#include <vector>
+#include "deals_postings.hpp"
+#include "deals_types.hpp"
+#include "locks.hpp"
+#include "shared_memory.hpp"
+
+namespace deals {
+namespace i {
+struct OfferPrice {
+  uint32_t timestamp;
+  uint32_t price;
+};
+
+// hash slot in shared memory: one per (origin, destination, dates, direct).
+// offers differing only by direct flag are found by the same probes
+struct DealOffer {
+  uint32_t origin;  // 0 - slot was never used
+  uint32_t destination;
+  uint32_t departure_date;
+  uint32_t return_date;
+  bool direct;
+  uint8_t history_size;
+  uint16_t info_page_id;       // offer deal in DealsInfo table of origin shard
+  uint32_t info_index;         //
+  uint32_t info_page_version;  //
+  uint32_t updates;            // deals added for the offer
+  uint32_t timestamp;          // of offer deal
+  uint32_t price;              // of offer deal
+  uint32_t best_index;         // offer deal in DealsBest table
+  uint32_t best_page_version;  //
+  uint16_t best_page_id;       // UINT16_MAX - not added yet
+  bool best_hidden;            // deal in DealsBest is hidden by other offer
+  uint64_t data;               // DealsData page id << 32 | index, read without lock
+  OfferPrice history[DEALOFFERS_HISTORY];  // latest added prices, newest first
+};
+}  // namespace i
+
+//------------------------------------------------------------
+// DealsOffers
+//------------------------------------------------------------
+// deal of every offer is stored in DealsInfo table once and updated in place,
+// so queries scan as many deals as there are offers, not as many as were added.
+// deal points to its offer slot, the slot points to data of latest deal.
+// offer deals are copied to DealsBest table too, but only if they could be the cheapest:
+// deal of direct and not direct offers of same route and dates is hidden there
+// while the other deal is not more expensive and not older
+class DealsOffers {
+ public:
+  DealsOffers(DealsShards& shards, DealsPostings& postings);
+
+  // add deal of new offer or update deal of existing offer, deal data is already stored.
+  // false if there is no free slot for the offer, deal must be added as is then
+  bool upsert(i::DealInfo& info, uint16_t data_page_id, uint32_t data_index);
+  // data position of offer deal (DealInfo::page_id == DEALOFFERS_PAGE_ID)
+  void get_data(uint32_t slot, uint16_t& data_page_id, uint32_t& data_index) const;
+  void clear();
+
+ private:
+  i::DealOffer& get_slot(uint32_t slot) const;
+  DealsShard& get_shard(const i::DealOffer& offer) const;
+  void add_deal(i::DealOffer& offer, uint32_t slot, i::DealInfo& info);
+  // show or hide deals of offer and its other direct flag offer in DealsBest
+  void update_best(i::DealOffer& offer, const i::DealInfo& info, i::DealOffer* other);
+  void set_best(i::DealOffer& offer, i::DealInfo info, bool hidden);
+  static uint32_t hash(const i::DealInfo& info);
+  static bool is_same(const i::DealOffer& offer, const i::DealInfo& info);
+  static bool is_same_route(const i::DealOffer& offer, const i::DealInfo& info);
+  // deal of offer is never the cheapest one while deal of other offer is not worse
+  static bool is_dominated(const i::DealOffer& offer, const i::DealOffer& other,
+                           uint32_t expired_before);
+
+  DealsShards& shards;
+  DealsPostings& postings;
+  shared_mem::SharedMemoryArena slots;
+  std::vector<std::unique_ptr<locks::CriticalSection>> locks;
+};
+}  // namespace deals
+#endif
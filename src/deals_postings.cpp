@@ -0,0 +1,327 @@
+#include "deals_postings.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "timing.hpp"
+
+namespace deals {
+//---------------------------------------------------------
+// DealsPostings constructor
+//---------------------------------------------------------
+DealsPostings::DealsPostings(DealsShards& shards)
+    : shards(shards),
+      stripes{DEALPOSTINGS_NAME, DEALPOSTINGS_STRIPES, sizeof(i::PostingsStripe)} {
+  for (uint16_t stripe = 0; stripe < DEALPOSTINGS_STRIPES; ++stripe) {
+    locks.emplace_back(
+        new locks::CriticalSection{DEALPOSTINGS_NAME ":" + std::to_string(stripe)});
+  }
+}
+
+//---------------------------------------------------------
+// DealsPostings add
+//---------------------------------------------------------
+// route.head -> [newest block] -> [block] -> ... -> [oldest block]
+//  new postings are written to head block, when it is full new head is allocated
+//  and the oldest block is released if pages of all its postings were released
+void DealsPostings::add(const i::DealInfo& deal, bool best,
+                        const shared_mem::ElementExtractor<i::DealInfo>& position) {
+  const uint32_t key_hash = hash(deal.origin, deal.destination, best);
+  const uint32_t stripe_id = key_hash % DEALPOSTINGS_STRIPES;
+  const uint32_t current_time = timing::getTimestampSec();
+
+  auto& lock = *locks[stripe_id];
+  lock.enter();
+  locks::AutoCloser guard(lock);
+
+  auto& stripe = get_stripe(stripe_id);
+  release_routes(stripe, current_time);
+  auto route = find_route(stripe, key_hash / DEALPOSTINGS_STRIPES, deal.origin,
+                          deal.destination, best, true, current_time);
+  if (route == nullptr) {
+    std::cerr << "ERROR DealsPostings no free route in stripe:" << stripe_id << std::endl;
+    stripe.incomplete_until = current_time + DEALS_EXPIRES;
+    return;
+  }
+
+  i::PostingsBlock* block = route->head ? &stripe.blocks[route->head - 1] : nullptr;
+  if (block == nullptr || block->size == DEALPOSTINGS_BLOCK_SIZE) {
+    const uint32_t block_id = allocate_block(stripe, current_time);
+    if (block_id == 0) {
+      std::cerr << "ERROR DealsPostings no free block in stripe:" << stripe_id << std::endl;
+      route->incomplete_until = current_time + DEALS_EXPIRES;
+      return;
+    }
+    block = &stripe.blocks[block_id - 1];
+    block->next = route->head;
+    block->size = 0;
+    block->freed_at = 0;
+    // readers see initialized block
+    __atomic_store_n(&route->head, block_id, __ATOMIC_RELEASE);
+    release_tail(stripe, *route, current_time);
+  }
+
+  block->postings[block->size] = {position.index, position.page_version, position.page_id};
+  __atomic_store_n(&block->size, block->size + 1, __ATOMIC_RELEASE);
+}
+
+//---------------------------------------------------------
+// DealsPostings read
+//---------------------------------------------------------
+bool DealsPostings::read(uint32_t origin, const std::vector<uint32_t>& destinations, bool best,
+                         std::vector<i::DealInfo>& result) const {
+  const uint32_t current_time = timing::getTimestampSec();
+  std::vector<i::DealPosting> positions;
+
+  for (const auto destination : destinations) {
+    const uint32_t key_hash = hash(origin, destination, best);
+    auto& stripe = get_stripe(key_hash % DEALPOSTINGS_STRIPES);
+
+    if (__atomic_load_n(&stripe.incomplete_until, __ATOMIC_RELAXED) > current_time) {
+      return false;
+    }
+    auto route = find_route(stripe, key_hash / DEALPOSTINGS_STRIPES, origin, destination, best,
+                            false, current_time);
+    if (route == nullptr) {
+      continue;
+    }
+    if (__atomic_load_n(&route->incomplete_until, __ATOMIC_RELAXED) > current_time) {
+      return false;
+    }
+
+    // released blocks are not reused for a while, so they can be read till the end
+    uint32_t block_id = __atomic_load_n(&route->head, __ATOMIC_ACQUIRE);
+    while (block_id != 0) {
+      const auto& block = stripe.blocks[block_id - 1];
+      const uint32_t size = __atomic_load_n(&block.size, __ATOMIC_ACQUIRE);
+      positions.insert(positions.end(), block.postings, block.postings + size);
+      block_id = __atomic_load_n(&block.next, __ATOMIC_ACQUIRE);
+    }
+  }
+
+  // processors see deals in the same order as by table scan
+  std::sort(positions.begin(), positions.end(),
+            [](const i::DealPosting& a, const i::DealPosting& b) {
+              return a.page_id < b.page_id || (a.page_id == b.page_id && a.index < b.index);
+            });
+
+  auto& table = get_table(origin, best);
+  i::DealInfo deal;
+  for (const auto& posting : positions) {
+    if (table.readRecord(posting.page_id, posting.index, posting.page_version, deal)) {
+      result.push_back(deal);
+    }
+  }
+  return true;
+}
+
+//---------------------------------------------------------
+// DealsPostings clear
+//---------------------------------------------------------
+void DealsPostings::clear() {
+  for (uint16_t stripe = 0; stripe < DEALPOSTINGS_STRIPES; ++stripe) {
+    locks[stripe]->enter();
+    locks::AutoCloser guard(*locks[stripe]);
+    stripes.release_region(stripe);
+  }
+}
+
+//---------------------------------------------------------
+// DealsPostings find_route
+//---------------------------------------------------------
+// removed slots don't stop the search, new route takes the first one
+// removed long enough ago (readers could still look at it) or the never used one
+i::PostingsRoute* DealsPostings::find_route(i::PostingsStripe& stripe, uint32_t first,
+                                            uint32_t origin, uint32_t destination, bool best,
+                                            bool insert, uint32_t current_time) const {
+  i::PostingsRoute* free_route = nullptr;
+  for (uint32_t probe = 0; probe < DEALPOSTINGS_MAX_PROBES; ++probe) {
+    auto& route = stripe.routes[(first + probe) % DEALPOSTINGS_STRIPE_ROUTES];
+    // origin is set last, route is complete for readers then
+    const uint32_t route_origin = __atomic_load_n(&route.origin, __ATOMIC_ACQUIRE);
+
+    if (route_origin == 0) {
+      if (free_route == nullptr) {
+        free_route = &route;
+      }
+      break;
+    }
+
+    if (route_origin == DEALPOSTINGS_REMOVED_ROUTE) {
+      if (free_route == nullptr && route.removed_at + DEALPOSTINGS_REUSE_DELAY_SEC < current_time) {
+        free_route = &route;
+      }
+      continue;
+    }
+
+    if (route_origin == origin && route.destination == destination && route.best == best) {
+      return &route;
+    }
+  }
+
+  if (!insert || free_route == nullptr) {
+    return nullptr;
+  }
+  free_route->destination = destination;
+  free_route->best = best;
+  free_route->head = 0;
+  free_route->incomplete_until = 0;
+  __atomic_store_n(&free_route->origin, origin, __ATOMIC_RELEASE);
+  return free_route;
+}
+
+//---------------------------------------------------------
+// DealsPostings allocate_block
+//---------------------------------------------------------
+uint32_t DealsPostings::allocate_block(i::PostingsStripe& stripe, uint32_t current_time) {
+  if (stripe.free_head != 0) {
+    auto& block = stripe.blocks[stripe.free_head - 1];
+    // readers could still walk the block
+    if (block.freed_at + DEALPOSTINGS_REUSE_DELAY_SEC < current_time) {
+      const uint32_t block_id = stripe.free_head;
+      stripe.free_head = block.next_free;
+      if (stripe.free_head == 0) {
+        stripe.free_tail = 0;
+      }
+      return block_id;
+    }
+  }
+
+  if (stripe.blocks_used < DEALPOSTINGS_STRIPE_BLOCKS) {
+    return ++stripe.blocks_used;
+  }
+  return 0;
+}
+
+//---------------------------------------------------------
+// DealsPostings release_tail
+//---------------------------------------------------------
+// postings of oldest block are old too, their pages are released first
+void DealsPostings::release_tail(i::PostingsStripe& stripe, const i::PostingsRoute& route,
+                                 uint32_t current_time) {
+  i::PostingsBlock* previous = &stripe.blocks[route.head - 1];
+  if (previous->next == 0) {
+    return;
+  }
+  uint32_t tail_id = previous->next;
+  while (stripe.blocks[tail_id - 1].next != 0) {
+    previous = &stripe.blocks[tail_id - 1];
+    tail_id = previous->next;
+  }
+
+  if (!is_released(stripe.blocks[tail_id - 1], get_table(route.origin, route.best))) {
+    return;
+  }
+  __atomic_store_n(&previous->next, 0, __ATOMIC_RELEASE);
+  release_blocks(stripe, tail_id, current_time);
+}
+
+//---------------------------------------------------------
+// DealsPostings release_routes
+//---------------------------------------------------------
+// route.head -> [block] -> [released] -> [block] -> [released] -> [released]
+//                            the oldest block of not released pages ---^
+// blocks after the oldest block of not released pages are released,
+// route of released blocks only is removed unless its postings were lost
+void DealsPostings::release_routes(i::PostingsStripe& stripe, uint32_t current_time) {
+  if (stripe.checked_at + DEALPOSTINGS_CHECK_INTERVAL_SEC > current_time) {
+    return;
+  }
+  stripe.checked_at = current_time;
+
+  for (auto& route : stripe.routes) {
+    if (route.origin == 0 || route.origin == DEALPOSTINGS_REMOVED_ROUTE) {
+      continue;
+    }
+
+    auto& table = get_table(route.origin, route.best);
+    uint32_t oldest_used = 0;
+    for (uint32_t block_id = route.head; block_id != 0;
+         block_id = stripe.blocks[block_id - 1].next) {
+      if (!is_released(stripe.blocks[block_id - 1], table)) {
+        oldest_used = block_id;
+      }
+    }
+
+    if (oldest_used != 0) {
+      auto& oldest = stripe.blocks[oldest_used - 1];
+      const uint32_t released = oldest.next;
+      if (released != 0) {
+        __atomic_store_n(&oldest.next, 0, __ATOMIC_RELEASE);
+        release_blocks(stripe, released, current_time);
+      }
+      continue;
+    }
+
+    const uint32_t released = route.head;
+    __atomic_store_n(&route.head, 0, __ATOMIC_RELEASE);
+    release_blocks(stripe, released, current_time);
+    // readers must scan the shard until lost postings expire, so route is kept
+    if (route.incomplete_until <= current_time) {
+      route.removed_at = current_time;
+      __atomic_store_n(&route.origin, DEALPOSTINGS_REMOVED_ROUTE, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+//---------------------------------------------------------
+// DealsPostings release_blocks
+//---------------------------------------------------------
+void DealsPostings::release_blocks(i::PostingsStripe& stripe, uint32_t block_id,
+                                   uint32_t current_time) {
+  for (; block_id != 0; block_id = stripe.blocks[block_id - 1].next) {
+    auto& block = stripe.blocks[block_id - 1];
+    block.freed_at = current_time;
+    block.next_free = 0;
+    if (stripe.free_tail != 0) {
+      stripe.blocks[stripe.free_tail - 1].next_free = block_id;
+    } else {
+      stripe.free_head = block_id;
+    }
+    stripe.free_tail = block_id;
+  }
+}
+
+//---------------------------------------------------------
+// DealsPostings is_released
+//---------------------------------------------------------
+// pages of all block postings were released (newest postings are checked first)
+bool DealsPostings::is_released(const i::PostingsBlock& block,
+                                shared_mem::Table<i::DealInfo>& table) const {
+  i::DealInfo deal;
+  for (uint32_t idx = block.size; idx-- > 0;) {
+    const auto& posting = block.postings[idx];
+    if (table.readRecord(posting.page_id, posting.index, posting.page_version, deal)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//---------------------------------------------------------
+// DealsPostings get_stripe
+//---------------------------------------------------------
+i::PostingsStripe& DealsPostings::get_stripe(uint32_t stripe) const {
+  return *(i::PostingsStripe*)stripes.get_region(stripe);
+}
+
+//---------------------------------------------------------
+// DealsPostings get_table
+//---------------------------------------------------------
+shared_mem::Table<i::DealInfo>& DealsPostings::get_table(uint32_t origin, bool best) const {
+  auto& shard = *shards[getOriginShard(origin)];
+  return best ? shard.best : shard.index;
+}
+
+//---------------------------------------------------------
+// DealsPostings hash
+//---------------------------------------------------------
+uint32_t DealsPostings::hash(uint32_t origin, uint32_t destination, bool best) {
+  uint64_t key = (((uint64_t)origin << 32) + destination) * 0x9E3779B97F4A7C15ULL ^ best;
+  // final mix, all bits of key affect low bits
+  key ^= key >> 31;
+  key *= 0xBF58476D1CE4E5B9ULL;
+  key ^= key >> 29;
+  return key;
+}
+}  // namespace deals
@@ -0,0 +1,91 @@
+#ifndef SRC_DEALS_POSTINGS_HPP
+#define SRC_DEALS_POSTINGS_HPP
+
+#include <memory>
+#include <vector>
+#include "deals_types.hpp"
+#include "locks.hpp"
+#include "shared_memory.hpp"
+
+namespace deals {
+namespace i {
+// position of deal in DealsInfo or DealsBest table of origin shard
+struct DealPosting {
+  uint32_t index;
+  uint32_t page_version;
+  uint16_t page_id;
+};
+
+// block ids are stripe local and start from 1, 0 - no block
+struct PostingsBlock {
+  uint32_t next;       // older block of route
+  uint32_t size;       // postings written
+  uint32_t freed_at;   // released from route
+  uint32_t next_free;  // in stripe free list
+  DealPosting postings[DEALPOSTINGS_BLOCK_SIZE];
+};
+
+struct PostingsRoute {
+  uint32_t origin;  // 0 - slot was never used, DEALPOSTINGS_REMOVED_ROUTE - removed
+  uint32_t destination;
+  uint32_t head;              // newest block
+  uint32_t incomplete_until;  // posting was lost, queries must scan the shard
+  uint32_t removed_at;        // slot is given to another route later
+  bool best;                  // postings of DealsBest table
+};
+
+struct PostingsStripe {
+  uint32_t blocks_used;       // never used blocks start there
+  uint32_t free_head;         // released blocks, oldest first
+  uint32_t free_tail;         //
+  uint32_t incomplete_until;  // route was lost, queries must scan the shard
+  uint32_t checked_at;        // routes were checked for released pages
+  PostingsRoute routes[DEALPOSTINGS_STRIPE_ROUTES];
+  PostingsBlock blocks[DEALPOSTINGS_STRIPE_BLOCKS];
+};
+}  // namespace i
+
+//------------------------------------------------------------
+// DealsPostings
+//------------------------------------------------------------
+// lists of deal positions by (origin, destination) for DealsInfo and DealsBest tables.
+// every deal appended to them is posted once, in place updates keep the position.
+// lists grow by blocks, newest first. readers go without lock and skip positions
+// of released pages, the oldest block of list is released when all its pages are.
+// writers check routes of stripe from time to time: blocks of released pages are
+// released, list of no other blocks gives its route slot back
+class DealsPostings {
+ public:
+  DealsPostings(DealsShards& shards);
+
+  // deal was appended to index (best == false) or best table of its shard
+  void add(const i::DealInfo& deal, bool best,
+           const shared_mem::ElementExtractor<i::DealInfo>& position);
+  // deals of origin routes in table order (as table scan gives them),
+  // false if some postings of routes were lost
+  bool read(uint32_t origin, const std::vector<uint32_t>& destinations, bool best,
+            std::vector<i::DealInfo>& result) const;
+  void clear();
+
+ private:
+  i::PostingsStripe& get_stripe(uint32_t stripe) const;
+  i::PostingsRoute* find_route(i::PostingsStripe& stripe, uint32_t first, uint32_t origin,
+                               uint32_t destination, bool best, bool insert,
+                               uint32_t current_time) const;
+  uint32_t allocate_block(i::PostingsStripe& stripe, uint32_t current_time);
+  void release_tail(i::PostingsStripe& stripe, const i::PostingsRoute& route,
+                    uint32_t current_time);
+  // release blocks of released pages in all routes of stripe, remove empty routes
+  void release_routes(i::PostingsStripe& stripe, uint32_t current_time);
+  // block and older ones go to free list, readers could still walk them
+  void release_blocks(i::PostingsStripe& stripe, uint32_t block_id, uint32_t current_time);
+  bool is_released(const i::PostingsBlock& block, shared_mem::Table<i::DealInfo>& table) const;
+  shared_mem::Table<i::DealInfo>& get_table(uint32_t origin, bool best) const;
+  static uint32_t hash(uint32_t origin, uint32_t destination, bool best);
+
+  DealsShards& shards;
+  shared_mem::SharedMemoryArena stripes;
+  std::vector<std::unique_ptr<locks::CriticalSection>> locks;
+};
+}  // namespace deals
+#endif
@@ -1,18 +1,215 @@
 #include "deals_query.hpp"
+#include "flat_map.hpp"
 
 namespace deals {
+namespace {
+// date code -> days of i::DealInfo, dates out of days range become below / above
+uint32_t date_to_days(uint32_t date, uint32_t below, uint32_t above) {
+  static const uint32_t first = types::days_to_date(1);
+  static const uint32_t last = types::days_to_date(UINT16_MAX);
+
+  if (date < first) {
+    return below;
+  }
+  if (date > last) {
+    return above;
+  }
+  return types::date_to_days(date);
+}
+
+// key of group of deal in scan shared with siblings, queries give the same groups
+uint64_t shared_group_key(const i::ScanGroups &groups, const i::DealInfo &deal) {
+  switch (groups.key) {
+    case i::SCAN_GROUP_DESTINATION:
+      return deal.destination;
+    case i::SCAN_GROUP_COUNTRY:
+      return deal.destination_country;
+    case i::SCAN_GROUP_DEPARTURE_DATE:
+      return deal.departure_date;
+    case i::SCAN_GROUP_RETURN_DATE:
+      return deal.return_date;
+    case i::SCAN_GROUP_DATES:
+      return ((uint32_t)deal.departure_date << 16) | deal.return_date;
+    default:
+      // days are 16 bits, bit 16 keeps return dates after departure ones
+      return groups.exact_date == deal.return_date ? deal.departure_date
+                                                   : deal.return_date | 0x10000;
+  }
+}
+
+// partition of shared scan takes other bits of key hash than partitions of scan threads,
+// so groups of one shared partition are spread over all of them
+uint32_t shared_partition(uint64_t key, uint32_t partitions) {
+  return flat_map::partition_of(key * 0xC2B2AE3D27D4EB4Full, partitions);
+}
+}  // namespace
+
+//----------------------------------------------------------------
+// DealsSearchQuery::Part
+// filters of query, keeps matched deals by partitions of their groups instead of grouping them
+class DealsSearchQuery::Part : public DealsSearchQuery {
+ public:
+  Part(const DealsSearchQuery &query)
+      : DealsSearchQuery{query}, query(&query), deals(group_partitions) {
+  }
+  const DealsSearchQuery *query;  // group_key() of derived query
+  std::vector<std::vector<i::DealInfo>> deals;
+
+ private:
+  void process_deal(const i::DealInfo &deal) final override {
+    if (group_partitions == 1) {
+      deals[0].push_back(deal);
+      return;
+    }
+    deals[flat_map::partition_of(query->group_key(deal), group_partitions)].push_back(deal);
+  }
+  void pre_search() final override {
+  }
+  void post_search() final override {
+  }
+  const std::vector<i::DealInfo> get_result() const final override {
+    return {};
+  }
+};
+
+//----------------------------------------------------------------
+// DealsSearchQuery::Partitions
+// filters of query, passes it deals of groups in partitions of shared scan only
+class DealsSearchQuery::Partitions : public DealsSearchQuery {
+ public:
+  Partitions(DealsSearchQuery &query, const i::ScanGroups &groups,
+             const std::vector<bool> &partitions)
+      : DealsSearchQuery{query}, query(query), groups(groups), partitions(partitions) {
+  }
+
+ private:
+  void process_deal(const i::DealInfo &deal) final override {
+    if (partitions[shared_partition(shared_group_key(groups, deal), partitions.size())]) {
+      query.process_deal(deal);
+    }
+  }
+  // parts of scan threads are merged by partitions of groups of query
+  bool partition_groups(uint32_t count) final override {
+    return query.partition_groups(count);
+  }
+  uint64_t group_key(const i::DealInfo &deal) const final override {
+    return query.group_key(deal);
+  }
+  void pre_search() final override {
+  }
+  void post_search() final override {
+  }
+  const std::vector<i::DealInfo> get_result() const final override {
+    return {};
+  }
+
+  DealsSearchQuery &query;
+  const i::ScanGroups &groups;
+  const std::vector<bool> &partitions;
+};
+
+//----------------------------------------------------------------
+// DealsSearchQuery::SharedGroups
+// shared filters, groups deals of one partition of shared scan by sibling process
+class DealsSearchQuery::SharedGroups : public DealsSearchQuery {
+ public:
+  SharedGroups(shared_mem::Table<i::DealInfo> &table, const i::ScanGroups &groups,
+               uint32_t partition, uint32_t partitions)
+      : DealsSearchQuery{table},
+        groups(groups),
+        task_partition(partition),
+        task_partitions(partitions) {
+  }
+  // result deals of groups in result order, the first groups.limit of them
+  const std::vector<i::DealInfo> get_result() const final override {
+    std::vector<i::DealInfo> result;
+    result.reserve(groups_map.size());
+    groups_map.for_each([&result](uint64_t, const utils::CheapestAndLast &group) {
+      result.push_back(group.get());
+    });
+
+    const auto &shared = groups;
+    const auto key_less = [&shared](const i::DealInfo &a, const i::DealInfo &b) {
+      return shared_group_key(shared, a) < shared_group_key(shared, b);
+    };
+    const uint32_t limit = std::min<uint32_t>(groups.limit, DEALSCAN_TASK_GROUPS);
+    if (groups.by_price) {
+      query::sort_limited(result, limit, [&key_less](const i::DealInfo &a, const i::DealInfo &b) {
+        return a.price < b.price || (a.price == b.price && key_less(a, b));
+      });
+    } else {
+      query::sort_limited(result, limit, key_less);
+    }
+    return result;
+  }
+
+ private:
+  void process_deal(const i::DealInfo &deal) final override {
+    const uint64_t key = shared_group_key(groups, deal);
+    if (shared_partition(key, task_partitions) == task_partition) {
+      groups_map[key].add(deal);
+    }
+  }
+  bool partition_groups(uint32_t partitions) final override {
+    groups_map.set_partitions(partitions);
+    return true;
+  }
+  uint64_t group_key(const i::DealInfo &deal) const final override {
+    return shared_group_key(groups, deal);
+  }
+  void pre_search() final override {
+  }
+  void post_search() final override {
+  }
+
+  const i::ScanGroups groups;
+  const uint32_t task_partition;
+  const uint32_t task_partitions;
+  flat_map::PartitionedMap<uint64_t, utils::CheapestAndLast> groups_map;
+};
+
 // ----------------------------------------------------------
 std::vector<i::DealInfo> DealsSearchQuery::execute() {
+  start();
+  while (!resume(INT64_MAX)) {
+  }
+  return finish();
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery start()
+void DealsSearchQuery::start() {
+  dates_to_days();
   pre_search();  // run in derived class
 
   // filter out expired deals inside record, record has many elements with different ages,
   // but record age equal max age of all elements inside it.  =/ rethink it later
   min_timestamp =
       std::max(table.context.shm.global_expire_at, timing::getTimestampSec()) - DEALS_EXPIRES;
+  prepare_filter();
+}
 
-  // table processor iterates table pages and call DealsSearchQuery::process_element()
-  table.processRecords(*this);
+//----------------------------------------------------------------
+// DealsSearchQuery resume()
+bool DealsSearchQuery::resume(int64_t deadline_ms) {
+  if (scan == nullptr) {
+    if (process_postings()) {
+      return true;
+    }
+    // shared scan waits for parts of siblings, it is not suspended
+    if (scan_queue != nullptr) {
+      scan_queue->scan(*this, scan_table);
+      return true;
+    }
+    // table processor iterates table pages and call DealsSearchQuery::process_rows()
+    scan.reset(new shared_mem::TableScan<i::DealInfo>(table, *this));
+  }
+  return scan->resume(deadline_ms);
+}
 
+//----------------------------------------------------------------
+// DealsSearchQuery finish()
+std::vector<i::DealInfo> DealsSearchQuery::finish() {
   post_search();  // run in derived class
 
   auto result = get_result();
@@ -23,83 +220,325 @@ std::vector<i::DealInfo> DealsSearchQuery::execute() {
   }
 
   return result;
-};
+}
 
 //----------------------------------------------------------------
-// DealsSearchQuery process_element()
-// function that will be called by TableProcessor
-// for iterating over all not expired pages in table
-void DealsSearchQuery::process_element(const i::DealInfo &deal) {
-  // check if not expired by now or data page was reused on lowMem (global_expire_at)
-  if (deal.timestamp <= min_timestamp) {
-    return;
+// DealsSearchQuery dates_to_days()
+// query::SearchQuery keeps date codes, deals store days since 1970-01-01,
+// so dates filters are turned into days once: page summaries and DealsFilter
+// compare days then. Undefined bounds (0 and UINT32_MAX) are left as is
+void DealsSearchQuery::dates_to_days() {
+  if (filter_departure_date) {
+    auto &dates = departure_date_values;
+    dates.from = dates.from ? date_to_days(dates.from, 1, UINT32_MAX) : 0;
+    dates.to = date_to_days(dates.to, 0, UINT32_MAX);
   }
 
-  if (filter_origin && origin_value != deal.origin) {
-    return;
+  if (filter_return_date) {
+    auto &dates = return_date_values;
+    dates.from = dates.from ? date_to_days(dates.from, 1, UINT32_MAX) : 0;
+    dates.to = date_to_days(dates.to, 0, UINT32_MAX);
   }
 
-  if (filter_timestamp && timestamp_value > deal.timestamp) {
-    return;
+  // out of range date is not equal to any deal date
+  if (filter_exact_date) {
+    exact_date_value = date_to_days(exact_date_value, UINT32_MAX, UINT32_MAX);
   }
+}
 
-  if (filter_flight_by_roundtrip) {
-    if (roundtrip_flight_flag == true) {
-      if (deal.return_date == 0) {
-        return;
-      }
-    } else {
-      if (deal.return_date != 0) {
-        return;
-      }
-    }
+//----------------------------------------------------------------
+// DealsSearchQuery use_postings()
+void DealsSearchQuery::use_postings(const DealsPostings &postings, bool best) {
+  this->postings = &postings;
+  postings_best = best;
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery use_scan_queue()
+void DealsSearchQuery::use_scan_queue(DealsScanQueue &queue, uint32_t table) {
+  scan_queue = &queue;
+  scan_table = table;
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery process_postings()
+// deals of few destinations are a tiny part of origin deals, they are read by positions
+bool DealsSearchQuery::process_postings() {
+  if (postings == nullptr || !filter_origin || !filter_destination ||
+      destination_values_set.size() > DEALPOSTINGS_MAX_DESTINATIONS) {
+    return false;
   }
 
-  if (filter_destination) {
-    if (destination_values_set.find(deal.destination) == destination_values_set.end()) {
-      return;
-    }
+  std::vector<i::DealInfo> deals;
+  if (!postings->read(origin_value, destination_values_set.get_codes(), postings_best, deals)) {
+    return false;
   }
+  process_rows(deals.data(), deals.size());
+  return true;
+}
 
-  if (filter_destination_country) {
-    if (destination_country_set.find(deal.destination_country) == destination_country_set.end()) {
-      return;
+//----------------------------------------------------------------
+// DealsSearchQuery skip_page()
+// called by TableProcessor for every not expired page before scanning it
+bool DealsSearchQuery::skip_page(const shared_mem::PageSummary &summary) {
+  const auto &departure = summary.fields[i::DEPARTURE_DATE];
+  const auto &ret = summary.fields[i::RETURN_DATE];
+  const auto &timestamp = summary.fields[i::TIMESTAMP];
+
+  // all deals on the page are expired
+  if (timestamp.max <= min_timestamp) {
+    return true;
+  }
+
+  if (filter_timestamp && timestamp.max < timestamp_value) {
+    return true;
+  }
+
+  // one-way deals have return_date == 0
+  if (filter_flight_by_roundtrip) {
+    if (roundtrip_flight_flag == true && ret.max == 0) {
+      return true;
+    }
+    if (roundtrip_flight_flag == false && ret.min != 0) {
+      return true;
     }
   }
 
-  if (filter_departure_date && (deal.departure_date < departure_date_values.from ||
-                                deal.departure_date > departure_date_values.to)) {
-    return;
+  if (filter_departure_date &&
+      (departure.max < departure_date_values.from || departure.min > departure_date_values.to)) {
+    return true;
   }
 
   if (filter_return_date &&
-      (deal.return_date < return_date_values.from || deal.return_date > return_date_values.to)) {
-    return;
+      (ret.max < return_date_values.from || ret.min > return_date_values.to)) {
+    return true;
   }
 
   if (filter_exact_date &&  //
-      deal.return_date != exact_date_value && deal.departure_date != exact_date_value) {
-    return;
+      (departure.max < exact_date_value || departure.min > exact_date_value) &&
+      (ret.max < exact_date_value || ret.min > exact_date_value)) {
+    return true;
+  }
+
+  return false;
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery prepare_filter()
+// fixed for whole query, so all checks are turned into ranges once
+void DealsSearchQuery::prepare_filter() {
+  filter.predicates = 0;
+
+  // not expired by now or data page was reused on lowMem (global_expire_at)
+  filter.timestamp = {min_timestamp + 1, UINT32_MAX};
+  if (filter_timestamp) {
+    filter.timestamp.from = std::max(filter.timestamp.from, timestamp_value);
+  }
+
+  if (filter_origin) {
+    filter.predicates |= FILTER_ORIGIN;
+    filter.origin = {origin_value, origin_value};
+  }
+
+  if (filter_departure_date) {
+    filter.predicates |= FILTER_DEPARTURE_DATE;
+    filter.departure_date = {departure_date_values.from, departure_date_values.to};
+  }
+
+  // one-way deals have return_date == 0
+  if (filter_return_date || filter_flight_by_roundtrip) {
+    filter.predicates |= FILTER_RETURN_DATE;
+    filter.return_date = {0, UINT32_MAX};
+  }
+  if (filter_flight_by_roundtrip) {
+    filter.return_date = roundtrip_flight_flag ? DealsFilter::Range{1, UINT32_MAX}  //
+                                               : DealsFilter::Range{0, 0};
+  }
+  if (filter_return_date) {
+    filter.return_date.from = std::max(filter.return_date.from, return_date_values.from);
+    filter.return_date.to = std::min(filter.return_date.to, return_date_values.to);
+  }
+
+  if (filter_exact_date) {
+    filter.predicates |= FILTER_EXACT_DATE;
+    filter.exact_date = exact_date_value;
+  }
+
+  if (filter_stay_days) {
+    filter.predicates |= FILTER_STAY_DAYS;
+    filter.stay_days = {stay_days_values.from, stay_days_values.to};
+  }
+
+  if (filter_flight_by_stops) {
+    filter.predicates |= FILTER_DIRECT;
+    filter.direct = {direct_flights_flag, direct_flights_flag};
+  }
+
+  if (filter_departure_weekdays) {
+    filter.predicates |= FILTER_DEPARTURE_WEEKDAYS;
+    filter.departure_weekdays = departure_weekdays_bitmask;
+  }
+
+  if (filter_return_weekdays) {
+    filter.predicates |= FILTER_RETURN_WEEKDAYS;
+    filter.return_weekdays = return_weekdays_bitmask;
+  }
+
+  filter.specialize();
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery match_sets()
+bool DealsSearchQuery::match_sets(uint32_t destination, uint8_t destination_country) const {
+  return (!filter_destination || destination_values_set.contains(destination)) &&
+         (!filter_destination_country || destination_country_set.contains(destination_country));
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery process_rows()
+// function that will be called by TableProcessor
+// for iterating over all not expired PageLayout::ROWS pages in table
+void DealsSearchQuery::process_rows(const i::DealInfo *deals, uint32_t size) {
+  for (uint32_t block = 0; block < size; block += DEALS_FILTER_BLOCK) {
+    const uint32_t count = std::min(size - block, (uint32_t)DEALS_FILTER_BLOCK);
+    uint64_t matched = filter.match(deals + block, count);
+
+    while (matched) {
+      const auto &deal = deals[block + __builtin_ctzll(matched)];
+      matched &= matched - 1;
+
+      // Deal matched all selected filters -> process it @ derivered class
+      if (match_sets(deal.destination, deal.destination_country)) {
+        process_deal(deal);
+      }
+    }
   }
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery process_columns()
+// function that will be called by TableProcessor
+// for iterating over all not expired PageLayout::COLUMNS pages in table
+void DealsSearchQuery::process_columns(const shared_mem::PageColumns<i::DealInfo> &page) {
+  const auto destinations = page.get<uint32_t>(i::COL_DESTINATION);
+  const auto countries = page.get<uint8_t>(i::COL_DESTINATION_COUNTRY);
+  i::DealInfo deal;
+
+  for (uint32_t block = 0; block < page.size; block += DEALS_FILTER_BLOCK) {
+    const uint32_t count = std::min(page.size - block, (uint32_t)DEALS_FILTER_BLOCK);
+    uint64_t matched = filter.match(page, block, count);
+
+    while (matched) {
+      const uint32_t idx = block + __builtin_ctzll(matched);
+      matched &= matched - 1;
 
-  if (filter_stay_days &&
-      (deal.stay_days < stay_days_values.from || deal.stay_days > stay_days_values.to)) {
-    return;
+      // Deal matched all selected filters -> restore it and process @ derivered class
+      if (match_sets(destinations[idx], countries[idx])) {
+        page.get_element(idx, deal);
+        process_deal(deal);
+      }
+    }
   }
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery split()
+// called by scan thread of part, query doesn't scan pages until parts are split
+std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>> DealsSearchQuery::split() const {
+  return std::unique_ptr<Part>(new Part(*this));
+}
 
-  if (filter_flight_by_stops && (direct_flights_flag != deal.direct)) {
-    return;
+//----------------------------------------------------------------
+// DealsSearchQuery merge()
+// part pages follow pages of query and parts before
+void DealsSearchQuery::merge(shared_mem::TableProcessor<i::DealInfo> &part) {
+  for (const auto &deal : static_cast<Part &>(part).deals[0]) {
+    process_deal(deal);
   }
+}
 
-  if (filter_departure_weekdays && (deal.departure_day_of_week & departure_weekdays_bitmask) == 0) {
-    return;
+//----------------------------------------------------------------
+// DealsSearchQuery partition()
+// called before split(), parts keep deals by partitions of query
+bool DealsSearchQuery::partition(uint32_t partitions) {
+  if (!partition_groups(partitions)) {
+    return false;
   }
+  group_partitions = partitions;
+  return true;
+}
 
-  if (filter_return_weekdays && (deal.return_day_of_week & return_weekdays_bitmask) == 0) {
-    return;
+//----------------------------------------------------------------
+// DealsSearchQuery merge_partition()
+// deals of part 0 are grouped already, deals of other parts follow them
+void DealsSearchQuery::merge_partition(
+    const std::vector<std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>>> &parts,
+    uint32_t partition) {
+  for (size_t part = 1; part < parts.size(); ++part) {
+    for (const auto &deal : static_cast<Part &>(*parts[part]).deals[partition]) {
+      process_deal(deal);
+    }
+  }
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery share_filters()
+// filters checked by process_rows(), DealsFilter is the same in all processes.
+// sibling sends back no more groups than the result limit, so the limit must fit the slot
+bool DealsSearchQuery::share_filters(i::ScanFilter &shared, i::ScanGroups &groups) const {
+  const auto &destinations = destination_values_set.get_codes();
+  if (filter_destination && destinations.size() > DEALSCAN_MAX_DESTINATIONS) {
+    return false;
+  }
+  if (!share_groups(groups) || groups.limit > DEALSCAN_TASK_GROUPS) {
+    return false;
+  }
+
+  shared.filter = filter;
+  shared.filter_destination = filter_destination;
+  shared.destinations_count = filter_destination ? destinations.size() : 0;
+  std::copy(destinations.begin(), destinations.begin() + shared.destinations_count,
+            shared.destinations);
+  shared.filter_destination_country = filter_destination_country;
+  shared.destination_countries = destination_country_set;
+  return true;
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery scan_partitions()
+void DealsSearchQuery::scan_partitions(const shared_mem::ScanPage *pages, size_t count,
+                                       const i::ScanGroups &groups,
+                                       const std::vector<bool> &partitions) {
+  Partitions query{*this, groups, partitions};
+  table.processPages(query, pages, count);
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery scan_shared()
+bool DealsSearchQuery::scan_shared(shared_mem::Table<i::DealInfo> &table,
+                                   const i::ScanFilter &shared, const i::ScanGroups &groups,
+                                   uint32_t partition, uint32_t partitions,
+                                   const shared_mem::ScanPage *pages, size_t count,
+                                   std::vector<i::DealInfo> &deals) {
+  SharedGroups query{table, groups, partition, partitions};
+  query.filter = shared.filter;
+  query.filter.specialize();  // rows matcher of owner process is not valid here
+  query.filter_destination = shared.filter_destination;
+  for (uint32_t idx = 0; idx < shared.destinations_count; ++idx) {
+    query.destination_values_set.insert(shared.destinations[idx]);
   }
+  query.filter_destination_country = shared.filter_destination_country;
+  query.destination_country_set = shared.destination_countries;
 
-  // Deal matched all selected filters -> process it @ derivered class
-  process_deal(deal);
+  const bool complete = table.processPages(query, pages, count);
+  deals = query.get_result();
+  return complete;
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery process_element()
+// single deal is a block of one deal
+void DealsSearchQuery::process_element(const i::DealInfo &deal) {
+  process_rows(&deal, 1);
 }
 }  // namespace deals
\ No newline at end of file
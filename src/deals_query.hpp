@@ -1,6 +1,9 @@
 #ifndef SRC_DEALS_QUERY_HPP
 #define SRC_DEALS_QUERY_HPP
 
+#include "deals_filter.hpp"
+#include "deals_postings.hpp"
+#include "deals_scan_queue.hpp"
 #include "deals_types.hpp"
 #include "search_query.hpp"
 #include "shared_memory.hpp"
@@ -17,25 +20,114 @@ class DealsSearchQuery : public shared_mem::TableProcessor<i::DealInfo>, public
   }
   // preparations and actual processing
   std::vector<i::DealInfo> execute();
+  // execute() by steps, so the process could do something else between resume() calls:
+  // start() prepares filters, resume() scans until deadline (timing::getTimestampMs())
+  // and returns true when deals are processed, finish() returns result
+  void start();
+  bool resume(int64_t deadline_ms);
+  std::vector<i::DealInfo> finish();
+  // deals of a few destinations are read by postings of table (DealsBest if best)
+  void use_postings(const DealsPostings& postings, bool best);
+  // large scan of the table (tables[table] of queue) is shared with sibling processes
+  void use_scan_queue(DealsScanQueue& queue, uint32_t table);
 
  private:
   // function that will be called by TableProcessor
   // for iterating over all not expired pages in table
   void process_element(const i::DealInfo& element) final override;
+  // elements of PageLayout::ROWS page are checked by blocks with DealsFilter
+  void process_rows(const i::DealInfo* elements, uint32_t size) final override;
+  // skip pages which summary shows no deals for current filters
+  bool skip_page(const shared_mem::PageSummary& summary) final override;
+  // same for pages stored by columns: only columns of active filters are read
+  // and deals are restored only if matched
+  void process_columns(const shared_mem::PageColumns<i::DealInfo>& page) final override;
+  // dates of filters are compared with i::DealInfo days
+  void dates_to_days();
+  // copy active filters to DealsFilter
+  void prepare_filter();
+  // process deals of filtered destinations from postings, false if table must be scanned
+  bool process_postings();
+  // filters which DealsFilter does not check
+  bool match_sets(uint32_t destination, uint8_t destination_country) const;
+
+  // pages of scan part are filtered by copy of query in scan thread, merge() passes
+  // matched deals to process_deal() in pages order, so groups of derived queries
+  // get deals in the same order as without parts
+  class Part;
+  bool splittable() const final override {
+    return true;
+  }
+  std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>> split() const final override;
+  void merge(shared_mem::TableProcessor<i::DealInfo>& part) final override;
+  // derived query with groups in partitions of group_key() lets parts keep matched
+  // deals by partitions, then every partition is grouped by its scan thread
+  bool partition(uint32_t partitions) final override;
+  void merge_partition(
+      const std::vector<std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>>>& parts,
+      uint32_t partition) final override;
+
+  // scan shared with sibling processes (DealsScanQueue) is split by partitions of groups:
+  // owner passes query deals of its partitions only (Partitions), sibling groups deals
+  // of one partition by shared key of groups (SharedGroups)
+  class Partitions;
+  class SharedGroups;
+  // filters and groups for pages scanned by sibling process, false if they don't fit
+  bool share_filters(i::ScanFilter& shared, i::ScanGroups& groups) const;
+  // owner side: deals of pages which groups are in partitions[partition_of(key)]
+  void scan_partitions(const shared_mem::ScanPage* pages, size_t count,
+                       const i::ScanGroups& groups, const std::vector<bool>& partitions);
+  // sibling side: result deals of groups of partition for shared filters,
+  // the first groups.limit of them. false if some pages were released or reused
+  // since owner listed them
+  static bool scan_shared(shared_mem::Table<i::DealInfo>& table, const i::ScanFilter& shared,
+                          const i::ScanGroups& groups, uint32_t partition, uint32_t partitions,
+                          const shared_mem::ScanPage* pages, size_t count,
+                          std::vector<i::DealInfo>& deals);
 
   // VIRTUALS:
   // if process_element() deside deals worth of processing
   // process_deal() will be called in derivered class
   virtual void process_deal(const i::DealInfo& deal) = 0;
 
+  // groups of deals are kept in partitions (flat_map::PartitionedMap) of key of group:
+  // process_deal() of deals of one partition changes only groups of that partition.
+  // false if groups are not partitioned, deals of parts are grouped by caller thread
+  virtual bool partition_groups(uint32_t partitions) {
+    return false;
+  }
+  virtual uint64_t group_key(const i::DealInfo& deal) const {
+    return 0;
+  }
+  // groups of query as sibling process computes them, false if query is not shared
+  virtual bool share_groups(i::ScanGroups& groups) const {
+    return false;
+  }
+
   // before and after processing
   virtual void pre_search() = 0;
   virtual void post_search() = 0;
   virtual const std::vector<i::DealInfo> get_result() const = 0;
 
+  // query needs only deals which could be the cheapest ones,
+  // DealsDatabase gives it DealsBest table then
+  static const bool uses_best_deals = false;
+
   shared_mem::Table<i::DealInfo>& table;
+  DealsFilter filter;
+  const DealsPostings* postings = nullptr;
+  bool postings_best = false;
+  DealsScanQueue* scan_queue = nullptr;
+  uint32_t scan_table = 0;
+  uint32_t group_partitions = 1;  // set by partition()
+  // table scan begun by resume(), copies of query for scan parts don't use it
+  std::shared_ptr<shared_mem::TableScan<i::DealInfo>> scan;
 
   friend class DealsDatabase;
+  friend class DealsScanQueue;
+  template <typename QueryClass>
+  friend std::vector<i::DealInfo> runBenchQuery(shared_mem::Table<i::DealInfo>& table,
+                                                types::ObjectMap params);
 };
 }  // namespace deals
 #endif
\ No newline at end of file
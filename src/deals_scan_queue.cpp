@@ -0,0 +1,277 @@
+#include "deals_scan_queue.hpp"
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "deals_query.hpp"
+
+namespace deals {
+namespace {
+bool scan_sharing = false;
+}  // namespace
+
+void setScanSharing(bool enabled) {
+  scan_sharing = enabled;
+}
+
+bool scanSharing() {
+  return scan_sharing;
+}
+
+//---------------------------------------------------------
+// DealsScanQueue constructor
+//---------------------------------------------------------
+DealsScanQueue::DealsScanQueue(const std::string& name, const DealsTables& tables)
+    : tables(tables), slots{name, DEALSCAN_TASKS, sizeof(i::ScanTask)},
+      lock{name + ":queue"} {
+}
+
+//---------------------------------------------------------
+// DealsScanQueue scan
+//---------------------------------------------------------
+// result of a group depends on order of all its deals (utils::CheapestAndLast), so
+// tasks are partitions of groups over all pages: groups of sibling are complete
+uint32_t DealsScanQueue::scan(DealsSearchQuery& query, uint32_t table_id) {
+  auto& table = *tables[table_id];
+  const auto pages = table.getPagesToScan(query);
+
+  uint64_t elements = 0;
+  for (const auto& page : pages) {
+    elements += page.elements;
+  }
+  const uint32_t partitions =
+      std::min<uint64_t>(elements / DEALSCAN_PART_ELEMENTS, DEALSCAN_MAX_PARTS);
+
+  i::ScanFilter filter;
+  i::ScanGroups groups;
+  if (partitions < 2 || pages.size() > DEALINFO_PAGES || !query.share_filters(filter, groups)) {
+    table.processPages(query, pages.data(), pages.size());
+    return 0;
+  }
+
+  // siblings take other partitions while the first one is grouped here,
+  // partition which doesn't get a slot is grouped here as well
+  std::vector<int32_t> task_slot(partitions, -1);
+  std::vector<uint32_t> task_id(partitions, 0);
+  std::vector<bool> own(partitions, false);
+  own[0] = true;
+  for (uint32_t partition = 1; partition < partitions; ++partition) {
+    task_slot[partition] = queue_task(table_id, filter, groups, partition, partitions,
+                                      pages.data(), pages.size(), task_id[partition]);
+    own[partition] = task_slot[partition] < 0;
+  }
+
+  uint32_t shared = 0;
+  uint32_t partition = 1;
+  try {
+    query.scan_partitions(pages.data(), pages.size(), groups, own);
+
+    // not taken by siblings or failed, grouped by one more scan
+    std::vector<bool> left(partitions, false);
+    bool scan_left = false;
+    for (; partition < partitions; ++partition) {
+      if (task_slot[partition] < 0) {
+        continue;
+      }
+      if (collect(query, task_slot[partition], task_id[partition])) {
+        ++shared;
+      } else {
+        left[partition] = scan_left = true;
+      }
+      task_slot[partition] = -1;
+    }
+    if (scan_left) {
+      query.scan_partitions(pages.data(), pages.size(), groups, left);
+    }
+  } catch (...) {
+    for (; partition < partitions; ++partition) {
+      if (task_slot[partition] >= 0) {
+        cancel(task_slot[partition], task_id[partition]);
+      }
+    }
+    throw;
+  }
+
+  return shared;
+}
+
+//---------------------------------------------------------
+// DealsScanQueue run_task
+//---------------------------------------------------------
+bool DealsScanQueue::run_task() {
+  const pid_t pid = getpid();
+
+  // queue is looked through without lock, state is checked again under it
+  int32_t slot = -1;
+  for (uint32_t idx = 0; idx < DEALSCAN_TASKS && slot < 0; ++idx) {
+    const auto& task = get_task(idx);
+    if (__atomic_load_n(&task.state, __ATOMIC_ACQUIRE) == i::SCAN_TASK_QUEUED &&
+        task.owner != pid) {
+      slot = idx;
+    }
+  }
+  if (slot < 0) {
+    return false;
+  }
+
+  auto& task = get_task(slot);
+  {
+    lock.enter();
+    locks::AutoCloser guard(lock);
+    if (task.state != i::SCAN_TASK_QUEUED || task.owner == pid) {
+      return true;  // owner or another sibling was faster
+    }
+    if (!shared_mem::isProcessAlive(task.owner)) {
+      __atomic_store_n(&task.state, i::SCAN_TASK_FREE, __ATOMIC_RELEASE);
+      return true;
+    }
+    task.worker = pid;
+    __atomic_store_n(&task.state, i::SCAN_TASK_TAKEN, __ATOMIC_RELEASE);
+  }
+
+  // task is not changed by owner while it is taken. result is cut
+  // to the result limit of query, which fits the slot
+  std::vector<i::DealInfo> deals;
+  bool complete = false;
+  try {
+    complete = task.table < tables.size() &&
+               DealsSearchQuery::scan_shared(*tables[task.table], task.filter, task.groups,
+                                             task.partition, task.partitions, task.pages,
+                                             task.pages_count, deals);
+  } catch (types::Error& err) {
+    std::cerr << "ERROR DealsScanQueue::run_task " << err.message << std::endl;
+  }
+  if (complete) {
+    task.deals_count = std::min<size_t>(deals.size(), DEALSCAN_TASK_GROUPS);
+    std::copy(deals.begin(), deals.begin() + task.deals_count, task.deals);
+  }
+  task.complete = complete;
+
+  lock.enter();
+  locks::AutoCloser guard(lock);
+  // owner didn't wait for the task, it is not needed anymore
+  const auto state = task.state == i::SCAN_TASK_TAKEN ? i::SCAN_TASK_DONE : i::SCAN_TASK_FREE;
+  __atomic_store_n(&task.state, state, __ATOMIC_RELEASE);
+  return true;
+}
+
+//---------------------------------------------------------
+// DealsScanQueue get_task
+//---------------------------------------------------------
+i::ScanTask& DealsScanQueue::get_task(uint32_t slot) const {
+  return *(i::ScanTask*)slots.get_region(slot);
+}
+
+//---------------------------------------------------------
+// DealsScanQueue queue_task
+//---------------------------------------------------------
+int32_t DealsScanQueue::queue_task(uint32_t table, const i::ScanFilter& filter,
+                                   const i::ScanGroups& groups, uint32_t partition,
+                                   uint32_t partitions, const shared_mem::ScanPage* pages,
+                                   size_t count, uint32_t& id) {
+  lock.enter();
+  locks::AutoCloser guard(lock);
+
+  for (uint32_t slot = 0; slot < DEALSCAN_TASKS; ++slot) {
+    auto& task = get_task(slot);
+    if (!is_free(task)) {
+      continue;
+    }
+    id = ++task.id;
+    task.owner = getpid();
+    task.worker = 0;
+    task.table = table;
+    task.filter = filter;
+    task.groups = groups;
+    task.partition = partition;
+    task.partitions = partitions;
+    task.pages_count = count;
+    std::copy(pages, pages + count, task.pages);
+    task.complete = false;
+    task.deals_count = 0;
+    __atomic_store_n(&task.state, i::SCAN_TASK_QUEUED, __ATOMIC_RELEASE);
+    return slot;
+  }
+  return -1;
+}
+
+//---------------------------------------------------------
+// DealsScanQueue collect
+//---------------------------------------------------------
+bool DealsScanQueue::collect(DealsSearchQuery& query, uint32_t slot, uint32_t id) {
+  auto& task = get_task(slot);
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(DEALSCAN_WAIT_MS);
+  while (__atomic_load_n(&task.state, __ATOMIC_ACQUIRE) == i::SCAN_TASK_TAKEN &&
+         std::chrono::steady_clock::now() < deadline) {
+    usleep(50);
+  }
+
+  {
+    lock.enter();
+    locks::AutoCloser guard(lock);
+    // slot was reused after this process was taken for dead
+    if (task.id != id || task.owner != getpid()) {
+      return false;
+    }
+    switch (task.state) {
+      case i::SCAN_TASK_QUEUED:
+        __atomic_store_n(&task.state, i::SCAN_TASK_FREE, __ATOMIC_RELEASE);
+        return false;
+      case i::SCAN_TASK_TAKEN:
+        __atomic_store_n(&task.state, i::SCAN_TASK_ABANDONED, __ATOMIC_RELEASE);
+        return false;
+      case i::SCAN_TASK_DONE:
+        break;
+      default:
+        return false;
+    }
+  }
+
+  // done task is freed by owner only. groups of partition are not in query yet,
+  // so result deal of group is taken as it is
+  const bool complete = task.complete;
+  if (complete) {
+    for (uint32_t idx = 0; idx < task.deals_count; ++idx) {
+      query.process_deal(task.deals[idx]);
+    }
+  }
+
+  lock.enter();
+  locks::AutoCloser guard(lock);
+  __atomic_store_n(&task.state, i::SCAN_TASK_FREE, __ATOMIC_RELEASE);
+  return complete;
+}
+
+//---------------------------------------------------------
+// DealsScanQueue cancel
+//---------------------------------------------------------
+void DealsScanQueue::cancel(uint32_t slot, uint32_t id) {
+  auto& task = get_task(slot);
+  lock.enter();
+  locks::AutoCloser guard(lock);
+  if (task.id != id || task.owner != getpid()) {
+    return;
+  }
+  const auto state = task.state == i::SCAN_TASK_TAKEN ? i::SCAN_TASK_ABANDONED : i::SCAN_TASK_FREE;
+  __atomic_store_n(&task.state, state, __ATOMIC_RELEASE);
+}
+
+//---------------------------------------------------------
+// DealsScanQueue is_free
+//---------------------------------------------------------
+// queue lock is required
+bool DealsScanQueue::is_free(const i::ScanTask& task) {
+  switch (task.state) {
+    case i::SCAN_TASK_FREE:
+      return true;
+    case i::SCAN_TASK_QUEUED:
+    case i::SCAN_TASK_DONE:
+      return !shared_mem::isProcessAlive(task.owner);
+    default:
+      return !shared_mem::isProcessAlive(task.worker);
+  }
+}
+}  // namespace deals
@@ -0,0 +1,112 @@
+#ifndef SRC_DEALS_SCAN_QUEUE_HPP
+#define SRC_DEALS_SCAN_QUEUE_HPP
+
+#include <sys/types.h>
+#include <vector>
+#include "deals_filter.hpp"
+#include "deals_types.hpp"
+#include "locks.hpp"
+#include "search_query.hpp"
+#include "shared_memory.hpp"
+
+namespace deals {
+class DealsSearchQuery;
+
+// large scans of this process are shared with sibling processes
+// and this process scans parts of theirs. disabled by default
+void setScanSharing(bool enabled);
+bool scanSharing();
+
+namespace i {
+// filters of query which pages are checked by sibling (DealsSearchQuery restores them)
+struct ScanFilter {
+  DealsFilter filter;
+  bool filter_destination;
+  uint32_t destinations_count;
+  uint32_t destinations[DEALSCAN_MAX_DESTINATIONS];
+  bool filter_destination_country;
+  query::CountryCodesSet destination_countries;
+};
+
+// key of query groups which sibling computes for deals (DealsSearchQuery::share_groups())
+enum ScanGroupKey : uint32_t {
+  SCAN_GROUP_DESTINATION = 0,
+  SCAN_GROUP_COUNTRY,
+  SCAN_GROUP_DEPARTURE_DATE,
+  SCAN_GROUP_RETURN_DATE,
+  SCAN_GROUP_DATES,       // departure and return dates
+  SCAN_GROUP_EXACT_DATE,  // date of deal other than exact_date
+};
+
+// groups of query: deals of one group are taken by utils::CheapestAndLast,
+// result is the first limit groups by price and key (by_price) or by key
+struct ScanGroups {
+  uint32_t key;  // ScanGroupKey
+  uint32_t exact_date;
+  bool by_price;
+  uint32_t limit;
+};
+
+enum ScanTaskState : uint32_t {
+  SCAN_TASK_FREE = 0,
+  SCAN_TASK_QUEUED,     // waits for sibling, owner could take it back
+  SCAN_TASK_TAKEN,      // being scanned by worker
+  SCAN_TASK_DONE,       // deals are ready for owner
+  SCAN_TASK_ABANDONED,  // owner didn't wait, worker frees slot
+};
+
+// partition of groups of scan queued by owner process
+struct ScanTask {
+  uint32_t state;  // ScanTaskState, changed under queue lock
+  uint32_t id;     // next task of slot gets next id
+  pid_t owner;
+  pid_t worker;
+  uint32_t table;  // in tables of DealsScanQueue
+  ScanFilter filter;
+  ScanGroups groups;
+  uint32_t partition;  // groups of deals are taken from that partition of keys only
+  uint32_t partitions;
+  uint32_t pages_count;
+  shared_mem::ScanPage pages[DEALINFO_PAGES];
+  bool complete;  // all pages were scanned and result deals of groups are here
+  uint32_t deals_count;
+  DealInfo deals[DEALSCAN_TASK_GROUPS];
+};
+}  // namespace i
+
+//------------------------------------------------------------
+// DealsScanQueue
+//------------------------------------------------------------
+// partitions of groups of table scans in shared memory slots. owner queues all partitions
+// except the first one, scans pages for it and then goes over the others: result deals
+// of groups of done partition are passed to query, partitions not taken yet (or failed)
+// are taken back and grouped by one more scan of owner. slots of dead processes are reused
+class DealsScanQueue {
+ public:
+  // tables are the same (and in the same order) in all processes of queue
+  DealsScanQueue(const std::string& name, const DealsTables& tables);
+
+  // scan pages of tables[table] for query, return count of partitions grouped by siblings
+  uint32_t scan(DealsSearchQuery& query, uint32_t table);
+  // group one partition queued by another process, false if there was nothing to do
+  bool run_task();
+
+ private:
+  i::ScanTask& get_task(uint32_t slot) const;
+  // slot of new task, -1 if all slots are busy
+  int32_t queue_task(uint32_t table, const i::ScanFilter& filter, const i::ScanGroups& groups,
+                     uint32_t partition, uint32_t partitions, const shared_mem::ScanPage* pages,
+                     size_t count, uint32_t& id);
+  // pass result deals of groups of done task to query and free slot,
+  // false if owner must group the partition itself
+  bool collect(DealsSearchQuery& query, uint32_t slot, uint32_t id);
+  // owner gives task up
+  void cancel(uint32_t slot, uint32_t id);
+  static bool is_free(const i::ScanTask& task);
+
+  const DealsTables tables;
+  shared_mem::SharedMemoryArena slots;
+  locks::CriticalSection lock;
+};
+}  // namespace deals
+#endif
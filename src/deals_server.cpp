@@ -1,4 +1,5 @@
 #include <csignal>
+#include <cstdlib>
 #include <fstream>
 
 #include "deals_server.hpp"
@@ -55,7 +56,11 @@ void signalHandler(int signal) {
 // DealsServer process in child class
 //-----------------------------------------------------------
 void DealsServer::process() {
+  // poll doesn't wait while queries are pending
+  set_poll_timeout(pending.empty() ? idle_poll_ms : 0);
   auto connections = srv::TCPServer<Context>::process();
+  db.runScanTasks();
+  runPendingQueries();
 
   // quit after all connections are closed
   if (gotQuitSignal) {
@@ -72,6 +77,56 @@ void DealsServer::process() {
   }
 }
 
+//-----------------------------------------------------------
+// DealsServer runQuery
+//-----------------------------------------------------------
+void DealsServer::runQuery(Connection &conn, QueryResume resume) {
+  if (resume(conn, timing::getTimestampMs() + QUERY_SLICE_MS)) {
+    return;
+  }
+  conn.context.query_pending = true;
+  pending.push_back({&conn, std::move(resume)});
+}
+
+//-----------------------------------------------------------
+// DealsServer runPendingQueries
+//-----------------------------------------------------------
+void DealsServer::runPendingQueries() {
+  for (size_t idx = 0; idx < pending.size();) {
+    auto &query = pending[idx];
+    bool done = true;
+    try {
+      done = query.resume(*query.conn, timing::getTimestampMs() + QUERY_SLICE_MS);
+    } catch (types::Error err) {
+      terminateWithError(*query.conn, err);
+    } catch (...) {
+      types::Error err{"Something is broken inside me\n", types::ErrorCode::InternalError};
+      terminateWithError(*query.conn, err);
+    }
+
+    if (done) {
+      query.conn->context.query_pending = false;
+      pending.erase(pending.begin() + idx);
+    } else {
+      ++idx;
+    }
+  }
+}
+
+//-----------------------------------------------------------
+// DealsServer on close
+//-----------------------------------------------------------
+void DealsServer::on_close(Connection &conn) {
+  // nobody waits for result of query anymore
+  for (size_t idx = 0; idx < pending.size();) {
+    if (pending[idx].conn == &conn) {
+      pending.erase(pending.begin() + idx);
+    } else {
+      ++idx;
+    }
+  }
+}
+
 // TODO
 // *) remove truncate methods
 // *) overwrite not expired pages on low mem
@@ -92,6 +147,11 @@ void DealsServer::on_data(Connection &conn) {
     return;
   }
 
+  // connection gets nothing else until its query is done
+  if (conn.context.query_pending) {
+    return;
+  }
+
   conn.context.http.write(conn.get_data());
 
   if (conn.context.http.is_bad_request()) {
@@ -248,13 +308,22 @@ void DealsServer::getTop(Connection &conn) {
       return_date_from, return_date_to, rweekdays, stay_from, stay_to, direct_flights,            \
       deals_limit, timelimit, roundtrip_flights, departure_or_return_date, all_combinations
 
+  std::shared_ptr<deals::DealsJob<std::vector<deals::DealInfo>>> job;
   if (group_by_date.isDefined() && group_by_date.isTrue()) {
-    writeTopResult(conn, db.searchFor<deals::CheapestByDay>(TOP_SEARCH_PARAMS));
+    job = db.startSearch<deals::CheapestByDay>(TOP_SEARCH_PARAMS);
   } else if (group_by_country.isDefined() && group_by_country.isTrue()) {
-    writeTopResult(conn, db.searchFor<deals::CheapestByCountry>(TOP_SEARCH_PARAMS));
+    job = db.startSearch<deals::CheapestByCountry>(TOP_SEARCH_PARAMS);
   } else {
-    writeTopResult(conn, db.searchFor<deals::SimplyCheapest>(TOP_SEARCH_PARAMS));
+    job = db.startSearch<deals::SimplyCheapest>(TOP_SEARCH_PARAMS);
   }
+
+  runQuery(conn, [this, job](Connection &conn, int64_t deadline_ms) {
+    if (!job->resume(deadline_ms)) {
+      return false;
+    }
+    writeTopResult(conn, std::move(job->result));
+    return true;
+  });
 }
 
 //------------------------------------------------------------
@@ -305,20 +374,28 @@ void DealsServer::writeTopResult(Connection &conn, const std::vector<deals::Deal
 // getUniqueRoutes
 //-----------------------------------------------------------
 void DealsServer::getUniqueRoutes(Connection &conn) {
-  const auto result = db.getUniqueRoutesDeals();
+  std::shared_ptr<deals::DealsJob<std::string>> job = db.startUniqueRoutes();
 
-  if (result.size() == 0) {
-    http::HttpResponse rq_result(204, "Empty result");
-    rq_result.add_header("Content-Length", "0");
-    conn.close(rq_result);
-    return;
-  }
+  runQuery(conn, [job](Connection &conn, int64_t deadline_ms) {
+    if (!job->resume(deadline_ms)) {
+      return false;
+    }
+    const auto &result = job->result;
 
-  http::HttpResponse rq_result(200, "OK");
-  rq_result.add_header("Content-Type", "text/plain");
-  rq_result.add_header("Content-Length", std::to_string(result.length()));
-  rq_result.write(result);
-  conn.close(rq_result);
+    if (result.size() == 0) {
+      http::HttpResponse rq_result(204, "Empty result");
+      rq_result.add_header("Content-Length", "0");
+      conn.close(rq_result);
+      return true;
+    }
+
+    http::HttpResponse rq_result(200, "OK");
+    rq_result.add_header("Content-Type", "text/plain");
+    rq_result.add_header("Content-Length", std::to_string(result.length()));
+    rq_result.write(result);
+    conn.close(rq_result);
+    return true;
+  });
 }
 
 //-----------------------------------------------------------
@@ -415,12 +492,28 @@ int main(int argc, char *argv[]) {
   if (argc > 1 && std::string(argv[1]) == "test") {
     std::cout << "running autotests..." << std::endl;
     try {
-      locks::CriticalSection lock1("DealsInfo");
-      locks::CriticalSection lock2("DealsData");
-      locks::CriticalSection lock3("TopDst");
-      lock1.reset_not_for_production();
-      lock2.reset_not_for_production();
-      lock3.reset_not_for_production();
+      // locks left by crashed run: tables of every shard, arenas and their stripes
+      std::vector<std::string> lock_names{
+          DEALS_DB_NAME "Context",      DEALS_DB_NAME "Migration",      DEALDATA_TABLENAME,
+          DEALDATA_TABLENAME ".arena",  DEALS_LEGACY_INFO_TABLENAME,    DEALS_LEGACY_DATA_TABLENAME,
+          TOPDST_TABLENAME,             TOPDST_TABLENAME "Context",     DEALOFFERS_NAME,
+          DEALPOSTINGS_NAME,            DEALSCAN_NAME,                  DEALSCAN_NAME ":queue"};
+      for (uint16_t shard = 0; shard < DEALS_SHARDS; ++shard) {
+        for (const std::string table : {DEALINFO_TABLENAME, DEALBEST_TABLENAME}) {
+          lock_names.push_back(table + ":" + std::to_string(shard));
+          lock_names.push_back(table + ":" + std::to_string(shard) + ".arena");
+        }
+      }
+      for (uint32_t stripe = 0; stripe < DEALOFFERS_STRIPES; ++stripe) {
+        lock_names.push_back(DEALOFFERS_NAME ":" + std::to_string(stripe));
+      }
+      for (uint32_t stripe = 0; stripe < DEALPOSTINGS_STRIPES; ++stripe) {
+        lock_names.push_back(DEALPOSTINGS_NAME ":" + std::to_string(stripe));
+      }
+      for (const auto &name : lock_names) {
+        locks::CriticalSection lock(name);
+        lock.reset_not_for_production();
+      }
 
       http::unit_test();
       deals::unit_test();
@@ -441,6 +534,16 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    try {
+      deals::benchmark(argc > 2 ? std::stol(argv[2]) : 1000000);
+      return 0;
+    } catch (types::Error err) {
+      std::cerr << "BENCH FAILED: " << err.message << std::endl;
+      return -1;
+    }
+  }
+
   if (argc > 1 && std::string(argv[1]) == "stat") {
     statsd::metric.inc("dealstest", {{"port", "5000"}});
     return 0;
@@ -455,12 +558,35 @@ int main(int argc, char *argv[]) {
   std::signal(SIGTERM, deals_srv::signalHandler);
   std::signal(SIGBUS, deals_srv::signalHandler);
 
+  // DEALS_HUGEPAGES=1 - new deals tables are created in huge pages (MEMPAGE_HUGEPAGES_PATH)
+  const char *huge_pages = std::getenv("DEALS_HUGEPAGES");
+  shared_mem::setHugePages(huge_pages != nullptr && std::string(huge_pages) == "1");
+  // DEALS_SCAN_THREADS=N - threads scanning parts of one table, hardware threads by default
+  const char *scan_threads = std::getenv("DEALS_SCAN_THREADS");
+  if (scan_threads != nullptr) {
+    shared_mem::setScanThreads(std::stol(scan_threads));
+  }
+
+  // DEALS_SCAN_SHARING=1 - large scans are shared with sibling processes of the same mode
+  const char *scan_sharing = std::getenv("DEALS_SCAN_SHARING");
+  deals::setScanSharing(scan_sharing != nullptr && std::string(scan_sharing) == "1");
+
+  // DEALS_IO_URING=1 - connections are served by io_uring backend (epoll if kernel refuses)
+  const char *io_uring = std::getenv("DEALS_IO_URING");
+  srv::setIoUring(io_uring != nullptr && std::string(io_uring) == "1");
+
   const std::string host = argv[1];
   const uint16_t port = std::stol(argv[2]);
-  deals_srv::DealsServer srv(host, port);
+  try {
+    deals_srv::DealsServer srv(host, port);
 
-  while (1) {
-    srv.process();
+    while (1) {
+      srv.process();
+    }
+  } catch (types::Error err) {
+    // f.e. shared tables of other layout are used by running process
+    std::cerr << "SERVER FAILED: " << err.message << std::endl;
+    return -1;
   }
 
   return 0;
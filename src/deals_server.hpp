@@ -10,6 +10,9 @@
 #include "tcp_server.hpp"
 #include "top_destinations.hpp"
 
+// query of connection runs for slice, then other connections are polled
+#define QUERY_SLICE_MS 5
+
 namespace deals_srv {
 //------------------------------------------------------
 // Connection Context
@@ -18,6 +21,7 @@ class Context {
  public:
   int anyvalue;
   http::HttpParser http;
+  bool query_pending = false;  // the rest of request is ignored until query is done
 };
 
 //------------------------------------------------------
@@ -26,6 +30,10 @@ class Context {
 class DealsServer : public srv::TCPServer<Context> {
  public:
   DealsServer(const std::string host, const uint16_t port) : srv::TCPServer<Context>(host, port) {
+    // idle process looks for parts of sibling scans between polls
+    if (deals::scanSharing()) {
+      idle_poll_ms = DEALSCAN_POLL_MS;
+    }
   }
   void process();
   void quit();
@@ -33,6 +41,16 @@ class DealsServer : public srv::TCPServer<Context> {
  private:
   void on_connect(Connection& conn) final override;
   void on_data(Connection& conn) final override;
+  void on_close(Connection& conn) final override;
+
+  // query runs by slices until resume() writes response to connection and returns true
+  using QueryResume = std::function<bool(Connection& conn, int64_t deadline_ms)>;
+  struct PendingQuery {
+    Connection* conn;
+    QueryResume resume;
+  };
+  void runQuery(Connection& conn, QueryResume resume);
+  void runPendingQueries();
 
   void addDeal(Connection& conn);
   void getTop(Connection& conn);
@@ -47,6 +65,8 @@ class DealsServer : public srv::TCPServer<Context> {
   top::TopDstDatabase db_dst;
 
   bool quit_request = false;
+  std::vector<PendingQuery> pending;  // slice of each one after every poll
+  int idle_poll_ms = POLL_TIMEOUT_MS;
 };
 }  // namespace deals_srv
 
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "deals_stats.hpp"
 #include "types.hpp"
 
@@ -5,15 +7,17 @@ namespace deals {
 //------------------------------------------------------------
 // UniqueRoutes
 //------------------------------------------------------------
-const std::string getStatsRoutine(shared_mem::Table<i::DealInfo>& table) {
+const std::string getStatsRoutine(const DealsTables& tables, uint64_t data_size) {
   StatsProcessor stat;
-  table.processRecords(stat);
+  stat.size = data_size;
+  for (auto table : tables) {
+    table->processRecords(stat);
+  }
   return stat.getStringResults();
 }
 
 void StatsProcessor::process_element(const i::DealInfo& deal) {
   elements++;
-  size += deal.size;
 
   if (deal.timestamp > max) {
     max = deal.timestamp;
@@ -37,6 +41,32 @@ void StatsProcessor::process_element(const i::DealInfo& deal) {
   */
 }
 
+void StatsProcessor::process_columns(const shared_mem::PageColumns<i::DealInfo>& page) {
+  const auto timestamps = page.get<uint32_t>(i::COL_TIMESTAMP);
+  elements += page.size;
+
+  for (uint32_t idx = 0; idx < page.size; ++idx) {
+    if (timestamps[idx] > max) {
+      max = timestamps[idx];
+    }
+
+    if (timestamps[idx] < min) {
+      min = timestamps[idx];
+    }
+  }
+}
+
+std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>> StatsProcessor::split() const {
+  return std::unique_ptr<StatsProcessor>(new StatsProcessor());
+}
+
+void StatsProcessor::merge(shared_mem::TableProcessor<i::DealInfo>& part) {
+  const auto& part_stats = static_cast<StatsProcessor&>(part);
+  elements += part_stats.elements;
+  max = std::max(max, part_stats.max);
+  min = std::min(min, part_stats.min);
+}
+
 const std::string StatsProcessor::getStringResults() {
   std::string res;
 
@@ -10,7 +10,8 @@ namespace deals {
 //------------------------------------------------------------
 //
 //------------------------------------------------------------
-const std::string getStatsRoutine(shared_mem::Table<i::DealInfo>& table);
+// data_size - size of deals data (DealsData table)
+const std::string getStatsRoutine(const DealsTables& tables, uint64_t data_size);
 
 //------------------------------------------------------------
 //
@@ -26,6 +27,14 @@ class StatsProcessor : public shared_mem::TableProcessor<i::DealInfo> {
  protected:
   // function that will be called for iterating over all not expired pages in table
   void process_element(const i::DealInfo& element) final override;
+  // only timestamp column is needed
+  void process_columns(const shared_mem::PageColumns<i::DealInfo>& page) final override;
+  // pages are scanned by parts in scan threads
+  bool splittable() const final override {
+    return true;
+  }
+  std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>> split() const final override;
+  void merge(shared_mem::TableProcessor<i::DealInfo>& part) final override;
   std::unordered_map<std::string, uint32_t> group_by_route;
 };
 
@@ -2,9 +2,21 @@
 #include <cassert>
 #include <cinttypes>
 #include <climits>
+#include <cstring>
 #include <iostream>
+#include <thread>
+#include <unordered_map>
 
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "deals_cheapest.hpp"
+#include "deals_cheapest_by_country.hpp"
+#include "deals_cheapest_by_date.hpp"
 #include "deals_database.hpp"
+#include "deals_filter.hpp"
+#include "deals_stats.hpp"
+#include "flat_map.hpp"
 #include "timing.hpp"
 #define TEST_ELEMENTS_COUNT 50000
 
@@ -146,6 +158,14 @@ void convertertionsTest() {
   assert(date2.days_after(date1) == 58);
   assert(date3.days_after(date2) == 1);
 
+  assert(date1.get_days() == 16436);
+  assert(date4.get_days() - date1.get_days() == 365);
+  assert(date3.get_days() - date2.get_days() == 1);
+  assert(types::date_to_days(19700102) == 1);
+  assert(types::days_to_date(date2.get_days()) == 20150228);
+  assert(types::days_to_date(date4.get_days()) == 20160101);
+  assert(types::days_to_date(UINT16_MAX) == 21490606);
+
   assert(::utils::day_of_week_str_from_date("2016-06-25") == "sat");
   assert(::utils::day_of_week_str_from_date("2016-04-13") == "wed");
   assert(::utils::day_of_week_from_str("sat") == 5);
@@ -154,9 +174,433 @@ void convertertionsTest() {
   assert(::utils::day_of_week_from_str("eff") == 7);
 }
 
+//------------------------------------------------------------------------
+// DealsFilter: SIMD and scalar masks must be equal to per deal checks
+//------------------------------------------------------------------------
+void filterTest() {
+  std::cout << "Deals filter" << std::endl;
+  i::DealInfo deals[DEALS_FILTER_BLOCK];
+  const uint32_t day = types::date_to_days(20170101);
+
+  for (int test = 0; test < 1000; ++test) {
+    for (auto &deal : deals) {
+      deal.timestamp = 1000 + rand() % 10;
+      deal.origin = rand() % 3;
+      deal.departure_date = day + rand() % 10;
+      deal.return_date = rand() % 3 == 0 ? 0 : day + 4 + rand() % 10;
+      deal.stay_days = rand() % 10;
+      deal.direct = rand() % 2;
+      deal.departure_day_of_week = 1 << (rand() % 7);
+      deal.return_day_of_week = 1 << (rand() % 7);
+    }
+
+    DealsFilter filter;
+    // first 4 predicates give all specialized combinations
+    filter.predicates = rand() % 2 ? rand() % 16 : rand() % 256;
+    filter.timestamp = {1000 + (uint32_t)rand() % 5, UINT32_MAX};
+    filter.origin = {1, 1};
+    filter.departure_date = {day + 2, day + 6};
+    filter.return_date = {rand() % 2 ? day + 7 : 0, rand() % 2 ? day + 10 : UINT32_MAX};
+    filter.exact_date = day + 5;
+    filter.stay_days = {2, 6};
+    filter.direct = {1, 1};
+    filter.departure_weekdays = 0b0010101;
+    filter.return_weekdays = 0b1000110;
+
+    const uint32_t count = 1 + rand() % DEALS_FILTER_BLOCK;
+    uint64_t expected = 0;
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      const auto &deal = deals[idx];
+      const auto in = [](uint32_t value, uint32_t from, uint32_t to) {
+        return value >= from && value <= to;
+      };
+      const auto active = [&filter](uint32_t predicate) {
+        return (filter.predicates & predicate) != 0;
+      };
+      const bool matched =
+          deal.timestamp >= filter.timestamp.from &&
+          (!active(FILTER_ORIGIN) || deal.origin == filter.origin.from) &&
+          (!active(FILTER_DEPARTURE_DATE) ||
+           in(deal.departure_date, filter.departure_date.from, filter.departure_date.to)) &&
+          (!active(FILTER_RETURN_DATE) ||
+           in(deal.return_date, filter.return_date.from, filter.return_date.to)) &&
+          (!active(FILTER_EXACT_DATE) || deal.departure_date == filter.exact_date ||
+           deal.return_date == filter.exact_date) &&
+          (!active(FILTER_STAY_DAYS) ||
+           in(deal.stay_days, filter.stay_days.from, filter.stay_days.to)) &&
+          (!active(FILTER_DIRECT) || deal.direct == filter.direct.from) &&
+          (!active(FILTER_DEPARTURE_WEEKDAYS) ||
+           (deal.departure_day_of_week & filter.departure_weekdays)) &&
+          (!active(FILTER_RETURN_WEEKDAYS) || (deal.return_day_of_week & filter.return_weekdays));
+      expected |= (uint64_t)matched << idx;
+    }
+
+    filter.use_simd = false;
+    assert(filter.match_rows(deals, count) == expected);
+    filter.use_simd = DealsFilter::simd_available();
+    assert(filter.match_rows(deals, count) == expected);
+    // specialized matchers
+    filter.specialize();
+    assert(filter.match(deals, count) == expected);
+  }
+}
+
+//------------------------------------------------------------------------
+// query groups before utils::CheapestAndLast: taken deals history
+//------------------------------------------------------------------------
+i::DealInfo historyCheapest(const std::vector<i::DealInfo> &deals) {
+  i::DealInfo dst_deal;
+  std::memset(&dst_deal, 0, sizeof(dst_deal));
+  std::vector<i::DealInfo> history;
+
+  for (const auto &deal : deals) {
+    if (dst_deal.price == 0 || deal.price <= dst_deal.price) {
+      if (utils::equal(deal, dst_deal) && dst_deal.timestamp > deal.timestamp) {
+        continue;
+      }
+      dst_deal = deal;
+      history.push_back(deal);
+    } else if (utils::equal(deal, dst_deal) && dst_deal.timestamp < deal.timestamp) {
+      dst_deal = deal;
+      history.push_back(deal);
+    }
+  }
+  return utils::findCheapestAndLast(history);
+}
+
+//------------------------------------------------------------------------
+// CheapestAndLast: differential test with groups history
+//------------------------------------------------------------------------
+void cheapestAndLastTest() {
+  std::cout << "Cheapest and last" << std::endl;
+  const auto same = [](const i::DealInfo &d1, const i::DealInfo &d2) {
+    return std::memcmp(&d1, &d2, sizeof(d1)) == 0;
+  };
+  const auto make_deal = [](uint32_t offer, uint32_t timestamp, uint32_t price) {
+    i::DealInfo deal;
+    std::memset(&deal, 0, sizeof(deal));
+    deal.origin = 1;
+    deal.destination = 100 + offer / 2;
+    deal.direct = offer % 2;
+    deal.departure_date = 17000;
+    deal.timestamp = timestamp;
+    deal.price = price;
+    return deal;
+  };
+
+  // cheaper deal of offer A is outdated by its newer one taken before:
+  // C@1 $200, A@5 $100, B@1 $90, A@3 $80 gives B $90
+  {
+    utils::CheapestAndLast group;
+    const std::vector<i::DealInfo> deals{make_deal(6, 1, 200), make_deal(0, 5, 100),
+                                         make_deal(2, 1, 90), make_deal(0, 3, 80)};
+    for (const auto &deal : deals) {
+      group.add(deal);
+    }
+    assert(same(group.get(), historyCheapest(deals)));
+    assert(group.get().destination == 101 && group.get().price == 90);
+  }
+
+  for (int test = 0; test < 20000; ++test) {
+    // one deal of every offer: offers are updated in place by DealsOffers
+    const bool one_deal = test % 4 == 0;
+    // prices go down, so most deals are taken and offers don't fit inline
+    const bool cheaper = test % 3 == 0;
+    const uint32_t offers = 1 + rand() % (4 * DEALS_GROUP_OFFERS);
+    std::vector<i::DealInfo> deals;
+
+    for (uint32_t offer = 0; offer < offers; ++offer) {
+      const uint32_t offer_deals = one_deal ? 1 : 1 + rand() % 6;
+      for (uint32_t idx = 0; idx < offer_deals; ++idx) {
+        auto deal = make_deal(offer, 1000 + rand() % 8, 100 + rand() % 6);
+        deal.index = deals.size();
+        deals.push_back(deal);
+      }
+    }
+    std::random_shuffle(deals.begin(), deals.end());
+    if (cheaper) {
+      for (size_t idx = 0; idx < deals.size(); ++idx) {
+        deals[idx].price = 1000 - idx * (rand() % 3) / 2;
+      }
+    }
+
+    utils::CheapestAndLast group;
+    std::vector<i::DealInfo> added;
+    for (const auto &deal : deals) {
+      group.add(deal);
+      added.push_back(deal);
+      assert(same(group.get(), historyCheapest(added)));
+    }
+    assert(!group.empty());
+  }
+}
+
+//------------------------------------------------------------------------
+// FlatMap: differential test with std::unordered_map, reused after clear()
+//------------------------------------------------------------------------
+void flatMapTest() {
+  std::cout << "Flat map" << std::endl;
+  flat_map::FlatMap<uint64_t, uint32_t> map;
+
+  for (int test = 0; test < 100; ++test) {
+    std::unordered_map<uint64_t, uint32_t> expected;
+    map.clear();
+    const uint32_t keys = 1 + rand() % (test % 2 ? 50 : 5000);
+    for (int idx = 0; idx < 10000; ++idx) {
+      const uint64_t key = (uint64_t)(rand() % keys) << (test % 3 ? 0 : 32);
+      map[key] += idx;
+      expected[key] += idx;
+    }
+
+    assert(map.size() == expected.size());
+    assert(map.find(UINT64_MAX) == nullptr);
+    uint32_t found = 0;
+    map.for_each([&](uint64_t key, uint32_t value) {
+      assert(expected.at(key) == value);
+      assert(*map.find(key) == value);
+      ++found;
+    });
+    assert(found == expected.size());
+  }
+
+  // partitions are filled by keys of them only, keys move when partitions change
+  flat_map::PartitionedMap<uint64_t, uint32_t> partitioned;
+  std::unordered_map<uint64_t, uint32_t> expected;
+  for (uint32_t partitions : {3, 1, 8, 4}) {
+    partitioned.set_partitions(partitions);
+    for (int idx = 0; idx < 10000; ++idx) {
+      const uint64_t key = rand() % 3000;
+      partitioned[key] += idx;
+      expected[key] += idx;
+    }
+    assert(partitioned.size() == expected.size());
+    uint32_t found = 0;
+    for (uint32_t partition = 0; partition < partitions; ++partition) {
+      partitioned.for_each(partition, [&](uint64_t key, uint32_t value) {
+        assert(partitioned.partition(key) == partition);
+        assert(expected.at(key) == value && *partitioned.find(key) == value);
+        ++found;
+      });
+    }
+    assert(found == expected.size());
+  }
+  partitioned.clear();
+  assert(partitioned.size() == 0 && partitioned.partitions() == 1);
+}
+
+//------------------------------------------------------------------------
+// CountryScan: cheapest deals by country of all deals
+//------------------------------------------------------------------------
+class CountryScan : public CheapestByCountry {
+ public:
+  CountryScan(shared_mem::Table<i::DealInfo> &table) : CheapestByCountry(table) {
+  }
+  std::vector<i::DealInfo> run(DealsScanQueue *queue = nullptr) {
+    if (queue != nullptr) {
+      use_scan_queue(*queue, 0);
+    }
+    filter_result_limit = 256;  // every country
+    return execute();
+  }
+};
+
+//------------------------------------------------------------------------
+// ScanOrder: indexes of deals in scan order
+//------------------------------------------------------------------------
+class ScanOrder : public shared_mem::TableProcessor<i::DealInfo> {
+ public:
+  std::vector<uint32_t> indexes;
+
+ protected:
+  void process_element(const i::DealInfo &deal) final override {
+    indexes.push_back(deal.index);
+  }
+  bool splittable() const final override {
+    return true;
+  }
+  std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>> split() const final override {
+    return std::unique_ptr<ScanOrder>(new ScanOrder());
+  }
+  void merge(shared_mem::TableProcessor<i::DealInfo> &part) final override {
+    const auto &part_indexes = static_cast<ScanOrder &>(part).indexes;
+    indexes.insert(indexes.end(), part_indexes.begin(), part_indexes.end());
+  }
+};
+
+//------------------------------------------------------------------------
+// table scan by parts of scan threads: every page once, parts merged in pages order
+//------------------------------------------------------------------------
+void scanPartsTest() {
+  std::cout << "Scan parts" << std::endl;
+  const uint32_t deals_count = 200000;
+  shared_mem::SharedContext context{"TScan"};
+  shared_mem::Table<i::DealInfo> table{"TScan", 100, 5000, DEALS_EXPIRES, context};
+  table.cleanup();
+
+  i::DealInfo deal;
+  std::memset(&deal, 0, sizeof(deal));
+  for (uint32_t idx = 0; idx < deals_count; ++idx) {
+    deal.timestamp = timing::getTimestampSec() - idx % 100;
+    deal.index = idx;
+    deal.destination = idx % 1000;
+    deal.destination_country = idx % 37;
+    deal.departure_date = idx % 3;
+    deal.price = 1000 + idx * 7919 % 5000;
+    table.addRecord(&deal);
+  }
+
+  // results of groups don't depend on scan threads which merged them
+  const auto sorted_routes = [&table]() {
+    auto routes = ::utils::split_string(getUniqueRoutesRoutine({&table}), "\n");
+    std::sort(routes.begin(), routes.end());
+    return routes;
+  };
+
+  shared_mem::setScanThreads(1);
+  const auto stats = getStatsRoutine({&table}, 0);
+  const auto routes = sorted_routes();
+  const auto countries = CountryScan{table}.run();
+  assert(routes.size() >= 1000 && countries.size() == 37);
+
+  for (uint32_t threads : {4, 3, 1}) {
+    shared_mem::setScanThreads(threads);
+    ScanOrder scan;
+    table.processRecords(scan);
+    assert(scan.indexes.size() == deals_count);
+    for (uint32_t idx = 0; idx < deals_count; ++idx) {
+      assert(scan.indexes[idx] == idx);
+    }
+    assert(getStatsRoutine({&table}, 0) == stats);
+    assert(sorted_routes() == routes);
+    const auto parts_countries = CountryScan{table}.run();
+    assert(parts_countries.size() == countries.size());
+    assert(std::memcmp(parts_countries.data(), countries.data(),
+                       countries.size() * sizeof(i::DealInfo)) == 0);
+  }
+
+  // scan by slices of past deadline gets the same elements in the same order
+  ScanOrder sliced;
+  shared_mem::TableScan<i::DealInfo> slices{table, sliced, 20000};
+  uint32_t resumes = 1;
+  while (!slices.resume(0)) {
+    ++resumes;
+  }
+  assert(resumes > 1);
+  assert(sliced.indexes.size() == deals_count);
+  for (uint32_t idx = 0; idx < deals_count; ++idx) {
+    assert(sliced.indexes[idx] == idx);
+  }
+
+  shared_mem::setScanThreads(std::thread::hardware_concurrency());
+  table.drop();
+}
+
+//------------------------------------------------------------------------
+// the cheapest deals of destinations, siblings send back only that many groups
+class DestinationScan : public SimplyCheapest {
+ public:
+  DestinationScan(shared_mem::Table<i::DealInfo> &table) : SimplyCheapest(table) {
+  }
+  std::vector<i::DealInfo> run(DealsScanQueue *queue) {
+    if (queue != nullptr) {
+      use_scan_queue(*queue, 0);
+    }
+    filter_result_limit = 50;
+    return execute();
+  }
+};
+
+//------------------------------------------------------------------------
+// cheapest deals by departure days of 30 days (dense groups) or from the first of them
+class DayScan : public CheapestByDay {
+ public:
+  DayScan(shared_mem::Table<i::DealInfo> &table) : CheapestByDay(table) {
+  }
+  std::vector<i::DealInfo> run(DealsScanQueue *queue, uint16_t first_day, bool open) {
+    if (queue != nullptr) {
+      use_scan_queue(*queue, 0);
+    }
+    filter_departure_date = true;
+    departure_date_values = {types::days_to_date(first_day),
+                             open ? UINT32_MAX : types::days_to_date(first_day + 29), 30};
+    return execute();
+  }
+};
+
+//------------------------------------------------------------------------
+// partitions of groups taken by sibling process give the same result as scan of one process
+//------------------------------------------------------------------------
+void scanQueueTest() {
+  std::cout << "Scan queue" << std::endl;
+  const uint32_t deals_count = 200000;
+  const uint16_t first_day = 20005;
+  shared_mem::SharedContext context{"TShare"};
+  shared_mem::Table<i::DealInfo> table{"TShare", 100, 5000, DEALS_EXPIRES, context};
+  table.cleanup();
+  DealsScanQueue queue{"TShareQueue", {&table}};
+
+  // offers are repeated with other prices and timestamps
+  i::DealInfo deal;
+  std::memset(&deal, 0, sizeof(deal));
+  for (uint32_t idx = 0; idx < deals_count; ++idx) {
+    deal.timestamp = timing::getTimestampSec() - idx % 100;
+    deal.index = idx;
+    deal.destination = idx % 1000;
+    deal.destination_country = idx % 37;
+    deal.departure_date = 20000 + idx % 40;
+    deal.price = 1000 + idx * 7919 % 5000;
+    table.addRecord(&deal);
+  }
+
+  const auto run = [&](DealsScanQueue *queue) {
+    std::vector<std::vector<i::DealInfo>> results;
+    results.push_back(DestinationScan{table}.run(queue));
+    results.push_back(CountryScan{table}.run(queue));
+    results.push_back(DayScan{table}.run(queue, first_day, false));
+    results.push_back(DayScan{table}.run(queue, first_day, true));
+    return results;
+  };
+  const auto expected = run(nullptr);
+  assert(expected[0].size() == 50 && expected[1].size() == 37);
+  assert(expected[2].size() == 30 && expected[3].size() == 30);
+
+  // sibling exits with 0 if it grouped some partitions
+  const auto sibling = fork();
+  if (sibling == 0) {
+    uint32_t tasks = 0;
+    const auto until = timing::getTimestampSec() + 3;
+    while (timing::getTimestampSec() < until) {
+      if (queue.run_task()) {
+        ++tasks;
+      } else {
+        usleep(100);
+      }
+    }
+    _exit(tasks > 0 ? 0 : 1);
+  }
+
+  int status = -1;
+  while (waitpid(sibling, &status, WNOHANG) == 0) {
+    const auto results = run(&queue);
+    for (size_t query = 0; query < expected.size(); ++query) {
+      assert(results[query].size() == expected[query].size());
+      assert(std::memcmp(results[query].data(), expected[query].data(),
+                         expected[query].size() * sizeof(i::DealInfo)) == 0);
+    }
+  }
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  table.drop();
+}
+
 //------------------------------------------------------------------------
 void unit_test() {
   convertertionsTest();
+  filterTest();
+  cheapestAndLastTest();
+  flatMapTest();
+  scanPartsTest();
+  scanQueueTest();
 
   DealsDatabase db;
   db.truncate();
@@ -406,6 +850,51 @@ void unit_test() {
   }
 
   timer.tick("test 3 FINISH");
+
+  // 4th test -------------------------------
+  // deal of known offer is updated in place
+  // *********************************************************
+  auto index_elements = [&db]() {
+    uint64_t count = 0;
+    for (auto table : db.get_index_tables()) {
+      count += table->getElementsCount();
+    }
+    return count;
+  };
+  const auto deals_count = index_elements();
+  time += 5;
+  db.addDeal(ri(params, "MOW"), ri(params, "MAD"), rc(params, "IT"), rd(params, "2016-05-01"),
+             od(params, "2016-05-21"), rb(params, "true"), rn(params, "6000"), check);
+  assert(index_elements() == deals_count);
+
+  result = db.searchFor<deals::SimplyCheapest>(
+      ri(params, "MOW"), ois(params, "AAA,PAR,BER,MAD"), oc(params, "z"), od(params, "2016-05-01"),
+      od(params, "2016-05-01"), ow(params, "z"), od(params, "2016-05-21"),
+      od(params, "2016-05-21"), ow(params, "z"), on(params, "z"), on(params, "z"),
+      ob(params, "true"), on(params, "z"), on(params, "z"), ob(params, "z"), od(params, "z"),
+      ob(params, "z"));
+  assert(result.size() == 1);
+  assert(result[0].test->price == 6000 && result[0].test->overriden);
+  assert(result[0].data == "7, 7, 7");
+  timer.tick("test 4 FINISH");
+
+  // 5th test -------------------------------
+  // not direct deal is hidden in best deals by cheaper direct one
+  // *********************************************************
+  db.addDeal(ri(params, "MOW"), ri(params, "MAD"), rc(params, "IT"), rd(params, "2016-05-01"),
+             od(params, "2016-05-21"), rb(params, "false"), rn(params, "6900"), check);
+  for (const std::string direct : {"z", "false"}) {
+    result = db.searchFor<deals::SimplyCheapest>(
+        ri(params, "MOW"), ois(params, "MAD"), oc(params, "z"), od(params, "2016-05-01"),
+        od(params, "2016-05-01"), ow(params, "z"), od(params, "2016-05-21"),
+        od(params, "2016-05-21"), ow(params, "z"), on(params, "z"), on(params, "z"),
+        ob(params, direct), on(params, "z"), on(params, "z"), ob(params, "z"), od(params, "z"),
+        ob(params, "z"));
+    assert(result.size() == 1);
+    assert(result[0].test->price == (direct == "z" ? 6000 : 6900));
+  }
+  timer.tick("test 5 FINISH");
+
   std::cout << "DEALS OK" << std::endl;
 }
 }  // namespace deals_test
@@ -1,4 +1,28 @@
 #include "deals_types.hpp"
+
+namespace deals {
+//-----------------------------------------------------------
+// DealsShard constructor
+//-----------------------------------------------------------
+DealsShard::DealsShard(uint16_t shard, shared_mem::SharedContext& context)
+    : index{DEALINFO_TABLENAME ":" + std::to_string(shard), DEALINFO_PAGES, DEALINFO_ELEMENTS,
+            DEALS_EXPIRES,                                 context,        DEALINFO_LAYOUT,
+            DEALS_STORAGE},
+      best{DEALBEST_TABLENAME ":" + std::to_string(shard), DEALBEST_PAGES, DEALINFO_ELEMENTS,
+           DEALS_EXPIRES,                                 context,        DEALINFO_LAYOUT,
+           DEALS_STORAGE} {
+}
+
+//-----------------------------------------------------------
+// getOriginShard
+//-----------------------------------------------------------
+// IATA code bytes are mixed by multiplication, high bits of product choose the shard
+uint16_t getOriginShard(uint32_t origin) {
+  const uint32_t mixed = origin * 0x9E3779B1u;
+  return ((uint64_t)mixed * DEALS_SHARDS) >> 32;
+}
+}  // namespace deals
+
 //***********************************************************
 //                   UTILS
 //***********************************************************
@@ -6,11 +30,12 @@ namespace deals {
 namespace utils {
 //-----------------------------------------------------------
 void print(const i::DealInfo& deal) {
-  std::cout << "i::DEAL: (" << types::int_to_date(deal.departure_date) << ")"
+  std::cout << "i::DEAL: (" << types::int_to_date(types::days_to_date(deal.departure_date)) << ")"
             << types::code_to_origin(deal.origin) << "-" << types::code_to_origin(deal.destination)
-            << (deal.return_date ? ("(" + types::int_to_date(deal.return_date) + ") :")
-                                 : "             :")
-            << deal.price << " " << deal.page_name << ":" << deal.index << std::endl;
+            << (deal.return_date
+                    ? ("(" + types::int_to_date(types::days_to_date(deal.return_date)) + ") :")
+                    : "             :")
+            << deal.price << " " << deal.page_id << ":" << deal.index << std::endl;
 }
 //-----------------------------------------------------------
 void print(const DealInfo& deal) {
@@ -79,6 +104,131 @@ const i::DealInfo findCheapestAndLast(const std::vector<i::DealInfo>& history) {
   // when we rich this point last_deal - is cheapest and newest available
   return last_deal;
 }
+
+//----------------------------------------------------------------
+// CheapestAndLast add()
+// deal is taken as groups history took it: if it is not more expensive than the last
+// taken one (but not older deal of its offer), or if it is newer deal of its offer
+//----------------------------------------------------------------
+void CheapestAndLast::add(const i::DealInfo& deal) {
+  if (last.price == 0 || deal.price <= last.price) {
+    // ignore same route and dates with lower price, but older timestamp
+    if (equal(deal, last) && last.timestamp > deal.timestamp) {
+      return;
+    }
+  } else if (!equal(deal, last) || last.timestamp >= deal.timestamp) {
+    return;
+  }
+
+  // findCheapestAndLast() goes back from the last deal of history to the first one which
+  // has no newer deal of its offer before it, so it is the last such deal taken
+  if (!is_outdated(deal)) {
+    result = deal;
+  }
+  // the last taken deal is compared with deals taken after the next one
+  if (taken > 1) {
+    update_offer(last);
+  }
+  last = deal;
+  ++taken;
+}
+
+//----------------------------------------------------------------
+// CheapestAndLast is_outdated()
+// offers keep deals taken after the first one and before the last one
+//----------------------------------------------------------------
+bool CheapestAndLast::is_outdated(const i::DealInfo& deal) const {
+  const Offer offer = get_offer(deal);
+  const Offer* known = nullptr;
+
+  if (more_offers) {
+    uint64_t key;
+    known = find_more_offer(offer, key);
+  } else {
+    for (uint8_t pos = 0; pos < size && known == nullptr; ++pos) {
+      if (is_offer(offers[pos], offer)) {
+        known = &offers[pos];
+      }
+    }
+  }
+  return known != nullptr && known->timestamp > deal.timestamp;
+}
+
+//----------------------------------------------------------------
+// CheapestAndLast update_offer()
+//----------------------------------------------------------------
+void CheapestAndLast::update_offer(const i::DealInfo& deal) {
+  const Offer offer = get_offer(deal);
+
+  if (!more_offers) {
+    for (uint8_t pos = 0; pos < size; ++pos) {
+      if (is_offer(offers[pos], offer)) {
+        offers[pos].timestamp = std::max(offers[pos].timestamp, offer.timestamp);
+        return;
+      }
+    }
+    if (size < DEALS_GROUP_OFFERS) {
+      offers[size++] = offer;
+      return;
+    }
+
+    // inline offers are full: all of them go to hash map
+    more_offers.reset(new flat_map::FlatMap<uint64_t, Offer>());
+    for (const auto& known : offers) {
+      uint64_t key;
+      find_more_offer(known, key);
+      (*more_offers)[key] = known;
+    }
+  }
+
+  uint64_t key;
+  const Offer* known = find_more_offer(offer, key);
+  auto& stored = (*more_offers)[key];
+  if (known == nullptr) {
+    stored = offer;
+  } else {
+    stored.timestamp = std::max(stored.timestamp, offer.timestamp);
+  }
+}
+
+//----------------------------------------------------------------
+// CheapestAndLast find_more_offer()
+// offers of different hash collided: the next hash values are probed. key is the one
+// of offer or the free one
+//----------------------------------------------------------------
+const CheapestAndLast::Offer* CheapestAndLast::find_more_offer(const Offer& offer,
+                                                               uint64_t& key) const {
+  key = ((uint64_t)offer.origin << 32) + offer.destination;
+  key = key * 0x9E3779B97F4A7C15ULL ^
+        (((uint64_t)offer.departure_date << 17) + ((uint64_t)offer.return_date << 1) +
+         offer.direct);
+
+  for (;; ++key) {
+    const Offer* known = more_offers->find(key);
+    if (known == nullptr || is_offer(*known, offer)) {
+      return known;
+    }
+  }
+}
+
+//----------------------------------------------------------------
+// CheapestAndLast get_offer()
+//----------------------------------------------------------------
+CheapestAndLast::Offer CheapestAndLast::get_offer(const i::DealInfo& deal) {
+  return {deal.origin,      deal.destination, deal.departure_date,
+          deal.return_date, deal.direct,      deal.timestamp};
+}
+
+//----------------------------------------------------------------
+// CheapestAndLast is_offer()
+// the same as equal() of deals
+//----------------------------------------------------------------
+bool CheapestAndLast::is_offer(const Offer& known, const Offer& offer) {
+  return known.departure_date == offer.departure_date &&
+         known.return_date == offer.return_date && known.direct == offer.direct &&
+         known.destination == offer.destination && known.origin == offer.origin;
+}
+
 //-------------------------------------------------------------
 }  // utils namespace
 }  // namespace deals
@@ -2,20 +2,99 @@
 #define SRC_DEALS_TYPES_HPP
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <vector>
+#include "flat_map.hpp"
 #include "shared_memory.hpp"
 
 #define DEALS_EXPIRES 60 * 60 * 24
 
 #define DEALS_DB_NAME "Deals"
+// tables names contain version of i::DealInfo and DealData layout,
+// tables of previous version are migrated by DealsDatabase on start
+#define DEALS_LAYOUT_VERSION 2
+#define DEALS_LEGACY_INFO_TABLENAME "DealsInfo"
+#define DEALS_LEGACY_DATA_TABLENAME "DealsData"
+#define DEALS_LEGACY_INFO_PAGES 5000
+#define DEALS_LEGACY_INFO_ELEMENTS 10000
+#define DEALS_LEGACY_DATA_PAGES 10000
+#define DEALS_LEGACY_DATA_ELEMENTS 50000000
 
-#define DEALINFO_TABLENAME "DealsInfo"
+// deals are partitioned by origin: every shard has own DealsInfo and DealsBest tables
+// named "<table>:<shard>" with own locks and pages, queries scan shard of their origin
+#define DEALS_SHARDS 16
+
+#define DEALINFO_TABLENAME "DealsInfo2"
+// pages of every shard, most deals could have one origin
 #define DEALINFO_PAGES 5000
-#define DEALINFO_ELEMENTS 10000
+// page of 65000 deals (32 bytes each) with page header and column alignment
+// fits 2 MiB: one huge page, less than 1% of it is not used
+#define DEALINFO_ELEMENTS 65000
+// ROWS or COLUMNS, compare them with "deals-server bench"
+#define DEALINFO_LAYOUT shared_mem::PageLayout::ROWS
 
-#define DEALDATA_TABLENAME "DealsData"
+#define DEALDATA_TABLENAME "DealsData2"
 #define DEALDATA_PAGES 10000
 #define DEALDATA_ELEMENTS 50000000
+// best deals of offers (DealsOffers), queries of cheapest deals scan them instead of
+// all deals. one deal per offer at most, so much less pages than DealsInfo
+#define DEALBEST_TABLENAME "DealsBest2"
+#define DEALBEST_PAGES 1000
+
+// every table keeps its pages in own shared memory arena
+#define DEALS_STORAGE shared_mem::PageStorage::ARENA
+
+// deals with the same route, dates and direct flag are one offer updated in place,
+// offers are found by shared memory hash (DealsOffers) split to stripes with own lock
+#define DEALOFFERS_NAME "DealsOffers2"
+#define DEALOFFERS_STRIPES 16
+#define DEALOFFERS_STRIPE_SLOTS (128 * 1024)
+#define DEALOFFERS_MAX_PROBES 32
+#define DEALOFFERS_HISTORY 4
+// slot of offer not updated for so long after its deals expired is given to another offer
+#define DEALOFFERS_REUSE_DELAY_SEC 60
+// i::DealInfo::page_id of offer deal, its i::DealInfo::index is offer slot
+#define DEALOFFERS_PAGE_ID UINT16_MAX
+
+// positions of appended deals by origin and destination (DealsPostings),
+// queries of a few destinations read them instead of scanning the shard
+#define DEALPOSTINGS_NAME "DealsPostings2"
+#define DEALPOSTINGS_STRIPES 16
+#define DEALPOSTINGS_STRIPE_ROUTES (16 * 1024)
+#define DEALPOSTINGS_STRIPE_BLOCKS (32 * 1024)
+#define DEALPOSTINGS_BLOCK_SIZE 32
+#define DEALPOSTINGS_MAX_PROBES 32
+// query with more destinations scans the shard
+#define DEALPOSTINGS_MAX_DESTINATIONS 16
+// block released from route (or removed route slot) is given to another route after that
+#define DEALPOSTINGS_REUSE_DELAY_SEC 60
+// routes of stripe are checked once per interval: blocks with postings of released
+// pages only are released, route without other blocks is removed
+#define DEALPOSTINGS_CHECK_INTERVAL_SEC 60
+// origin of removed route slot
+#define DEALPOSTINGS_REMOVED_ROUTE UINT32_MAX
+
+// large scans could be shared with idle sibling processes (DealsScanQueue, opt-in):
+// partitions of query groups are queued to shared memory, siblings group them between poll ticks
+#define DEALSCAN_NAME "DealsScan2"
+#define DEALSCAN_TASKS 16
+// groups of scan are split to a partition per that many elements, to DEALSCAN_MAX_PARTS at most
+#define DEALSCAN_PART_ELEMENTS (2 * MEMPAGE_SCAN_PART_ELEMENTS)
+#define DEALSCAN_MAX_PARTS 8
+// result deals of groups of partition sent back, query with larger result limit is not shared
+#define DEALSCAN_TASK_GROUPS 1024
+// query with more destinations is not shared
+#define DEALSCAN_MAX_DESTINATIONS 256
+// owner scans part itself if sibling took it but didn't finish in time
+#define DEALSCAN_WAIT_MS 1000
+// poll timeout of sharing processes, so idle ones look at the queue often enough
+#define DEALSCAN_POLL_MS 5
+
+// offers of one group kept inline by query aggregates (utils::CheapestAndLast),
+// group with more offers keeps them in a hash map
+#define DEALS_GROUP_OFFERS 4
 
 namespace deals {
 namespace i {
@@ -23,23 +102,47 @@ struct DealInfo {
   uint32_t timestamp;
   uint32_t origin;
   uint32_t destination;
-  uint32_t departure_date;
-  uint32_t return_date;
   uint32_t price;
+  uint32_t index;           // data position in DealsData page
+  uint16_t departure_date;  // days since 1970-01-01 (types::date_to_days)
+  uint16_t return_date;     // days since 1970-01-01, 0 for one-way deal
+  uint16_t page_id;         // DealsData page
   uint8_t stay_days;
   uint8_t destination_country;
   uint8_t departure_day_of_week;
   uint8_t return_day_of_week;
   bool direct;
   bool overriden;  // show that not cheapest but lastest in period
-  char page_name[MEMPAGE_NAME_MAX_LEN];
-  uint32_t index;
-  uint32_t size;
 };
+static_assert(sizeof(DealInfo) == 32, "DealInfo is stored in shared memory, check layout version");
+static_assert(DEALINFO_ELEMENTS * sizeof(DealInfo) + 4096 <= MEMPAGE_HUGE_PAGE_SIZE,
+              "DealsInfo page should fit one huge page");
 
+// deal data in DealsData page: [uint32_t size][size bytes]
 using DealData = uint8_t;  // aka char
 using sharedDealData = shared_mem::ElementExtractor<i::DealData>;
 
+// DealInfo fields summarized per index page (shared_mem::PageSummary)
+enum SummaryField : uint8_t { DEPARTURE_DATE = 0, RETURN_DATE, PRICE, TIMESTAMP };
+
+// DealInfo columns in PageLayout::COLUMNS pages (shared_mem::PageColumns)
+enum Column : uint16_t {
+  COL_TIMESTAMP = 0,
+  COL_ORIGIN,
+  COL_DESTINATION,
+  COL_DEPARTURE_DATE,
+  COL_RETURN_DATE,
+  COL_PRICE,
+  COL_STAY_DAYS,
+  COL_DESTINATION_COUNTRY,
+  COL_DEPARTURE_DAY_OF_WEEK,
+  COL_RETURN_DAY_OF_WEEK,
+  COL_INDEX,
+  COL_PAGE_ID,
+  COL_DIRECT,
+  COL_OVERRIDEN,
+  COLUMNS_COUNT
+};
 }  // namespace deals::i
 
 struct DealInfoTest {
@@ -57,6 +160,44 @@ struct DealInfoTest {
   bool overriden;                 // this data need only for testing
 };
 
+//------------------------------------------------------------
+// DealsShard
+//------------------------------------------------------------
+// deals of origins with the same getOriginShard()
+struct DealsShard {
+  DealsShard(uint16_t shard, shared_mem::SharedContext& context);
+
+  shared_mem::Table<i::DealInfo> index;
+  shared_mem::Table<i::DealInfo> best;  // filled by DealsOffers
+};
+using DealsShards = std::vector<std::unique_ptr<DealsShard>>;
+// tables scanned together by routines of all deals
+using DealsTables = std::vector<shared_mem::Table<i::DealInfo>*>;
+
+uint16_t getOriginShard(uint32_t origin);
+
+//------------------------------------------------------------
+// DealsJob
+//------------------------------------------------------------
+// request to DealsDatabase run by time slices: the server answers other requests
+// between resume() calls, so a long scan doesn't hold them
+template <typename RESULT_T>
+class DealsJob {
+ public:
+  virtual ~DealsJob() {
+  }
+  // run until deadline (timing::getTimestampMs()), true when result is ready
+  virtual bool resume(int64_t deadline_ms) = 0;
+  // run to the end
+  RESULT_T& run() {
+    while (!resume(INT64_MAX)) {
+    }
+    return result;
+  }
+
+  RESULT_T result;
+};
+
 class DealInfo {
  public:
   DealInfo(std::string _data, std::shared_ptr<DealInfoTest> _testing)
@@ -73,7 +214,93 @@ void print(const i::DealInfo& deal);
 void print(const DealInfo& deal);
 std::string sprint(const DealInfo& deal);
 bool equal(const i::DealInfo& d1, const i::DealInfo& d2);
+// history of deals taken by a group, replaced by CheapestAndLast (kept for tests)
 const i::DealInfo findCheapestAndLast(const std::vector<i::DealInfo>& history);
+
+//------------------------------------------------------------
+// CheapestAndLast
+//------------------------------------------------------------
+// findCheapestAndLast() of query group history, updated deal by deal without the history.
+// group takes a deal which is not more expensive than the last taken one or is a newer
+// deal of the same offer (utils::equal). result is the last taken deal which is not
+// outdated by a newer one of its offer taken before it, the first taken deal and the one
+// just before it are not compared (as the history walk does). so the group keeps the
+// newest timestamp of every offer it took deals of, not the deals: it never holds more
+// entries than distinct offers of the group, nor than the history had deals. offers are
+// kept inline up to DEALS_GROUP_OFFERS, only a group which took more of them allocates
+class CheapestAndLast {
+ public:
+  void add(const i::DealInfo& deal);
+  bool empty() const {
+    return taken == 0;
+  }
+  // the same deal findCheapestAndLast() gives for group history
+  const i::DealInfo& get() const {
+    return result;
+  }
+
+ private:
+  struct Offer {
+    uint32_t origin;
+    uint32_t destination;
+    uint16_t departure_date;
+    uint16_t return_date;
+    bool direct;
+    uint32_t timestamp;  // newest of taken deals of offer
+  };
+
+  // taken deal has older timestamp than its offer, the last taken deal is not compared
+  bool is_outdated(const i::DealInfo& deal) const;
+  // keep timestamp of taken deal if it is the newest of its offer
+  void update_offer(const i::DealInfo& deal);
+  const Offer* find_more_offer(const Offer& offer, uint64_t& key) const;
+  static Offer get_offer(const i::DealInfo& deal);
+  static bool is_offer(const Offer& known, const Offer& offer);
+
+  i::DealInfo last{};  // last taken deal
+  i::DealInfo result{};
+  uint32_t taken = 0;
+  Offer offers[DEALS_GROUP_OFFERS];
+  uint8_t size = 0;
+  // all offers when there are more than DEALS_GROUP_OFFERS, by offer hash
+  std::unique_ptr<flat_map::FlatMap<uint64_t, Offer>> more_offers;
+};
 }  // namespace deals::utils
 }  // namespace deals
+
+namespace shared_mem {
+template <>
+struct PageSummaryTraits<deals::i::DealInfo> {
+  static const bool enabled = true;
+  static void get_values(const deals::i::DealInfo& deal,
+                         uint32_t (&values)[MEMPAGE_SUMMARY_FIELDS]) {
+    values[deals::i::DEPARTURE_DATE] = deal.departure_date;
+    values[deals::i::RETURN_DATE] = deal.return_date;
+    values[deals::i::PRICE] = deal.price;
+    values[deals::i::TIMESTAMP] = deal.timestamp;
+  }
+};
+
+#define DEALINFO_COLUMN(field) \
+  { offsetof(deals::i::DealInfo, field), sizeof(deals::i::DealInfo::field) }
+
+template <>
+struct PageColumnsTraits<deals::i::DealInfo> {
+  static const uint16_t count = deals::i::COLUMNS_COUNT;
+  static const PageColumn* get_columns() {
+    // order must match deals::i::Column
+    static const PageColumn columns[] = {
+        DEALINFO_COLUMN(timestamp),      DEALINFO_COLUMN(origin),
+        DEALINFO_COLUMN(destination),    DEALINFO_COLUMN(departure_date),
+        DEALINFO_COLUMN(return_date),    DEALINFO_COLUMN(price),
+        DEALINFO_COLUMN(stay_days),      DEALINFO_COLUMN(destination_country),
+        DEALINFO_COLUMN(departure_day_of_week), DEALINFO_COLUMN(return_day_of_week),
+        DEALINFO_COLUMN(index),          DEALINFO_COLUMN(page_id),
+        DEALINFO_COLUMN(direct),         DEALINFO_COLUMN(overriden)};
+    static_assert(sizeof(columns) / sizeof(columns[0]) == count, "DEALINFO COLUMNS");
+    return columns;
+  }
+};
+#undef DEALINFO_COLUMN
+}  // namespace shared_mem
 #endif
\ No newline at end of file
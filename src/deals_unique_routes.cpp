@@ -1,13 +1,32 @@
 #include "deals_unique_routes.hpp"
+#include "timing.hpp"
 
 namespace deals {
 //------------------------------------------------------------
 // UniqueRoutes
 //------------------------------------------------------------
-const std::string getUniqueRoutesRoutine(shared_mem::Table<i::DealInfo>& table) {
-  UniqueProcessor up;
-  table.processRecords(up);
-  return up.getStringResults();
+const std::string getUniqueRoutesRoutine(const DealsTables& tables) {
+  return UniqueRoutesScan{tables}.run();
+}
+
+bool UniqueRoutesScan::resume(int64_t deadline_ms) {
+  while (next_table < tables.size()) {
+    if (scan == nullptr) {
+      scan.reset(new shared_mem::TableScan<i::DealInfo>(*tables[next_table], processor));
+    }
+    if (!scan->resume(deadline_ms)) {
+      return false;
+    }
+    scan.reset();
+    ++next_table;
+
+    if (next_table < tables.size() && timing::getTimestampMs() >= deadline_ms) {
+      return false;
+    }
+  }
+
+  result = processor.getStringResults();
+  return true;
 }
 
 void UniqueProcessor::process_element(const i::DealInfo& deal) {
@@ -29,14 +48,67 @@ void UniqueProcessor::process_element(const i::DealInfo& deal) {
   }
 }
 
+void UniqueProcessor::process_columns(const shared_mem::PageColumns<i::DealInfo>& page) {
+  const auto origins = page.get<uint32_t>(i::COL_ORIGIN);
+  const auto destinations = page.get<uint32_t>(i::COL_DESTINATION);
+  const auto prices = page.get<uint32_t>(i::COL_PRICE);
+  const auto timestamps = page.get<uint32_t>(i::COL_TIMESTAMP);
+  const auto departure_dates = page.get<uint16_t>(i::COL_DEPARTURE_DATE);
+  const auto return_dates = page.get<uint16_t>(i::COL_RETURN_DATE);
+  const auto directs = page.get<bool>(i::COL_DIRECT);
+
+  for (uint32_t idx = 0; idx < page.size; ++idx) {
+    uint64_t route = ((uint64_t)origins[idx] << 32) + destinations[idx];
+    auto& dst_deal = grouped_by_routes[route];
+
+    if (dst_deal.price == 0 || dst_deal.price >= prices[idx]) {
+      if (dst_deal.price == prices[idx] && dst_deal.timestamp > timestamps[idx]) {
+        continue;
+      }
+      page.get_element(idx, dst_deal);
+    } else if (departure_dates[idx] == dst_deal.departure_date &&
+               return_dates[idx] == dst_deal.return_date && directs[idx] == dst_deal.direct &&
+               dst_deal.timestamp < timestamps[idx]) {
+      page.get_element(idx, dst_deal);
+      dst_deal.overriden = true;
+    }
+  }
+}
+
+std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>> UniqueProcessor::split() const {
+  std::unique_ptr<UniqueProcessor> part(new UniqueProcessor());
+  part->grouped_by_routes.set_partitions(grouped_by_routes.partitions());
+  return std::move(part);
+}
+
+// route deals of part are later deals of routes
+void UniqueProcessor::merge(shared_mem::TableProcessor<i::DealInfo>& part) {
+  static_cast<UniqueProcessor&>(part).grouped_by_routes.for_each(
+      [this](uint64_t, const i::DealInfo& deal) { process_element(deal); });
+}
+
+bool UniqueProcessor::partition(uint32_t partitions) {
+  grouped_by_routes.set_partitions(partitions);
+  return true;
+}
+
+// routes of partition are in the same partition of every part and of the processor
+void UniqueProcessor::merge_partition(
+    const std::vector<std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>>>& parts,
+    uint32_t partition) {
+  for (size_t part = 1; part < parts.size(); ++part) {
+    static_cast<UniqueProcessor&>(*parts[part]).grouped_by_routes.for_each(
+        partition, [this](uint64_t, const i::DealInfo& deal) { process_element(deal); });
+  }
+}
+
 const std::string UniqueProcessor::getStringResults() {
   std::string res;
 
-  for (const auto& elm : grouped_by_routes) {
-    res += types::code_to_origin(elm.second.origin) + "," +
-           types::code_to_origin(elm.second.destination) + "," + std::to_string(elm.second.price) +
-           "\n";
-  }
+  grouped_by_routes.for_each([&res](uint64_t, const i::DealInfo& deal) {
+    res += types::code_to_origin(deal.origin) + "," + types::code_to_origin(deal.destination) +
+           "," + std::to_string(deal.price) + "\n";
+  });
   std::cout << "Total unique routes:" << grouped_by_routes.size() << std::endl;
 
   return res;
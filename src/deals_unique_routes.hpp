@@ -2,15 +2,14 @@
 #define SRC_DEALS_UNIQUE_ROUTES_HPP
 
 #include "deals_types.hpp"
+#include "flat_map.hpp"
 #include "shared_memory.hpp"
 
-#include <unordered_map>
-
 namespace deals {
 //------------------------------------------------------------
 // UniqueRoutes
 //------------------------------------------------------------
-const std::string getUniqueRoutesRoutine(shared_mem::Table<i::DealInfo>& table);
+const std::string getUniqueRoutesRoutine(const DealsTables& tables);
 
 //------------------------------------------------------------
 //
@@ -22,7 +21,39 @@ class UniqueProcessor : public shared_mem::TableProcessor<i::DealInfo> {
  protected:
   // function that will be called for iterating over all not expired pages in table
   void process_element(const i::DealInfo& element) final override;
-  std::unordered_map<uint64_t, i::DealInfo> grouped_by_routes;
+  // same as process_element() but whole deal is read only when it replaces route's deal
+  void process_columns(const shared_mem::PageColumns<i::DealInfo>& page) final override;
+  // pages are scanned by parts in scan threads
+  bool splittable() const final override {
+    return true;
+  }
+  std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>> split() const final override;
+  void merge(shared_mem::TableProcessor<i::DealInfo>& part) final override;
+  // routes of parts are merged by partitions of routes in scan threads
+  bool partition(uint32_t partitions) final override;
+  void merge_partition(
+      const std::vector<std::unique_ptr<shared_mem::TableProcessor<i::DealInfo>>>& parts,
+      uint32_t partition) final override;
+  using Routes = flat_map::PartitionedMap<uint64_t, i::DealInfo>;
+  flat_map::ThreadMap<UniqueProcessor, Routes> routes;
+  Routes& grouped_by_routes = routes.get();
+};
+
+//------------------------------------------------------------
+// UniqueRoutesScan
+//------------------------------------------------------------
+// getUniqueRoutesRoutine() by time slices, tables are scanned one by one
+class UniqueRoutesScan : public DealsJob<std::string> {
+ public:
+  UniqueRoutesScan(const DealsTables& tables) : tables(tables) {
+  }
+  bool resume(int64_t deadline_ms) final override;
+
+ private:
+  const DealsTables tables;
+  size_t next_table = 0;
+  UniqueProcessor processor;
+  std::unique_ptr<shared_mem::TableScan<i::DealInfo>> scan;  // of next_table
 };
 
 }  // namespace deals
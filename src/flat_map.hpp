@@ -0,0 +1,337 @@
+#ifndef SRC_FLAT_MAP_HPP
+#define SRC_FLAT_MAP_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace flat_map {
+//------------------------------------------------------------
+// FlatMap
+//------------------------------------------------------------
+// hash map of integer keys for grouping by queries: slots are one array searched
+// by linear probing, no allocation per key. clear() only starts a new generation
+// of slots, so memory grown by previous queries is kept for the next ones
+template <typename KEY_T, typename VALUE_T>
+class FlatMap {
+ public:
+  FlatMap();
+  // value initialized by VALUE_T() if key is new
+  VALUE_T& operator[](KEY_T key);
+  const VALUE_T* find(KEY_T key) const;
+  // func(key, value) for every key, order is not defined
+  template <typename FUNC>
+  void for_each(FUNC func) const;
+  template <typename FUNC>
+  void for_each(FUNC func);
+  // room for count keys without growing
+  void reserve(uint32_t count);
+  void clear();
+  uint32_t size() const;
+
+ private:
+  struct Slot {
+    KEY_T key;
+    uint32_t generation;  // slot is used if it equals map generation
+    VALUE_T value;
+  };
+
+  uint32_t slot_of(KEY_T key) const;
+  void grow(uint32_t capacity);
+
+  std::vector<Slot> slots;  // power of 2, at most half used
+  uint32_t mask = 0;
+  uint32_t count = 0;
+  uint32_t generation = 1;
+};
+
+//------------------------------------------------------------
+// PartitionedMap
+//------------------------------------------------------------
+// partition of key: high bits of the hash FlatMap slots take low bits of,
+// so keys of one partition are spread over slots of its map
+inline uint32_t partition_of(uint64_t key, uint32_t partitions) {
+  return ((((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32) * partitions) >> 32;
+}
+
+// FlatMap of every partition of keys. threads could fill different partitions
+// at once, each of them only with keys of its own partition (partition_of())
+template <typename KEY_T, typename VALUE_T>
+class PartitionedMap {
+ public:
+  PartitionedMap() : maps(1) {
+  }
+  VALUE_T& operator[](KEY_T key) {
+    return maps[partition(key)][key];
+  }
+  const VALUE_T* find(KEY_T key) const {
+    return maps[partition(key)].find(key);
+  }
+  // func(key, value) for every key of all partitions or one of them, order is not defined
+  template <typename FUNC>
+  void for_each(FUNC func) const;
+  template <typename FUNC>
+  void for_each(uint32_t partition, FUNC func) const {
+    maps[partition].for_each(func);
+  }
+  // keys are moved to partitions of new count
+  void set_partitions(uint32_t count);
+  uint32_t partitions() const {
+    return count;
+  }
+  uint32_t partition(KEY_T key) const {
+    return count == 1 ? 0 : partition_of(key, count);
+  }
+  // one partition again, memory of all of them is kept
+  void clear();
+  uint32_t size() const;
+
+ private:
+  std::vector<FlatMap<KEY_T, VALUE_T>> maps;  // partitions in use are the first count
+  uint32_t count = 1;
+};
+
+//------------------------------------------------------------
+// ThreadMap
+//------------------------------------------------------------
+// FlatMap of the calling thread for processors of TAG type, cleared for every processor
+// and given back by its destructor. processor made while another TAG processor of the
+// thread holds the map (scan suspended between time slices) gets own map
+template <typename TAG, typename MAP_T>
+class ThreadMap {
+ public:
+  ThreadMap();
+  ~ThreadMap();
+  ThreadMap(const ThreadMap&) = delete;
+  ThreadMap& operator=(const ThreadMap&) = delete;
+
+  MAP_T& get() {
+    return *map;
+  }
+
+ private:
+  struct Cached {
+    MAP_T map;
+    bool taken = false;
+  };
+  static Cached& thread_cached();
+
+  Cached* cached = nullptr;  // map of thread is taken
+  std::unique_ptr<MAP_T> own_map;
+  MAP_T* map;
+};
+
+//                             IMPLEMENTATIONS:
+// constructor --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+FlatMap<KEY_T, VALUE_T>::FlatMap() {
+  grow(16);
+}
+
+// operator[] --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+VALUE_T& FlatMap<KEY_T, VALUE_T>::operator[](KEY_T key) {
+  if ((count + 1) * 2 > slots.size()) {
+    grow(slots.size() * 2);
+  }
+
+  uint32_t pos = slot_of(key);
+  while (slots[pos].generation == generation) {
+    if (slots[pos].key == key) {
+      return slots[pos].value;
+    }
+    pos = (pos + 1) & mask;
+  }
+
+  auto& slot = slots[pos];
+  slot.key = key;
+  slot.generation = generation;
+  slot.value = VALUE_T();
+  ++count;
+  return slot.value;
+}
+
+// find() --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+const VALUE_T* FlatMap<KEY_T, VALUE_T>::find(KEY_T key) const {
+  uint32_t pos = slot_of(key);
+  while (slots[pos].generation == generation) {
+    if (slots[pos].key == key) {
+      return &slots[pos].value;
+    }
+    pos = (pos + 1) & mask;
+  }
+  return nullptr;
+}
+
+// for_each() --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+template <typename FUNC>
+void FlatMap<KEY_T, VALUE_T>::for_each(FUNC func) const {
+  for (const auto& slot : slots) {
+    if (slot.generation == generation) {
+      func(slot.key, slot.value);
+    }
+  }
+}
+
+template <typename KEY_T, typename VALUE_T>
+template <typename FUNC>
+void FlatMap<KEY_T, VALUE_T>::for_each(FUNC func) {
+  for (auto& slot : slots) {
+    if (slot.generation == generation) {
+      func(slot.key, slot.value);
+    }
+  }
+}
+
+// reserve() --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+void FlatMap<KEY_T, VALUE_T>::reserve(uint32_t count) {
+  uint32_t capacity = slots.size();
+  while (capacity < count * 2) {
+    capacity *= 2;
+  }
+  if (capacity > slots.size()) {
+    grow(capacity);
+  }
+}
+
+// clear() --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+void FlatMap<KEY_T, VALUE_T>::clear() {
+  count = 0;
+  if (++generation == 0) {
+    // generations wrapped around: slots of old ones could look used
+    for (auto& slot : slots) {
+      slot.generation = 0;
+    }
+    generation = 1;
+  }
+}
+
+// size() --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+uint32_t FlatMap<KEY_T, VALUE_T>::size() const {
+  return count;
+}
+
+// slot_of() --------------------------------------------------
+// high bits of multiplicative hash, keys are often close codes and days
+template <typename KEY_T, typename VALUE_T>
+uint32_t FlatMap<KEY_T, VALUE_T>::slot_of(KEY_T key) const {
+  return (((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+// grow() --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+void FlatMap<KEY_T, VALUE_T>::grow(uint32_t capacity) {
+  std::vector<Slot> used;
+  used.swap(slots);
+  slots.resize(capacity);  // generation 0: not used
+  mask = capacity - 1;
+
+  for (auto& slot : used) {
+    if (slot.generation != generation) {
+      continue;
+    }
+    uint32_t pos = slot_of(slot.key);
+    while (slots[pos].generation == generation) {
+      pos = (pos + 1) & mask;
+    }
+    slots[pos] = std::move(slot);
+  }
+}
+
+// PartitionedMap for_each() --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+template <typename FUNC>
+void PartitionedMap<KEY_T, VALUE_T>::for_each(FUNC func) const {
+  for (uint32_t partition = 0; partition < count; ++partition) {
+    maps[partition].for_each(func);
+  }
+}
+
+// PartitionedMap set_partitions() --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+void PartitionedMap<KEY_T, VALUE_T>::set_partitions(uint32_t partitions) {
+  partitions = std::max(partitions, 1u);
+  if (partitions == count) {
+    return;
+  }
+  if (maps.size() < partitions) {
+    maps.resize(partitions);
+  }
+  if (size() == 0) {
+    count = partitions;
+    return;
+  }
+
+  // keys are moved through maps of new partitions
+  std::vector<FlatMap<KEY_T, VALUE_T>> moved(partitions);
+  for (uint32_t partition = 0; partition < count; ++partition) {
+    maps[partition].for_each([&](KEY_T key, VALUE_T& value) {
+      moved[partition_of(key, partitions)][key] = std::move(value);
+    });
+    maps[partition].clear();
+  }
+  for (uint32_t partition = 0; partition < partitions; ++partition) {
+    std::swap(maps[partition], moved[partition]);
+  }
+  count = partitions;
+}
+
+// PartitionedMap clear() --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+void PartitionedMap<KEY_T, VALUE_T>::clear() {
+  for (auto& map : maps) {
+    map.clear();
+  }
+  count = 1;
+}
+
+// PartitionedMap size() --------------------------------------------------
+template <typename KEY_T, typename VALUE_T>
+uint32_t PartitionedMap<KEY_T, VALUE_T>::size() const {
+  uint32_t keys = 0;
+  for (uint32_t partition = 0; partition < count; ++partition) {
+    keys += maps[partition].size();
+  }
+  return keys;
+}
+
+// ThreadMap constructor --------------------------------------------------
+template <typename TAG, typename MAP_T>
+ThreadMap<TAG, MAP_T>::ThreadMap() {
+  auto& thread = thread_cached();
+  if (thread.taken) {
+    own_map.reset(new MAP_T());
+    map = own_map.get();
+    return;
+  }
+  thread.taken = true;
+  cached = &thread;
+  map = &thread.map;
+  map->clear();
+}
+
+// ThreadMap destructor --------------------------------------------------
+// could run in another thread (processors of scan parts), threads of parts are idle then
+template <typename TAG, typename MAP_T>
+ThreadMap<TAG, MAP_T>::~ThreadMap() {
+  if (cached != nullptr) {
+    cached->taken = false;
+  }
+}
+
+// thread_cached() --------------------------------------------------
+template <typename TAG, typename MAP_T>
+typename ThreadMap<TAG, MAP_T>::Cached& ThreadMap<TAG, MAP_T>::thread_cached() {
+  static thread_local Cached cached;
+  return cached;
+}
+}  // namespace flat_map
+
+#endif
@@ -98,6 +98,17 @@ void CriticalSection::enter() {
   unlock_needed = true;
 }
 
+//-----------------------------------------------
+// CriticalSection try_enter()
+//-----------------------------------------------
+bool CriticalSection::try_enter() {
+  if (sem_trywait(lock) == -1) {
+    return false;
+  }
+  unlock_needed = true;
+  return true;
+}
+
 //-----------------------------------------------
 // CriticalSection exit()
 //-----------------------------------------------
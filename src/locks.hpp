@@ -18,6 +18,8 @@ class CriticalSection {
   ~CriticalSection();
 
   void enter();
+  // enter only if nobody is inside, don't wait
+  bool try_enter();
   void exit();
   bool is_locked();
   void reset_not_for_production();
@@ -1,6 +1,28 @@
 #include "search_query.hpp"
 
 namespace query {
+//--------------------------------------------------
+// IATACodesSet
+//--------------------------------------------------
+void IATACodesSet::insert(uint32_t code) {
+  if (contains(code)) {
+    return;
+  }
+  codes.push_back(code);
+
+  const uint32_t idx = dense_index(code);
+  if (idx < IATA_DENSE_CODES) {
+    bits[idx / 64] |= 1ULL << (idx % 64);
+  } else {
+    other_codes.push_back(code);
+  }
+}
+
+void IATACodesSet::clear() {
+  bits.fill(0);
+  codes.clear();
+  other_codes.clear();
+}
 
 //--------------------------------------------------
 void SearchQuery::origin(const types::IATACode& origin) {
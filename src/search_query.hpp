@@ -1,7 +1,9 @@
 #ifndef SRC_SEARCH_QUERY_HPP
 #define SRC_SEARCH_QUERY_HPP
 
-#include <unordered_set>
+#include <algorithm>
+#include <array>
+#include <vector>
 #include "shared_memory.hpp"
 #include "types.hpp"
 #include "utils.hpp"
@@ -19,6 +21,77 @@ struct StayInterval {
   uint8_t to;
 };
 
+// three latin letters codes
+#define IATA_DENSE_CODES (26 * 26 * 26)
+
+//------------------------------------------------------------
+// IATACodesSet
+//------------------------------------------------------------
+// codes of three latin letters are bits of dense bitset, other codes
+// (IATACode accepts any three chars) are looked up in a short list
+class IATACodesSet {
+ public:
+  void insert(uint32_t code);
+  void clear();
+  bool contains(uint32_t code) const {
+    const uint32_t idx = dense_index(code);
+    if (idx < IATA_DENSE_CODES) {
+      return (bits[idx / 64] >> (idx % 64)) & 1;
+    }
+    return std::find(other_codes.begin(), other_codes.end(), code) != other_codes.end();
+  }
+  size_t size() const {
+    return codes.size();
+  }
+  const std::vector<uint32_t>& get_codes() const {
+    return codes;
+  }
+
+ private:
+  // IATA_DENSE_CODES or more for codes not of latin letters
+  static uint32_t dense_index(uint32_t code) {
+    types::PlaceCodec codec;
+    codec.int_code = code;
+    const uint32_t first = (uint8_t)codec.iata_code[1] - 'A';
+    const uint32_t second = (uint8_t)codec.iata_code[2] - 'A';
+    const uint32_t third = (uint8_t)codec.iata_code[3] - 'A';
+    if ((first | second | third) >= 26) {
+      return IATA_DENSE_CODES;
+    }
+    return (first * 26 + second) * 26 + third;
+  }
+
+  std::array<uint64_t, (IATA_DENSE_CODES + 63) / 64> bits{};
+  std::vector<uint32_t> codes;
+  std::vector<uint32_t> other_codes;
+};
+
+//------------------------------------------------------------
+// CountryCodesSet
+//------------------------------------------------------------
+class CountryCodesSet {
+ public:
+  void insert(uint8_t code) {
+    mask[code / 64] |= 1ULL << (code % 64);
+  }
+  void clear() {
+    mask.fill(0);
+  }
+  bool contains(uint8_t code) const {
+    return (mask[code / 64] >> (code % 64)) & 1;
+  }
+  size_t size() const {
+    size_t count = 0;
+    for (const auto word : mask) {
+      count += __builtin_popcountll(word);
+    }
+    return count;
+  }
+
+ private:
+  std::array<uint64_t, 4> mask{};
+};
+
 class SearchQuery {
  public:
   void origin(const types::IATACode& origin);
@@ -52,10 +125,10 @@ class SearchQuery {
   uint32_t origin_value;
 
   bool filter_destination = false;
-  std::unordered_set<uint32_t> destination_values_set;
+  IATACodesSet destination_values_set;
 
   bool filter_destination_country = false;
-  std::unordered_set<uint8_t> destination_country_set;
+  CountryCodesSet destination_country_set;
 
   bool filter_departure_date = false;
   DateInterval departure_date_values;
@@ -92,6 +165,20 @@ class SearchQuery {
   bool filter_all_combinations = false;
 };
 
+//------------------------------------------------------------
+// sort_limited
+//------------------------------------------------------------
+// result is cut to limit elements anyway, so only they are sorted
+// (heap selection), results of a few groups are just sorted
+template <typename T, typename COMPARE>
+void sort_limited(std::vector<T>& result, uint32_t limit, COMPARE compare) {
+  if (result.size() <= limit) {
+    std::sort(result.begin(), result.end(), compare);
+    return;
+  }
+  std::partial_sort(result.begin(), result.begin() + limit, result.end(), compare);
+  result.resize(limit);
+}
 }  // namespace query
 
 #endif
\ No newline at end of file
@@ -1,38 +1,67 @@
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <mutex>
 
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <unistd.h>
 
 #include "shared_memory.hpp"
 #include "statsd_client.hpp"
 #include "timing.hpp"
 
 namespace shared_mem {
+//-----------------------------------------------------------
+// free memory of filesystem in percents
+// hugetlbfs without size limit shows no blocks, huge pages pool is checked then
+//-----------------------------------------------------------
+static uint32_t getFreeMemPercent(const std::string& path) {
+  struct statvfs res;
+  if (statvfs(path.c_str(), &res) == 0 && res.f_blocks > 0) {
+    return 100 * res.f_bavail / res.f_blocks;
+  }
+
+  uint64_t total = 0, free = 0;
+  std::ifstream meminfo("/proc/meminfo");
+  std::string key;
+  uint64_t value;
+  while (meminfo >> key >> value) {
+    if (key == "HugePages_Total:") {
+      total = value;
+    } else if (key == "HugePages_Free:") {
+      free = value;
+    }
+    meminfo.ignore(256, '\n');
+  }
+  return total ? 100 * free / total : 0;
+}
+
 //-----------------------------------------------------------
 // Check that system has free shared memory
 //-----------------------------------------------------------
-bool isMemAvailable() {
+bool isMemAvailable(const std::string& path) {
 #ifdef __APPLE__  // doesnt work on apple
   return true;
 #endif
-  static struct statvfs res;
-  statvfs("/dev/shm/", &res);
-  uint32_t freemem = 100 * res.f_bavail / res.f_blocks;
+  uint32_t freemem = getFreeMemPercent(path);
 
   if (freemem <= LOWMEM_ERROR_PERCENT) {
-    std::cerr << "ERROR VERY LOW MEMORY:" << freemem << "%" << std::endl;
+    std::cerr << "ERROR VERY LOW MEMORY:" << freemem << "% " << path << std::endl;
     return false;
   }
   return true;
 }
 
 //-----------------------------------------------------------
-bool isMemLow() {
+bool isMemLow(const std::string& path) {
 #ifdef __APPLE__  // doesnt work on apple
   return false;
 #endif
-  static struct statvfs res;
-  statvfs("/dev/shm/", &res);
-  uint32_t freemem = 100 * res.f_bavail / res.f_blocks;
+  uint32_t freemem = getFreeMemPercent(path);
 
   if (freemem <= LOWMEM_PERCENT_FOR_PAGE_REUSING) {
     return true;
@@ -40,6 +69,47 @@ bool isMemLow() {
   return false;
 }
 
+//-----------------------------------------------------------
+static bool huge_pages_enabled = false;
+
+void setHugePages(bool enabled) {
+  huge_pages_enabled = enabled;
+}
+
+//-----------------------------------------------------------
+static uint32_t scan_threads = std::max(std::thread::hardware_concurrency(), 1u);
+// pool lives until process exits, threads are not joined at exit
+static thread_pool::ThreadPool* scan_pool = nullptr;
+static pid_t scan_pool_pid = 0;
+static std::mutex scan_pool_lock;
+
+void setScanThreads(uint32_t threads) {
+  std::lock_guard<std::mutex> guard(scan_pool_lock);
+  scan_threads = std::max(threads, 1u);
+}
+
+thread_pool::ThreadPool& scanThreads() {
+  std::lock_guard<std::mutex> guard(scan_pool_lock);
+  // threads of pool created before fork() are not in this process, pool is left as is
+  if (scan_pool && scan_pool_pid != getpid()) {
+    scan_pool = nullptr;
+  }
+  if (scan_pool && scan_pool->size() != scan_threads) {
+    delete scan_pool;
+    scan_pool = nullptr;
+  }
+  if (!scan_pool) {
+    scan_pool = new thread_pool::ThreadPool(scan_threads - 1);
+    scan_pool_pid = getpid();
+  }
+  return *scan_pool;
+}
+
+//-----------------------------------------------------------
+bool isProcessAlive(pid_t pid) {
+  return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
 //-----------------------------------------------------------
 void reportMemUsage(const PageType current_record_type, const std::string& insert_page_name) {
   if (current_record_type == PageType::NEW) {
@@ -71,6 +141,177 @@ SharedContext::SharedContext(std::string name)
   std::cout << "SharedContext created: " << name << "SharedContext" << std::endl;
 }
 
+//-----------------------------------------------------------
+// SharedMemoryArena
+//-----------------------------------------------------------
+SharedMemoryArena::SharedMemoryArena(const std::string& name, uint32_t regions_count,
+                                     uint32_t region_data_size)
+    : region_size(0), huge_pages(false), name(name), size(0), fd(-1), memory(nullptr) {
+  const std::string huge_path = MEMPAGE_HUGEPAGES_PATH + name;
+
+  // processes must agree where arena is, so only the first one chooses
+  locks::CriticalSection cslock(name);
+  cslock.enter();
+  locks::AutoCloser guard(cslock);
+
+  bool opened = false;
+  if (access(huge_path.c_str(), F_OK) == 0) {
+    if (!open(huge_path, true, regions_count, region_data_size)) {
+      throw types::Error("CANNOT_OPEN_SHMEM_ARENA\n", types::ErrorCode::InternalError);
+    }
+    opened = true;
+  } else if (huge_pages_enabled && !SharedMemoryPage<uint8_t>::exists(name)) {
+    opened = open(huge_path, true, regions_count, region_data_size);
+    if (!opened) {
+      std::cerr << "ERROR SharedMemoryArena no huge pages for " << name << ", using /dev/shm"
+                << std::endl;
+      ::unlink(huge_path.c_str());
+    }
+  }
+
+  if (!opened && !open(name, false, regions_count, region_data_size)) {
+    throw types::Error("CANNOT_OPEN_SHMEM_ARENA\n", types::ErrorCode::InternalError);
+  }
+  std::cout << "OPENED ARENA:" << path << " size:" << size << " region:" << region_size
+            << std::endl;
+}
+
+//-----------------------------------------------------------
+// open | file in huge pages mount or /dev/shm object
+//-----------------------------------------------------------
+bool SharedMemoryArena::open(const std::string& arena_path, bool huge, uint32_t regions_count,
+                             uint32_t region_data_size) {
+  fd = huge ? ::open(arena_path.c_str(), O_RDWR | O_CREAT, (mode_t)0666)
+            : shm_open(arena_path.c_str(), O_RDWR | O_CREAT, (mode_t)0666);
+  if (fd == -1) {
+    std::cerr << "ERROR SharedMemoryArena Cannot create or open:" << arena_path
+              << " errno:" << errno << std::endl;
+    return false;
+  }
+
+  path = huge ? arena_path : "/dev/shm/" + arena_path;
+  huge_pages = huge;
+
+  // regions must be whole memory pages to be released separately
+  uint64_t memory_page_size = sysconf(_SC_PAGE_SIZE);
+  if (huge) {
+    struct statvfs res;
+    fstatvfs(fd, &res);
+    memory_page_size = std::max((uint64_t)res.f_bsize, (uint64_t)MEMPAGE_HUGE_PAGE_SIZE);
+  }
+  region_size = (region_data_size + memory_page_size - 1) / memory_page_size * memory_page_size;
+  size = (uint64_t)regions_count * region_size;
+
+  // new arena has zero size, file is sparse: memory is not taken until pages are written
+  struct stat buf;
+  fstat(fd, &buf);
+  if (buf.st_size == 0) {
+    if ((huge && !is_memory_available()) || ftruncate(fd, size) == -1) {
+      std::cerr << "ERROR SharedMemoryArena cant truncate:" << errno << " " << path << std::endl;
+      close(fd);
+      return false;
+    }
+    fstat(fd, &buf);
+  }
+
+  if ((uint64_t)buf.st_size != size) {
+    std::cerr << "ERROR SharedMemoryArena size != arena size (" << path << ") " << buf.st_size
+              << " != " << size << std::endl;
+    close(fd);
+    throw types::Error("ERR_WRONG_SHMEM_ARENA_SIZE\n", types::ErrorCode::InternalError);
+  }
+
+  // the only mmap for all table pages
+  void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+  if (map == MAP_FAILED) {
+    std::cerr << "ERROR SharedMemoryArena MAP_FAILED:" << errno << " (" << path
+              << ") size:" << size << std::endl;
+    close(fd);
+    return false;
+  }
+  memory = (uint8_t*)map;
+  return true;
+}
+
+//-----------------------------------------------------------
+SharedMemoryArena::~SharedMemoryArena() {
+  std::cout << "FREE ARENA " << path << std::endl;
+  munmap(memory, size);
+  close(fd);
+}
+
+//-----------------------------------------------------------
+void SharedMemoryArena::release_region(uint32_t region) {
+  const uint64_t offset = (uint64_t)region * region_size;
+  std::cout << "RELEASE ARENA REGION: " << path << " " << region << std::endl;
+#ifdef FALLOC_FL_PUNCH_HOLE
+  if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, region_size) == 0) {
+    return;
+  }
+  std::cerr << "ERROR SharedMemoryArena punch hole:" << errno << " " << path << std::endl;
+#endif
+  // memory is not returned to system, but region is cleared anyway
+  std::memset(memory + offset, 0, region_size);
+}
+
+//-----------------------------------------------------------
+// SharedMemoryView
+//-----------------------------------------------------------
+SharedMemoryView::SharedMemoryView(const std::string& name)
+    : name(name), size(0), memory(nullptr) {
+}
+
+//-----------------------------------------------------------
+SharedMemoryView::~SharedMemoryView() {
+  if (memory != nullptr) {
+    munmap(memory, size);
+  }
+}
+
+//-----------------------------------------------------------
+bool SharedMemoryView::open(size_t expected_size) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat buf;
+  fstat(fd, &buf);
+  if ((size_t)buf.st_size != expected_size) {
+    std::cerr << "ERROR SharedMemoryView size != expected size (" << name << ") " << buf.st_size
+              << " != " << expected_size << std::endl;
+    close(fd);
+    throw types::Error("ERR_WRONG_SHMEM_PAGE_SIZE\n", types::ErrorCode::InternalError);
+  }
+
+  void* map = mmap(nullptr, expected_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    std::cerr << "ERROR SharedMemoryView MAP_FAILED:" << errno << " (" << name << ")" << std::endl;
+    throw types::Error("ERR_SHMEM_MAP_FAILED\n", types::ErrorCode::InternalError);
+  }
+  size = expected_size;
+  memory = (uint8_t*)map;
+  return true;
+}
+
+//-----------------------------------------------------------
+bool SharedMemoryArena::is_memory_available() const {
+  return isMemAvailable(path.substr(0, path.rfind('/') + 1));
+}
+
+//-----------------------------------------------------------
+bool SharedMemoryArena::is_memory_low() const {
+  return isMemLow(path.substr(0, path.rfind('/') + 1));
+}
+
+//-----------------------------------------------------------
+void SharedMemoryArena::unlink(const std::string& name) {
+  std::cout << "UNLINK: " << name << std::endl;
+  shm_unlink(name.c_str());
+  ::unlink((MEMPAGE_HUGEPAGES_PATH + name).c_str());
+}
+
 /* ----------------------------------------------------------
 **  TESTING......
 ** ----------------------------------------------------------*/
@@ -131,7 +372,7 @@ void testAddMultipleRecords(Table<TestInfo>* t, uint32_t number, uint8_t numval
   uint32_t idx;
   for (idx = 0; idx < number; ++idx) {
     TestInfo test = {numval};
-    auto result = t->addRecord(&test, 1, lifetime);
+    t->addRecord(&test, 1, lifetime);
   }
 }
 
@@ -2,12 +2,16 @@
 #define SRC_SHAREDMEM_HPP
 
 #include <sys/mman.h>
+#include <sys/types.h>
 #include <cinttypes>
+#include <cstddef>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include "locks.hpp"
+#include "thread_pool.hpp"
 #include "types.hpp"
 
 namespace shared_mem {
@@ -19,6 +23,24 @@ namespace shared_mem {
 static_assert(MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC > MEMPAGE_CHECK_EXPIRED_PAGES_INTERVAL_SEC,
               "CHECK MEM CLEAR SETTINGS");
 
+#define MEMPAGE_SUMMARY_FIELDS 4
+#define MEMPAGE_MAX_COLUMNS 16
+#define MEMPAGE_COLUMN_ALIGN 64
+
+// huge pages mount, MEMPAGE_HUGE_PAGE_SIZE is minimal alignment of arena regions there
+#define MEMPAGE_HUGEPAGES_PATH "/dev/hugepages/"
+#define MEMPAGE_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// readers retry index record that is being changed this many times, then skip it
+#define MEMPAGE_SEQLOCK_RETRIES 3
+// processes writing into one page at a time, the rest append to other pages
+#define MEMPAGE_PAGE_WRITERS 16
+// addRecord reserves elements again that many times if page was changed under writer
+#define MEMPAGE_WRITE_RETRIES 3
+// table scan is split between scan threads only if every part gets that many elements
+#define MEMPAGE_SCAN_PART_ELEMENTS 32768
+// TableScan scans pages by slices of that many elements, then looks at its deadline
+#define MEMPAGE_SCAN_SLICE_ELEMENTS (8 * MEMPAGE_SCAN_PART_ELEMENTS)
+
 #define LOWMEM_PERCENT_FOR_PAGE_REUSING 15
 #define LOWMEM_ERROR_PERCENT 10
 static_assert(LOWMEM_PERCENT_FOR_PAGE_REUSING > LOWMEM_ERROR_PERCENT, "CHECK LOWMEM SETTINGS");
@@ -28,10 +50,133 @@ class Table;
 class SharedContext;
 
 enum class PageType : int { EXPIRED, OLDEST, NEW, CURRENT, UNKNOWN };
-bool isMemAvailable();
-bool isMemLow();
+// how elements are stored inside the page:
+// ROWS    - array of elements [el0][el1][el2]...
+// COLUMNS - every element field in its own array [f0 f0 f0...][f1 f1 f1...]...
+enum class PageLayout : uint8_t { ROWS, COLUMNS };
+// how table pages are kept in /dev/shm:
+// FILES - every page is its own shared memory object, mapped on first access
+// ARENA - one sparse object per table mapped at once, page id is page position in it
+enum class PageStorage : uint8_t { FILES, ARENA };
+bool isMemAvailable(const std::string& path = "/dev/shm/");
+bool isMemLow(const std::string& path = "/dev/shm/");
+// create new SharedMemoryArena in huge pages (runtime switch, off by default)
+void setHugePages(bool enabled);
+// threads scanning parts of table by Table::processRecords(), the caller is one of them.
+// hardware threads by default, 1 - table is scanned by the caller only
+void setScanThreads(uint32_t threads);
+// pool of scan threads of this process, for one caller thread at a time
+thread_pool::ThreadPool& scanThreads();
+// kill(pid, 0) fails with EPERM for process of another user
+bool isProcessAlive(pid_t pid);
 void reportMemUsage(const PageType current_record_type, const std::string& insert_page_name);
 
+//-----------------------------------------------
+// PageColumnsTraits
+//-----------------------------------------------
+// element type that could be stored in PageLayout::COLUMNS pages must specialize
+// this template: describe every field (offset and size inside ELEMENT_T)
+struct PageColumn {
+  uint16_t offset;
+  uint16_t size;
+};
+
+template <typename ELEMENT_T>
+struct PageColumnsTraits {
+  static const uint16_t count = 0;
+  static const PageColumn* get_columns() {
+    return nullptr;
+  }
+};
+
+//-----------------------------------------------
+// PageColumns
+//-----------------------------------------------
+// access to the elements of PageLayout::COLUMNS page
+template <typename ELEMENT_T>
+class PageColumns {
+ public:
+  PageColumns(uint8_t* page_data, uint32_t max_elements, uint32_t size);
+
+  // typed pointer to the first value of column
+  template <typename FIELD_T>
+  const FIELD_T* get(uint16_t column) const;
+
+  void get_element(uint32_t idx, ELEMENT_T& element) const;  // gather fields to element
+  void set_element(uint32_t idx, const ELEMENT_T& element);  // scatter element to columns
+  // scatter element with atomic store of every field, for elements readers could see
+  void update_element(uint32_t idx, const ELEMENT_T& element);
+
+  static uint32_t get_page_data_size(uint32_t max_elements);
+  const uint32_t size;  // elements stored on page
+
+ private:
+  uint8_t* columns[MEMPAGE_MAX_COLUMNS];
+};
+
+//-------------------------------------------------------
+// SharedMemoryArena
+//-------------------------------------------------------
+// one shared memory object for all pages (regions) of a table.
+// memory is taken on first write to a region, release_region() returns it back.
+// with setHugePages(true) new arenas are created at MEMPAGE_HUGEPAGES_PATH
+// (hugetlbfs or tmpfs mounted with huge=always) and fall back to /dev/shm
+// if there are no free huge pages. existing arena is opened where it is
+class SharedMemoryArena {
+ public:
+  // regions are aligned to memory page size (huge page size for huge pages)
+  SharedMemoryArena(const std::string& name, uint32_t regions_count, uint32_t region_data_size);
+  ~SharedMemoryArena();
+
+  uint8_t* get_region(uint32_t region) const {
+    return memory + (uint64_t)region * region_size;
+  }
+  // drop memory of region, it reads as zeros after that (for all processes)
+  void release_region(uint32_t region);
+  // free memory of arena backing filesystem
+  bool is_memory_available() const;
+  bool is_memory_low() const;
+  static void unlink(const std::string& name);
+
+  uint32_t region_size;
+  bool huge_pages;
+
+ private:
+  bool open(const std::string& path, bool huge, uint32_t regions_count, uint32_t region_data_size);
+
+  const std::string name;
+  std::string path;  // arena file, /dev/shm for shm_open
+  uint64_t size;
+  int fd;  // kept open for release_region()
+  uint8_t* memory;
+};
+
+//-------------------------------------------------------
+// SharedMemoryView
+//-------------------------------------------------------
+// read-only mapping of existing shared memory object. object is never created,
+// resized or removed by view: it could belong to process of other version
+class SharedMemoryView {
+ public:
+  SharedMemoryView(const std::string& name);
+  ~SharedMemoryView();
+
+  // false if object doesn't exist, throws if it exists with other size
+  bool open(size_t expected_size);
+  const uint8_t* get_memory() const {
+    return memory;
+  }
+
+  const std::string name;
+
+ private:
+  SharedMemoryView(const SharedMemoryView&) = delete;
+  SharedMemoryView& operator=(const SharedMemoryView&) = delete;
+
+  size_t size;
+  uint8_t* memory;
+};
+
 //-------------------------------------------------------
 // SharedMemoryPage
 //-------------------------------------------------------
@@ -39,11 +184,21 @@ template <typename ELEMENT_T>
 class SharedMemoryPage {
  public:
   ELEMENT_T* getElements();
+  PageColumns<ELEMENT_T> getColumns(uint32_t size);
 
  private:
-  SharedMemoryPage(std::string page_name, uint32_t elements);
+  SharedMemoryPage(std::string page_name, uint32_t elements,
+                   PageLayout layout = PageLayout::ROWS);
+  // page inside SharedMemoryArena, memory is not owned by page
+  SharedMemoryPage(std::string page_name, uint32_t elements, PageLayout layout, uint8_t* memory,
+                   uint32_t memory_size);
   ~SharedMemoryPage();
 
+  // header and elements
+  static uint32_t get_data_size(uint32_t elements, PageLayout layout);
+  // aligned to system page
+  static uint32_t get_memory_size(uint32_t elements, PageLayout layout);
+
   // every shared memory page has this properties:
   struct Page_information {
     bool unlinked;
@@ -54,6 +209,8 @@ class SharedMemoryPage {
   // page property
   std::string page_name;
   uint32_t page_memory_size;
+  uint32_t page_elements;
+  PageLayout layout;
 
   // pointers to shared memory
   void* shared_memory;
@@ -68,9 +225,14 @@ class SharedMemoryPage {
     shm_unlink(page_name.c_str());
   }
 
+  static bool exists(std::string page_name);
+
   template <class T>
   friend class Table;
+  template <class T>
+  friend class LegacyTable;
   friend class SharedContext;
+  friend class SharedMemoryArena;
 };
 
 //-----------------------------------------------
@@ -78,7 +240,8 @@ class SharedMemoryPage {
 //-----------------------------------------------
 struct DBContext {
   uint32_t global_expire_at;
-  uint8_t reserved[1000];
+  uint32_t layout_version;  // version of tables data, set by application
+  uint8_t reserved[996];
 };
 
 class SharedContext {
@@ -92,14 +255,73 @@ class SharedContext {
   DBContext& shm;
 };
 
+//-----------------------------------------------
+// PageSummary (zone map)
+//-----------------------------------------------
+// min/max values of some element fields over all elements of the page.
+// processors use it to skip pages that cannot contain anything they need
+struct PageSummaryRange {
+  uint32_t min;
+  uint32_t max;
+};
+
+struct PageSummary {
+  PageSummaryRange fields[MEMPAGE_SUMMARY_FIELDS];
+};
+
+// element type that wants page summaries must specialize this template:
+// set enabled = true and put summarized field values into values[]
+template <typename ELEMENT_T>
+struct PageSummaryTraits {
+  static const bool enabled = false;
+  static void get_values(const ELEMENT_T& element, uint32_t (&values)[MEMPAGE_SUMMARY_FIELDS]) {
+  }
+};
+
+//-----------------------------------------------
+// ScanPage
+//-----------------------------------------------
+// page of table scan: the same pages could be scanned by another process later
+struct ScanPage {
+  uint16_t page_id;
+  uint32_t elements;  // committed when page was listed
+  uint32_t version;   // index record version, page was released or reused if changed
+};
+
 //-----------------------------------------------
 // TablePageIndexElement
 //-----------------------------------------------
 // information about all open pages in all processes
-struct TablePageIndexElement {
+struct alignas(8) TablePageIndexElement {
   uint32_t expire_at;
-  uint32_t page_elements_available;
+  uint32_t page_elements_written;  // reserved and already written by writers
+  // writers reserve elements by compare-and-swap of both as one word (PageReservation)
+  uint32_t page_elements_available;  // not reserved by writers yet
+  uint32_t version;                  // odd while page is set up or released (seqlock)
   char page_name[MEMPAGE_NAME_MAX_LEN];
+  PageSummary summary;
+  uint32_t page_elements_committed;  // visible to readers, prefix of the page
+  // processes between reservation and commit of elements, 0 - free slot.
+  // stalled elements are committed only when none of them is alive
+  pid_t writers[MEMPAGE_PAGE_WRITERS];
+};
+
+// page_elements_available and version of TablePageIndexElement
+struct PageReservation {
+  uint32_t page_elements_available;
+  uint32_t version;
+};
+static_assert(offsetof(TablePageIndexElement, page_elements_available) % 8 == 0 &&
+                  offsetof(TablePageIndexElement, version) ==
+                      offsetof(TablePageIndexElement, page_elements_available) +
+                          offsetof(PageReservation, version),
+              "PageReservation must be one aligned word of TablePageIndexElement");
+
+// elements of page taken by writer, write_records() fills and commits them
+struct ElementsReservation {
+  uint32_t element_idx;  // first reserved element
+  uint32_t version;      // index record version elements were reserved in
+  uint16_t writer;       // slot of writer pid in TablePageIndexElement::writers
 };
 
 //-----------------------------------------------
@@ -108,14 +330,16 @@ struct TablePageIndexElement {
 template <typename ELEMENT_T>
 class ElementExtractor {
  public:
-  ElementExtractor(Table<ELEMENT_T>& table, std::string page_name, uint32_t index, uint32_t size)
-      : page_name(page_name), index(index), size(size), table(table){};
+  ElementExtractor(Table<ELEMENT_T>& table, uint16_t page_id, uint32_t index, uint32_t size,
+                   uint32_t page_version = 0)
+      : page_id(page_id), index(index), size(size), page_version(page_version), table(table){};
 
   ELEMENT_T* get_element_data();
 
-  const std::string page_name;
+  const uint16_t page_id;  // page position in table index
   const uint32_t index;
   const uint32_t size;
+  const uint32_t page_version;  // page index record version when element was added
 
  private:
   Table<ELEMENT_T>& table;
@@ -126,12 +350,64 @@ class ElementExtractor {
 //-----------------------------------------------
 template <typename ELEMENT_T>
 class TableProcessor {
+ public:
+  virtual ~TableProcessor() {
+  }
+
  protected:
   // function that will be called for iterating over all not expired pages in table
   virtual void process_element(const ELEMENT_T& element) = 0;
 
+  // called before page processing, return true if nothing on the page could match
+  virtual bool skip_page(const PageSummary& summary) {
+    return false;
+  }
+
+  // called for every PageLayout::ROWS page. processor could override it
+  // to check elements by blocks, by default elements are processed one by one
+  virtual void process_rows(const ELEMENT_T* elements, uint32_t size) {
+    for (uint32_t idx = 0; idx < size; ++idx) {
+      process_element(elements[idx]);
+    }
+  }
+
+  // called for every PageLayout::COLUMNS page. processor could override it
+  // and read only columns it needs, by default elements are restored one by one
+  virtual void process_columns(const PageColumns<ELEMENT_T>& page) {
+    ELEMENT_T element{};
+    for (uint32_t idx = 0; idx < page.size; ++idx) {
+      page.get_element(idx, element);
+      process_element(element);
+    }
+  }
+
+  // pages could be scanned by parts in scan threads if processor is splittable:
+  // split() is called by the thread of a part and returns processor of the same
+  // query for it, merge() adds results of part which pages follow own pages
+  virtual bool splittable() const {
+    return false;
+  }
+  virtual std::unique_ptr<TableProcessor> split() const {
+    return nullptr;
+  }
+  virtual void merge(TableProcessor& part) {
+  }
+  // parts could be merged by scan threads too: processor which keeps its result
+  // in partitions of keys returns true from partition(), it has partitions of them
+  // then and so do its parts. merge_partition() is called by a scan thread for every
+  // partition and adds results of parts (in pages order) of that partition only,
+  // merge() is not called. parts[0] is the processor itself (null)
+  virtual bool partition(uint32_t partitions) {
+    return false;
+  }
+  virtual void merge_partition(const std::vector<std::unique_ptr<TableProcessor>>& parts,
+                               uint32_t partition) {
+  }
+
   template <class T>
   friend class Table;
+  template <class T>
+  friend class LegacyTable;
 };
 
 //-----------------------------------------------
@@ -141,36 +417,110 @@ template <typename ELEMENT_T>
 class Table {
  public:
   Table(std::string table_name, uint16_t table_max_pages, uint32_t max_elements_in_page,
-        uint32_t record_expire_seconds, SharedContext& context);
+        uint32_t record_expire_seconds, SharedContext& context,
+        PageLayout layout = PageLayout::ROWS, PageStorage storage = PageStorage::FILES);
   ~Table();
 
   ElementExtractor<ELEMENT_T> addRecord(ELEMENT_T* el, uint32_t size = 1,
                                         uint32_t lifetime_seconds = 0);
+  // change element added before (position from addRecord()) in place. every field is
+  // stored atomically, element type must specialize PageColumnsTraits. page expire time
+  // and summary are extended. false if page was released or reused since then
+  bool updateRecord(uint16_t page_id, uint32_t index, uint32_t page_version,
+                    const ELEMENT_T& element, uint32_t lifetime_seconds = 0);
+  // copy element added before, false if page was released or reused since then.
+  // element is consistent only if its writers are serialized with the caller
+  bool readRecord(uint16_t page_id, uint32_t index, uint32_t page_version,
+                  ELEMENT_T& element);
   void processRecords(TableProcessor<ELEMENT_T>& result);
+  // pages processRecords() scans for processor: not expired and not skipped, in table order
+  std::vector<ScanPage> getPagesToScan(TableProcessor<ELEMENT_T>& processor);
+  // scan pages listed by getPagesToScan() of this or another process. false if some of
+  // them were released or reused since then, processor got only part of elements
+  bool processPages(TableProcessor<ELEMENT_T>& processor, const ScanPage* pages, size_t count);
   void cleanup();
-  const SharedContext context;
+  // cleanup() and remove table index, table must not be used after that
+  void drop();
+  // elements stored in not expired pages
+  uint64_t getElementsCount();
+  // table was created by some process
+  static bool exists(const std::string& table_name);
+  // pages are in SharedMemoryArena backed by huge pages
+  bool usesHugePages() const;
+  // context is owned by the table user (shared by its tables), it outlives the table
+  SharedContext& context;
 
  private:
-  SharedMemoryPage<ELEMENT_T>* localGetPageByName(const std::string& page_name_to_look);
-  SharedMemoryPage<ELEMENT_T>* getPageByName(const std::string& page_name_to_look);
+  SharedMemoryPage<ELEMENT_T>* getPageById(uint16_t page_id);
+  void release_page(uint16_t page_id);
+  void remove_page(uint16_t page_id);  // mark unlinked and free page memory
+  std::string get_page_name(uint16_t page_id) const;
   void release_open_pages();
   void clear_index_record(TablePageIndexElement& record);
   void clear_index_record_full(TablePageIndexElement& record);
+  void clear_page_summary(PageSummary& summary);
+  void update_page_summary(PageSummary& summary, const ELEMENT_T* records, uint32_t records_count);
   void release_expired_memory_pages();
+  // page with reserved elements for records, lock-free on the page used last time
+  uint16_t reserve_page(const ELEMENT_T* records, uint32_t records_count,
+                        uint32_t lifetime_seconds, ElementsReservation& reservation);
+  // page and count of its elements to scan
+  using PageToScan = std::pair<SharedMemoryPage<ELEMENT_T>*, uint32_t>;
+  void scan_pages(TableProcessor<ELEMENT_T>& processor, const PageToScan* pages, size_t count);
+  // split pages between scan threads by parts of close elements count
+  void scan_pages_by_parts(TableProcessor<ELEMENT_T>& processor,
+                           const std::vector<PageToScan>& pages, uint64_t elements,
+                           uint32_t parts);
   void checkRecord(uint32_t& records_cout);
   void update_record_expire(TablePageIndexElement* index_record, uint32_t current_time,
                             uint32_t lifetime_seconds);
   void update_global_expire(uint32_t value);
+  // take records_count elements of page with atomic compare-and-swap of PageReservation.
+  // false if page is not in use, expired, has no room, has no free writer slot or is being
+  // changed. does not need table lock
+  bool reserve_elements(TablePageIndexElement& record, uint32_t records_count,
+                        uint32_t current_time, ElementsReservation& reservation);
+  // false if page was released or set up again since reservation, nothing is committed then
+  bool write_records(uint16_t page_id, const ElementsReservation& reservation,
+                     const ELEMENT_T* records, uint32_t records_count);
+  // count written elements, make them visible to readers when all reserved ones are written
+  void commit_elements(TablePageIndexElement& record, uint32_t records_count);
+  // slot of TablePageIndexElement::writers taken by this process, false if all are taken
+  bool enter_writer(TablePageIndexElement& record, uint16_t& writer);
+  void exit_writer(TablePageIndexElement& record, uint16_t writer);
+  // writer killed between reservation and write holds back the rest of the page, commit it
+  // when no process registered as writer of the page is alive
+  void commit_stalled_elements(uint16_t page_id);
+  // seqlock of index record: readers skip page between begin and end, table lock is required
+  void begin_page_change(TablePageIndexElement& record);
+  void end_page_change(TablePageIndexElement& record);
+  // begin_page_change() of page to be reused or removed. false and page is left as it was
+  // if some reserved elements are not written yet: writer could still copy into them
+  bool begin_page_reuse(TablePageIndexElement& record);
+  // consistent copy of expire_at, page_elements_committed, summary and version
+  // without table lock. false if page is being changed
+  bool read_index_record(const TablePageIndexElement& record,
+                         TablePageIndexElement& snapshot) const;
 
   locks::CriticalSection lock;                          // [interprocess memory access management]
   SharedMemoryPage<TablePageIndexElement> table_index;  // [INDEX]
-  std::vector<SharedMemoryPage<ELEMENT_T>*> opened_pages_list;
+  // pages mapped by this process, indexed by page id (slot in table_index)
+  std::vector<SharedMemoryPage<ELEMENT_T>*> opened_pages;
 
   const std::string table_name;
   const uint16_t table_max_pages;
   const uint32_t max_elements_in_page;
   const uint32_t record_expire_seconds;
+  const PageLayout layout;
+  const PageStorage storage;
+  uint32_t page_memory_size;
+  std::unique_ptr<SharedMemoryArena> arena;  // PageStorage::ARENA only
   uint32_t time_to_check_page_expire = 0;
+  // page this process appended to last time, next addRecord tries it without table lock
+  uint16_t append_page = UINT16_MAX;
+  // page version and page_elements_written seen by previous maintenance
+  // when page had reserved but not written elements
+  std::vector<uint64_t> stalled_written;
 
   template <class T>
   friend class SharedMemoryPage;
@@ -178,6 +528,74 @@ class Table {
   template <class T>
   friend class ElementExtractor;
 };
+
+//-----------------------------------------------
+// TableScan
+//-----------------------------------------------
+// processRecords() which could be suspended between slices of pages: pages are listed
+// by constructor, resume() scans them until deadline. pages released meanwhile are skipped
+template <typename ELEMENT_T>
+class TableScan {
+ public:
+  TableScan(Table<ELEMENT_T>& table, TableProcessor<ELEMENT_T>& processor,
+            uint64_t slice_elements = MEMPAGE_SCAN_SLICE_ELEMENTS);
+  // scan slices until deadline (timing::getTimestampMs()), one slice at least.
+  // true when all pages are scanned
+  bool resume(int64_t deadline_ms);
+
+ private:
+  Table<ELEMENT_T>& table;
+  TableProcessor<ELEMENT_T>& processor;
+  const uint64_t slice_elements;
+  std::vector<ScanPage> pages;
+  size_t next_page = 0;
+};
+
+//-----------------------------------------------
+// LegacyTable
+//-----------------------------------------------
+// read-only access to table of index layout before PageSummary, to migrate its elements.
+// processes of previous version could still write to it: index and pages are mapped
+// read-only and nothing is removed until drop()
+template <typename ELEMENT_T>
+class LegacyTable {
+ public:
+  // throws if table index has other size
+  LegacyTable(std::string table_name, uint16_t table_max_pages, uint32_t max_elements_in_page);
+
+  // process elements of not expired pages, pages released meanwhile are skipped
+  void processRecords(TableProcessor<ELEMENT_T>& processor, uint32_t global_expire_at);
+  // elements of page, nullptr if page was released or elements are out of it
+  const ELEMENT_T* getRecords(uint16_t page_id, uint32_t index, uint32_t size);
+  // remove index and pages, only when no process of previous version uses table
+  void drop();
+  static bool exists(const std::string& table_name);
+
+ private:
+  // layout of previous version, must not be changed
+  struct IndexElement {
+    uint32_t expire_at;
+    uint32_t page_elements_available;
+    char page_name[MEMPAGE_NAME_MAX_LEN];
+  };
+  struct PageInformation {
+    bool unlinked;
+    uint32_t expiration_check;
+  };
+
+  // header and elements aligned to system page (and one more system page)
+  static size_t get_memory_size(uint32_t elements, size_t element_size);
+  const IndexElement* get_index() const;
+  std::string get_page_name(uint16_t page_id) const;
+
+  locks::CriticalSection lock;  // index lock of previous version
+  SharedMemoryView table_index;
+  std::vector<std::unique_ptr<SharedMemoryView>> opened_pages;
+
+  const std::string table_name;
+  const uint16_t table_max_pages;
+  const uint32_t max_elements_in_page;
+};
 }  // namespace shared_mem
 
 // template implementation...
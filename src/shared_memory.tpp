@@ -5,6 +5,7 @@
 
 #include <errno.h>
 #include <fcntl.h> /* For O_* constants */
+#include <sched.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -17,20 +18,79 @@
 
 namespace shared_mem {
 
+// index records are updated by appending processes without table lock
+inline void atomic_store_min(uint32_t& value, uint32_t candidate) {
+  uint32_t current = __atomic_load_n(&value, __ATOMIC_RELAXED);
+  while (candidate < current && !__atomic_compare_exchange_n(&value, &current, candidate, true,
+                                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+// element fields changed in place: readers see either old or new value of each field
+inline void atomic_store_field(uint8_t* to, const uint8_t* from, uint16_t size) {
+  switch (size) {
+    case 1:
+      __atomic_store_n(to, *from, __ATOMIC_RELAXED);
+      break;
+    case 2: {
+      uint16_t value;
+      std::memcpy(&value, from, 2);
+      __atomic_store_n((uint16_t*)to, value, __ATOMIC_RELAXED);
+      break;
+    }
+    case 4: {
+      uint32_t value;
+      std::memcpy(&value, from, 4);
+      __atomic_store_n((uint32_t*)to, value, __ATOMIC_RELAXED);
+      break;
+    }
+    case 8: {
+      uint64_t value;
+      std::memcpy(&value, from, 8);
+      __atomic_store_n((uint64_t*)to, value, __ATOMIC_RELAXED);
+      break;
+    }
+    default:
+      std::memcpy(to, from, size);
+  }
+}
+
+inline void atomic_store_max(uint32_t& value, uint32_t candidate) {
+  uint32_t current = __atomic_load_n(&value, __ATOMIC_RELAXED);
+  while (candidate > current && !__atomic_compare_exchange_n(&value, &current, candidate, true,
+                                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
 /*-----------------------------------------------------------------
 * TABLE        Constructor
 *-----------------------------------------------------------------*/
 template <typename ELEMENT_T>
 Table<ELEMENT_T>::Table(std::string table_name, uint16_t table_max_pages,
                         uint32_t max_elements_in_page, uint32_t record_expire_seconds,
-                        SharedContext& context)
+                        SharedContext& context, PageLayout layout, PageStorage storage)
     : context(context),
       lock{table_name},
       table_index{table_name, table_max_pages},
+      opened_pages(table_max_pages, nullptr),
       table_name{table_name},
       table_max_pages(table_max_pages),
       max_elements_in_page(max_elements_in_page),
-      record_expire_seconds(record_expire_seconds) {
+      record_expire_seconds(record_expire_seconds),
+      layout(layout),
+      storage(storage),
+      page_memory_size(SharedMemoryPage<ELEMENT_T>::get_memory_size(max_elements_in_page, layout)),
+      stalled_written(table_max_pages, UINT64_MAX) {
+  if (layout == PageLayout::COLUMNS && PageColumnsTraits<ELEMENT_T>::count == 0) {
+    std::cerr << "ERROR Table::Table (" << table_name << ") no columns description" << std::endl;
+    throw types::Error("NO_COLUMNS_DESCRIPTION\n", types::ErrorCode::InternalError);
+  }
+  if (storage == PageStorage::ARENA) {
+    arena.reset(new SharedMemoryArena{
+        table_name + ".arena", table_max_pages,
+        SharedMemoryPage<ELEMENT_T>::get_data_size(max_elements_in_page, layout)});
+    page_memory_size = arena->region_size;
+  }
   std::cout << "Table::Table (" << table_name << ") OK" << std::endl;
 }
 
@@ -49,8 +109,12 @@ Table<ELEMENT_T>::~Table() {
 //-----------------------------------------------------
 template <typename ELEMENT_T>
 void Table<ELEMENT_T>::clear_index_record(TablePageIndexElement& record) {
-  record.expire_at = 0;
-  record.page_elements_available = max_elements_in_page;
+  // page stays out of lock-free appends (expire_at == 0) until it is set up again
+  __atomic_store_n(&record.expire_at, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&record.page_elements_available, max_elements_in_page, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&record.page_elements_written, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&record.page_elements_committed, 0, __ATOMIC_SEQ_CST);
+  clear_page_summary(record.summary);
 }
 
 //-----------------------------------------------------
@@ -58,9 +122,45 @@ void Table<ELEMENT_T>::clear_index_record(TablePageIndexElement& record) {
 //-----------------------------------------------------
 template <typename ELEMENT_T>
 void Table<ELEMENT_T>::clear_index_record_full(TablePageIndexElement& record) {
-  record.expire_at = 0;
-  record.page_elements_available = max_elements_in_page;
+  __atomic_store_n(&record.expire_at, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&record.page_elements_available, max_elements_in_page, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&record.page_elements_written, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&record.page_elements_committed, 0, __ATOMIC_SEQ_CST);
   std::memset(&record.page_name, 0, MEMPAGE_NAME_MAX_LEN);
+  clear_page_summary(record.summary);
+}
+
+//-----------------------------------------------------
+// clear_page_summary
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::clear_page_summary(PageSummary& summary) {
+  for (auto& field : summary.fields) {
+    __atomic_store_n(&field.min, UINT32_MAX, __ATOMIC_RELAXED);
+    __atomic_store_n(&field.max, 0, __ATOMIC_RELAXED);
+  }
+}
+
+//-----------------------------------------------------
+// update_page_summary
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::update_page_summary(PageSummary& summary, const ELEMENT_T* records,
+                                           uint32_t records_count) {
+  if (!PageSummaryTraits<ELEMENT_T>::enabled) {
+    return;
+  }
+
+  uint32_t values[MEMPAGE_SUMMARY_FIELDS];
+  for (uint32_t idx = 0; idx < records_count; ++idx) {
+    PageSummaryTraits<ELEMENT_T>::get_values(records[idx], values);
+
+    for (uint16_t field = 0; field < MEMPAGE_SUMMARY_FIELDS; ++field) {
+      auto& range = summary.fields[field];
+      atomic_store_min(range.min, values[field]);
+      atomic_store_max(range.max, values[field]);
+    }
+  }
 }
 
 //-----------------------------------------------------
@@ -68,18 +168,30 @@ void Table<ELEMENT_T>::clear_index_record_full(TablePageIndexElement& record) {
 //-----------------------------------------------------
 template <typename ELEMENT_T>
 void Table<ELEMENT_T>::processRecords(TableProcessor<ELEMENT_T>& processor) {
+  const auto pages = getPagesToScan(processor);
+  processPages(processor, pages.data(), pages.size());
+}
+
+//-----------------------------------------------------
+// getPagesToScan
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+std::vector<ScanPage> Table<ELEMENT_T>::getPagesToScan(TableProcessor<ELEMENT_T>& processor) {
   //
   release_expired_memory_pages();
 
   uint32_t timestamp_now = timing::getTimestampSec();
-  std::vector<TablePageIndexElement*> records_to_scan;
-  records_to_scan.reserve(opened_pages_list.size());  // optimisation
-
-  lock.enter();
-  locks::AutoCloser guard(lock);
+  // page and count of committed elements, readers don't look further
+  std::vector<ScanPage> pages_to_scan;
+  pages_to_scan.reserve(table_max_pages);  // optimisation
 
+  // index is read without table lock, see read_index_record()
+  TablePageIndexElement index_current;
   for (uint16_t idx = 0; idx < table_max_pages; ++idx) {
-    TablePageIndexElement& index_current = table_index.shared_elements[idx];
+    // page is being set up or released right now, nothing to read there
+    if (!read_index_record(table_index.shared_elements[idx], index_current)) {
+      continue;
+    }
     // or not used yet (stop here. next pages are unused)
     // [expired][expired][data][expired][data][expired][expired][zero][unused][unused]...[unused]
     //                                                            ^
@@ -91,7 +203,11 @@ void Table<ELEMENT_T>::processRecords(TableProcessor<ELEMENT_T>& processor) {
     //                     ^              ^
     if (index_current.expire_at > timestamp_now &&
         index_current.expire_at > context.shm.global_expire_at) {
-      records_to_scan.push_back(&index_current);
+      // let processor check page summary and skip what it doesn't need
+      if (!processor.skip_page(index_current.summary)) {
+        pages_to_scan.push_back(
+            {idx, index_current.page_elements_committed, index_current.version});
+      }
     }
     // [expired][data][expired][data][expired][expired][expired][zero][unused][unused]...[unused]
     //   ^              ^              ^        ^        ^
@@ -100,18 +216,174 @@ void Table<ELEMENT_T>::processRecords(TableProcessor<ELEMENT_T>& processor) {
     }
   }
 
-  lock.exit();
+  return pages_to_scan;
+}
 
+//-----------------------------------------------------
+// processPages
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::processPages(TableProcessor<ELEMENT_T>& processor, const ScanPage* pages,
+                                    size_t count) {
+  const auto unchanged = [this](const ScanPage& page) {
+    return __atomic_load_n(&table_index.shared_elements[page.page_id].version,
+                           __ATOMIC_SEQ_CST) == page.version;
+  };
+
+  std::vector<PageToScan> pages_to_scan;
+  pages_to_scan.reserve(count);
+  uint64_t elements_to_scan = 0;
+  bool complete = true;
+
+  for (size_t idx = 0; idx < count; ++idx) {
+    const auto& page = pages[idx];
+    if (page.page_id >= table_max_pages || !unchanged(page)) {
+      complete = false;
+      continue;
+    }
+    // pages are mapped here, scan threads only read them
+    pages_to_scan.emplace_back(getPageById(page.page_id), page.elements);
+    elements_to_scan += page.elements;
+  }
+
+  // large scan of splittable processor is shared with scan threads
+  const uint64_t parts =
+      std::min<uint64_t>(elements_to_scan / MEMPAGE_SCAN_PART_ELEMENTS, pages_to_scan.size());
+  if (parts > 1 && processor.splittable()) {
+    scan_pages_by_parts(processor, pages_to_scan, elements_to_scan, parts);
+  } else {
+    scan_pages(processor, pages_to_scan.data(), pages_to_scan.size());
+  }
+
+  // page could be reused while it was read
+  for (size_t idx = 0; idx < count && complete; ++idx) {
+    complete = unchanged(pages[idx]);
+  }
+  return complete;
+}
+
+//-----------------------------------------------------
+// TableScan constructor
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+TableScan<ELEMENT_T>::TableScan(Table<ELEMENT_T>& table, TableProcessor<ELEMENT_T>& processor,
+                                uint64_t slice_elements)
+    : table(table),
+      processor(processor),
+      slice_elements(slice_elements),
+      pages(table.getPagesToScan(processor)) {
+}
+
+//-----------------------------------------------------
+// TableScan resume
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool TableScan<ELEMENT_T>::resume(int64_t deadline_ms) {
+  do {
+    // slice is a range of pages, so parts of scan threads are within it
+    const size_t first = next_page;
+    uint64_t elements = 0;
+    while (next_page < pages.size() && (next_page == first || elements < slice_elements)) {
+      elements += pages[next_page++].elements;
+    }
+    table.processPages(processor, pages.data() + first, next_page - first);
+  } while (next_page < pages.size() && timing::getTimestampMs() < deadline_ms);
+
+  return next_page == pages.size();
+}
+
+//-----------------------------------------------------
+// scan_pages
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::scan_pages(TableProcessor<ELEMENT_T>& processor, const PageToScan* pages,
+                                  size_t count) {
   // process every element in every page
-  for (const auto record : records_to_scan) {
-    const auto page = getPageByName(record->page_name);
-    const auto elements = page->getElements();
-    const auto size = max_elements_in_page - record->page_elements_available;
+  for (size_t idx = 0; idx < count; ++idx) {
+    const auto page = pages[idx].first;
+    const auto size = pages[idx].second;
+
+    if (layout == PageLayout::COLUMNS) {
+      processor.process_columns(page->getColumns(size));
+      continue;
+    }
 
     // go throught all elements and apply process function
-    for (uint32_t idx = 0; idx < size; ++idx) {
-      processor.process_element(elements[idx]);
+    processor.process_rows(page->getElements(), size);
+  }
+}
+
+//-----------------------------------------------------
+// scan_pages_by_parts
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::scan_pages_by_parts(TableProcessor<ELEMENT_T>& processor,
+                                           const std::vector<PageToScan>& pages,
+                                           uint64_t elements, uint32_t parts) {
+  auto& threads = scanThreads();
+  parts = std::min(parts, threads.size());
+  if (parts == 1) {
+    scan_pages(processor, pages.data(), pages.size());
+    return;
+  }
+
+  // part is a range of pages of close elements count,
+  // so merging parts in their order keeps pages order
+  std::vector<size_t> part_first(parts + 1, pages.size());
+  part_first[0] = 0;
+  uint64_t part_elements = 0;
+  uint32_t part = 1;
+  for (size_t idx = 0; idx < pages.size() && part < parts; ++idx) {
+    part_elements += pages[idx].second;
+    if (part_elements * parts >= elements * part) {
+      part_first[part++] = idx + 1;
+    }
+  }
+
+  // partitions of processor result are set before parts copy it
+  const bool partitioned = processor.partition(threads.size());
+
+  // part 0 is scanned by the processor itself in the caller thread. it waits
+  // until other parts split the processor, they copy its state
+  std::vector<std::unique_ptr<TableProcessor<ELEMENT_T>>> processors(parts);
+  std::mutex split_lock;
+  std::condition_variable split_done;
+  uint32_t splitted = 1;
+
+  threads.run(parts, [&](uint32_t part) {
+    if (part == 0) {
+      std::unique_lock<std::mutex> guard(split_lock);
+      split_done.wait(guard, [&] { return splitted == parts; });
+    } else {
+      std::exception_ptr split_error;
+      try {
+        processors[part] = processor.split();
+      } catch (...) {
+        split_error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> guard(split_lock);
+        if (++splitted == parts) {
+          split_done.notify_one();
+        }
+      }
+      if (split_error) {
+        std::rethrow_exception(split_error);
+      }
     }
+    auto& part_processor = part ? *processors[part] : processor;
+    scan_pages(part_processor, pages.data() + part_first[part],
+               part_first[part + 1] - part_first[part]);
+  });
+
+  if (partitioned) {
+    threads.run(threads.size(), [&](uint32_t partition) {
+      processor.merge_partition(processors, partition);
+    });
+    return;
+  }
+  for (part = 1; part < parts; ++part) {
+    processor.merge(*processors[part]);
   }
 }
 
@@ -131,11 +403,10 @@ void Table<ELEMENT_T>::cleanup() {
     index_current = index_first + idx;
     // if page not empty and not expired
     if (index_current->expire_at > 0) {
-      const auto page = getPageByName(index_current->page_name);
-      // mark as deleted
-      page->shared_pageinfo->unlinked = true;
-      SharedMemoryPage<ELEMENT_T>::unlink(index_current->page_name);
+      begin_page_change(*index_current);
+      remove_page(idx);
       clear_index_record_full(*index_current);
+      end_page_change(*index_current);
     } else {
       // stop here. next pages are unused
       break;
@@ -147,15 +418,66 @@ void Table<ELEMENT_T>::cleanup() {
   release_open_pages();
 }
 
+//-----------------------------------------------------
+// drop
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::drop() {
+  cleanup();
+  if (storage == PageStorage::ARENA) {
+    SharedMemoryArena::unlink(table_name + ".arena");
+  }
+  SharedMemoryPage<TablePageIndexElement>::unlink(table_index.page_name);
+}
+
+//-----------------------------------------------------
+// getElementsCount
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+uint64_t Table<ELEMENT_T>::getElementsCount() {
+  uint32_t current_time = timing::getTimestampSec();
+  uint64_t count = 0;
+
+  TablePageIndexElement index_record;
+  for (uint16_t idx = 0; idx < table_max_pages; ++idx) {
+    if (!read_index_record(table_index.shared_elements[idx], index_record)) {
+      continue;
+    }
+    if (index_record.expire_at == 0) {
+      break;
+    }
+    if (index_record.expire_at > current_time) {
+      count += index_record.page_elements_committed;
+    }
+  }
+
+  return count;
+}
+
+//-----------------------------------------------------
+// exists
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::exists(const std::string& table_name) {
+  return SharedMemoryPage<TablePageIndexElement>::exists(table_name);
+}
+
+//-----------------------------------------------------
+// usesHugePages
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::usesHugePages() const {
+  return arena && arena->huge_pages;
+}
+
 //-----------------------------------------------------
 // release_open_pages
 //-----------------------------------------------------
 template <typename ELEMENT_T>
 void Table<ELEMENT_T>::release_open_pages() {
-  for (auto page : opened_pages_list) {
-    delete page;
+  for (uint16_t idx = 0; idx < table_max_pages; ++idx) {
+    release_page(idx);
   }
-  opened_pages_list.clear();
 }
 
 //-----------------------------------------------------
@@ -168,8 +490,46 @@ ElementExtractor<ELEMENT_T> Table<ELEMENT_T>::addRecord(ELEMENT_T* records_point
   release_expired_memory_pages();
   checkRecord(records_count);
 
+  for (uint32_t retries = 0;; ++retries) {
+    ElementsReservation reservation{};
+    const uint16_t page_id =
+        reserve_page(records_pointer, records_count, lifetime_seconds, reservation);
+    if (write_records(page_id, reservation, records_pointer, records_count)) {
+      return ElementExtractor<ELEMENT_T>{*this, page_id, reservation.element_idx, records_count,
+                                         reservation.version};
+    }
+    // page was truncated under the writer, records go to a page set up after that
+    std::cerr << "ERROR Table::addRecord (" << table_name << ") page changed:" << page_id
+              << std::endl;
+    append_page = UINT16_MAX;
+    if (retries == MEMPAGE_WRITE_RETRIES) {
+      throw types::Error("addRecord::PAGE_CHANGED\n", types::ErrorCode::InternalError);
+    }
+  }
+}
+
+//-----------------------------------------------------
+// reserve_page
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+uint16_t Table<ELEMENT_T>::reserve_page(const ELEMENT_T* records_pointer, uint32_t records_count,
+                                        uint32_t lifetime_seconds,
+                                        ElementsReservation& reservation) {
   uint32_t current_time = timing::getTimestampSec();
-  TablePageIndexElement* index_record;
+  TablePageIndexElement* index_record = nullptr;
+
+  // steady state: page used last time still has room, elements are reserved there
+  // with compare-and-swap, table lock is taken only to roll over to another page
+  if (append_page < table_max_pages) {
+    index_record = &table_index.shared_elements[append_page];
+    if (reserve_elements(*index_record, records_count, current_time, reservation)) {
+      update_record_expire(index_record, current_time, lifetime_seconds);
+      // summary updated before elements are written, so it never misses them
+      update_page_summary(index_record->summary, records_pointer, records_count);
+      return append_page;
+    }
+  }
+
   uint32_t expire_min = UINT32_MAX;
   uint16_t expire_min_idx = 0;
   uint16_t idx;
@@ -187,14 +547,15 @@ ElementExtractor<ELEMENT_T> Table<ELEMENT_T>::addRecord(ELEMENT_T* records_point
     // page expired -> make it empty and use it to save records
     // [expired][expired][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
     //   ^        ^              ^        ^        ^        ^
-    if (index_record->expire_at > 0 && index_record->expire_at < current_time) {
+    if (index_record->expire_at > 0 && index_record->expire_at < current_time &&
+        begin_page_reuse(*index_record)) {
       current_record_type = PageType::EXPIRED;
       break;
     }
     // page exist and fit in size
     // [data][data][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
     //   ^     ^     ^
-    if (index_record->expire_at > 0 && index_record->page_elements_available >= records_count) {
+    if (reserve_elements(*index_record, records_count, current_time, reservation)) {
       current_record_type = PageType::CURRENT;
       break;
     }
@@ -207,14 +568,33 @@ ElementExtractor<ELEMENT_T> Table<ELEMENT_T>::addRecord(ELEMENT_T* records_point
     }
   }
 
-  if (current_record_type == PageType::NEW && shared_mem::isMemLow()) {
+  if (current_record_type == PageType::NEW &&
+      (arena ? arena->is_memory_low() : shared_mem::isMemLow()) &&
+      begin_page_reuse(table_index.shared_elements[expire_min_idx])) {
     current_record_type = PageType::OLDEST;
     idx = expire_min_idx;
     index_record = &table_index.shared_elements[idx];
     update_global_expire(index_record->expire_at);
   }
 
-  std::string insert_page_name = table_index.page_name + ":" + std::to_string(idx);
+  // arena takes memory on first write to a page, check it the way page constructor does
+  if (storage == PageStorage::ARENA && current_record_type == PageType::NEW &&
+      !arena->is_memory_available()) {
+    std::cerr << "ERROR Table::addRecord LOW SHARED MEMORY" << std::endl;
+    throw types::Error("ERR_LOW_SHMEM\n", types::ErrorCode::InternalError);
+  }
+
+  std::string insert_page_name = get_page_name(idx);
+  // expired and oldest pages are changed since begin_page_reuse()
+  if (current_record_type == PageType::NEW) {
+    begin_page_change(*index_record);
+  }
+  if (current_record_type != PageType::CURRENT && current_record_type != PageType::UNKNOWN &&
+      !enter_writer(*index_record, reservation.writer)) {
+    // page is left as it was
+    __atomic_sub_fetch(&index_record->version, 1, __ATOMIC_SEQ_CST);
+    throw types::Error("addRecord::NO_WRITER_SLOT\n", types::ErrorCode::InternalError);
+  }
 
   switch (current_record_type) {
     case PageType::NEW:
@@ -229,21 +609,104 @@ ElementExtractor<ELEMENT_T> Table<ELEMENT_T>::addRecord(ELEMENT_T* records_point
       throw types::Error("addRecord::NO_SPACE_TO_INSERT\n", types::ErrorCode::InternalError);
   }
 
-  uint32_t insert_element_idx = max_elements_in_page - index_record->page_elements_available;
-  index_record->page_elements_available -= records_count;
-  update_record_expire(index_record, current_time, lifetime_seconds);
+  if (current_record_type != PageType::CURRENT) {
+    // page is set up again, lock-free appends wait for end_page_change()
+    update_record_expire(index_record, current_time, lifetime_seconds);
+    reservation.element_idx = 0;
+    __atomic_store_n(&index_record->page_elements_available,
+                     max_elements_in_page - records_count, __ATOMIC_SEQ_CST);
+  } else {
+    update_record_expire(index_record, current_time, lifetime_seconds);
+  }
+  // summary updated before elements are written, so it never misses them
+  update_page_summary(index_record->summary, records_pointer, records_count);
+  if (current_record_type != PageType::CURRENT) {
+    end_page_change(*index_record);
+    // version is changed only under table lock
+    reservation.version = __atomic_load_n(&index_record->version, __ATOMIC_SEQ_CST);
+  }
+  append_page = idx;
 
   lock.exit();
 
   if (current_record_type != PageType::CURRENT) {
     reportMemUsage(current_record_type, insert_page_name);
   }
-  // we have page and position to insert let's find page in local heap or allocate it
-  const auto page = getPageByName(insert_page_name);
-  std::memcpy(&page->shared_elements[insert_element_idx], records_pointer,
-              sizeof(ELEMENT_T) * records_count);
 
-  return ElementExtractor<ELEMENT_T>{*this, insert_page_name, insert_element_idx, records_count};
+  return idx;
+}
+
+//-----------------------------------------------------
+// Table updateRecord
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::updateRecord(uint16_t page_id, uint32_t index, uint32_t page_version,
+                                    const ELEMENT_T& element, uint32_t lifetime_seconds) {
+  if (PageColumnsTraits<ELEMENT_T>::count == 0) {
+    std::cerr << "ERROR Table::updateRecord (" << table_name << ") no columns description"
+              << std::endl;
+    throw types::Error("NO_COLUMNS_DESCRIPTION\n", types::ErrorCode::InternalError);
+  }
+  if (page_id >= table_max_pages) {
+    throw types::Error("updateRecord::WRONG_PAGE_ID\n", types::ErrorCode::InternalError);
+  }
+
+  const uint32_t current_time = timing::getTimestampSec();
+  TablePageIndexElement* index_record = &table_index.shared_elements[page_id];
+  const uint32_t expire_at = __atomic_load_n(&index_record->expire_at, __ATOMIC_SEQ_CST);
+  if (expire_at == 0 || expire_at < current_time) {
+    return false;
+  }
+  // page is kept alive first, then checked: expired pages are reused only under table lock
+  update_record_expire(index_record, current_time, lifetime_seconds);
+  if (__atomic_load_n(&index_record->version, __ATOMIC_SEQ_CST) != page_version ||
+      __atomic_load_n(&index_record->page_elements_committed, __ATOMIC_ACQUIRE) <= index) {
+    return false;
+  }
+  // summary updated before element is changed, so it never misses it
+  update_page_summary(index_record->summary, &element, 1);
+
+  const auto page = getPageById(page_id);
+  if (layout == PageLayout::COLUMNS) {
+    page->getColumns(max_elements_in_page).update_element(index, element);
+    return true;
+  }
+
+  const auto description = PageColumnsTraits<ELEMENT_T>::get_columns();
+  uint8_t* to = (uint8_t*)&page->shared_elements[index];
+  for (uint16_t column = 0; column < PageColumnsTraits<ELEMENT_T>::count; ++column) {
+    const auto& field = description[column];
+    atomic_store_field(to + field.offset, (const uint8_t*)&element + field.offset, field.size);
+  }
+  return true;
+}
+
+//-----------------------------------------------------
+// Table readRecord
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::readRecord(uint16_t page_id, uint32_t index, uint32_t page_version,
+                                  ELEMENT_T& element) {
+  if (page_id >= table_max_pages) {
+    throw types::Error("readRecord::WRONG_PAGE_ID\n", types::ErrorCode::InternalError);
+  }
+
+  TablePageIndexElement* index_record = &table_index.shared_elements[page_id];
+  const uint32_t expire_at = __atomic_load_n(&index_record->expire_at, __ATOMIC_SEQ_CST);
+  if (expire_at == 0 || expire_at < timing::getTimestampSec() ||
+      __atomic_load_n(&index_record->version, __ATOMIC_SEQ_CST) != page_version ||
+      __atomic_load_n(&index_record->page_elements_committed, __ATOMIC_ACQUIRE) <= index) {
+    return false;
+  }
+
+  const auto page = getPageById(page_id);
+  if (layout == PageLayout::COLUMNS) {
+    page->getColumns(max_elements_in_page).get_element(index, element);
+  } else {
+    element = page->shared_elements[index];
+  }
+  // page could be reused while it was read
+  return __atomic_load_n(&index_record->version, __ATOMIC_SEQ_CST) == page_version;
 }
 
 //-----------------------------------------------------
@@ -272,39 +735,315 @@ void Table<ELEMENT_T>::update_record_expire(TablePageIndexElement* index_record,
   }
 
   // update page expire time only if record expire time greater
-  if (expire_time > index_record->expire_at) {
-    index_record->expire_at = expire_time;
+  atomic_store_max(index_record->expire_at, expire_time);
+}
+
+//-----------------------------------------------------
+// reserve_elements
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::reserve_elements(TablePageIndexElement& record, uint32_t records_count,
+                                        uint32_t current_time, ElementsReservation& reservation) {
+  // version is swapped together with available count: page released and set up again
+  // meanwhile could have the same count available, and its elements would be given twice
+  uint64_t* page_reservation = (uint64_t*)&record.page_elements_available;
+  uint64_t expected = __atomic_load_n(page_reservation, __ATOMIC_SEQ_CST);
+  PageReservation state;
+  std::memcpy(&state, &expected, sizeof(state));
+  const uint32_t version = state.version;
+  if (version % 2) {
+    return false;
+  }
+
+  // expire time of this page version: it can't be reset without version change
+  const uint32_t expire_at = __atomic_load_n(&record.expire_at, __ATOMIC_SEQ_CST);
+  if (expire_at == 0 || expire_at < current_time) {
+    return false;
+  }
+
+  // writer is registered before its elements are reserved: maintenance that sees them
+  // reserved sees who could write them
+  if (!enter_writer(record, reservation.writer)) {
+    return false;
+  }
+
+  uint32_t available;
+  uint64_t desired;
+  do {
+    std::memcpy(&state, &expected, sizeof(state));
+    if (state.version != version || state.page_elements_available < records_count) {
+      exit_writer(record, reservation.writer);
+      return false;
+    }
+    available = state.page_elements_available;
+    state.page_elements_available -= records_count;
+    std::memcpy(&desired, &state, sizeof(desired));
+  } while (!__atomic_compare_exchange_n(page_reservation, &expected, desired, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+  reservation.element_idx = max_elements_in_page - available;
+  reservation.version = version;
+  return true;
+}
+
+//-----------------------------------------------------
+// write_records
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::write_records(uint16_t page_id, const ElementsReservation& reservation,
+                                     const ELEMENT_T* records, uint32_t records_count) {
+  auto& index_record = table_index.shared_elements[page_id];
+  // page is not reused or removed while its reserved elements are not written,
+  // only cleanup() changes it under the writer. reserved elements are not ours then
+  bool written = false;
+  if (__atomic_load_n(&index_record.version, __ATOMIC_SEQ_CST) == reservation.version) {
+    // we have page and position to insert let's find page in local heap or allocate it
+    const auto page = getPageById(page_id);
+    const uint32_t insert_element_idx = reservation.element_idx;
+    if (layout == PageLayout::COLUMNS) {
+      auto columns = page->getColumns(max_elements_in_page);
+      for (uint32_t idx = 0; idx < records_count; ++idx) {
+        columns.set_element(insert_element_idx + idx, records[idx]);
+      }
+    } else {
+      std::memcpy(&page->shared_elements[insert_element_idx], records,
+                  sizeof(ELEMENT_T) * records_count);
+    }
+    // written elements of other page version must not be counted
+    written = __atomic_load_n(&index_record.version, __ATOMIC_SEQ_CST) == reservation.version;
+    if (written) {
+      commit_elements(index_record, records_count);
+    }
+  }
+  exit_writer(index_record, reservation.writer);
+  return written;
+}
+
+//-----------------------------------------------------
+// commit_elements
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::commit_elements(TablePageIndexElement& record, uint32_t records_count) {
+  const uint32_t written =
+      __atomic_add_fetch(&record.page_elements_written, records_count, __ATOMIC_ACQ_REL);
+  const uint32_t reserved =
+      max_elements_in_page - __atomic_load_n(&record.page_elements_available, __ATOMIC_ACQUIRE);
+
+  // nobody is writing into the page right now, so all reserved elements are written.
+  // otherwise the last of the writers commits them, writers never wait for each other
+  if (written == reserved) {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    atomic_store_max(record.page_elements_committed, written);
   }
 }
 
 //-----------------------------------------------------
-// localGetPageByName
+// commit_stalled_elements
 //-----------------------------------------------------
 template <typename ELEMENT_T>
-SharedMemoryPage<ELEMENT_T>* Table<ELEMENT_T>::localGetPageByName(const std::string& page_to_look) {
-  for (const auto& page : opened_pages_list) {
-    if (page->page_name == page_to_look) {
-      return page;
+void Table<ELEMENT_T>::commit_stalled_elements(uint16_t page_id) {
+  auto& record = table_index.shared_elements[page_id];
+  const uint32_t written = __atomic_load_n(&record.page_elements_written, __ATOMIC_ACQUIRE);
+  const uint32_t reserved =
+      max_elements_in_page - __atomic_load_n(&record.page_elements_available, __ATOMIC_ACQUIRE);
+
+  if (written == reserved) {
+    stalled_written[page_id] = UINT64_MAX;
+    return;
+  }
+  // something is reserved and nobody finished a write into the same page since previous check
+  const uint64_t state = ((uint64_t)__atomic_load_n(&record.version, __ATOMIC_ACQUIRE) << 32) + written;
+  if (state == stalled_written[page_id]) {
+    // writers of reserved elements were registered before reservation. slow writer that
+    // is alive could still copy into them, the page waits for it
+    bool writers_alive = false;
+    for (auto& writer : record.writers) {
+      pid_t pid = __atomic_load_n(&writer, __ATOMIC_SEQ_CST);
+      if (pid == 0) {
+        continue;
+      }
+      if (isProcessAlive(pid)) {
+        writers_alive = true;
+      } else {
+        __atomic_compare_exchange_n(&writer, &pid, 0, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+      }
+    }
+    if (writers_alive) {
+      return;
+    }
+    std::cerr << "ERROR Table::commit_stalled_elements (" << table_name << ") page:" << page_id
+              << " written:" << written << " reserved:" << reserved << std::endl;
+    uint32_t expected = written;
+    if (__atomic_compare_exchange_n(&record.page_elements_written, &expected, reserved, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      atomic_store_max(record.page_elements_committed, reserved);
     }
+    stalled_written[page_id] = UINT64_MAX;
+    return;
   }
-  return nullptr;
+  stalled_written[page_id] = state;
 }
 
 //-----------------------------------------------------
-// getPagesByName
+// enter_writer
 //-----------------------------------------------------
 template <typename ELEMENT_T>
-SharedMemoryPage<ELEMENT_T>* Table<ELEMENT_T>::getPageByName(const std::string& page_to_look) {
-  auto page = localGetPageByName(page_to_look);
+bool Table<ELEMENT_T>::enter_writer(TablePageIndexElement& record, uint16_t& writer) {
+  const pid_t pid = getpid();
+  for (writer = 0; writer < MEMPAGE_PAGE_WRITERS; ++writer) {
+    pid_t expected = 0;
+    if (__atomic_load_n(&record.writers[writer], __ATOMIC_RELAXED) == 0 &&
+        __atomic_compare_exchange_n(&record.writers[writer], &expected, pid, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//-----------------------------------------------------
+// exit_writer
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::exit_writer(TablePageIndexElement& record, uint16_t writer) {
+  __atomic_store_n(&record.writers[writer], 0, __ATOMIC_SEQ_CST);
+}
+
+//-----------------------------------------------------
+// begin_page_change
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::begin_page_change(TablePageIndexElement& record) {
+  __atomic_add_fetch(&record.version, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------------
+// end_page_change
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::end_page_change(TablePageIndexElement& record) {
+  __atomic_add_fetch(&record.version, 1, __ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------------
+// begin_page_reuse
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::begin_page_reuse(TablePageIndexElement& record) {
+  begin_page_change(record);
+  // nothing is reserved with odd version, count of reserved elements is final
+  const uint32_t written = __atomic_load_n(&record.page_elements_written, __ATOMIC_SEQ_CST);
+  const uint32_t reserved =
+      max_elements_in_page - __atomic_load_n(&record.page_elements_available, __ATOMIC_SEQ_CST);
+  if (written == reserved) {
+    return true;
+  }
+  // page is not changed: its writers and readers see the version they started with
+  __atomic_sub_fetch(&record.version, 1, __ATOMIC_SEQ_CST);
+  return false;
+}
+
+//-----------------------------------------------------
+// read_index_record
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::read_index_record(const TablePageIndexElement& record,
+                                         TablePageIndexElement& snapshot) const {
+  for (uint16_t attempt = 0; attempt < MEMPAGE_SEQLOCK_RETRIES; ++attempt) {
+    const uint32_t version = __atomic_load_n(&record.version, __ATOMIC_ACQUIRE);
+    if (version % 2) {
+      sched_yield();
+      continue;
+    }
+
+    snapshot.expire_at = __atomic_load_n(&record.expire_at, __ATOMIC_RELAXED);
+    // summary is widened before elements are committed, so it is read after committed count
+    snapshot.page_elements_committed =
+        __atomic_load_n(&record.page_elements_committed, __ATOMIC_ACQUIRE);
+    for (uint16_t field = 0; field < MEMPAGE_SUMMARY_FIELDS; ++field) {
+      snapshot.summary.fields[field].min =
+          __atomic_load_n(&record.summary.fields[field].min, __ATOMIC_RELAXED);
+      snapshot.summary.fields[field].max =
+          __atomic_load_n(&record.summary.fields[field].max, __ATOMIC_RELAXED);
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&record.version, __ATOMIC_RELAXED) == version) {
+      snapshot.version = version;
+      return true;
+    }
+  }
+  return false;
+}
+
+//-----------------------------------------------------
+// getPageById | page is mapped once per process and kept until it is unlinked
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+SharedMemoryPage<ELEMENT_T>* Table<ELEMENT_T>::getPageById(uint16_t page_id) {
+  if (page_id >= table_max_pages) {
+    throw types::Error("getPageById::WRONG_PAGE_ID\n", types::ErrorCode::InternalError);
+  }
+
+  auto& page = opened_pages[page_id];
+  if (storage == PageStorage::ARENA) {
+    // arena is mapped already, page is a view into it
+    if (page == nullptr) {
+      page = new SharedMemoryPage<ELEMENT_T>{get_page_name(page_id), max_elements_in_page, layout,
+                                             arena->get_region(page_id), page_memory_size};
+    }
+    return page;
+  }
+
+  // slot was reused by a new page after the old one was unlinked
+  if (page != nullptr && page->shared_pageinfo->unlinked) {
+    release_page(page_id);
+  }
 
   if (page == nullptr) {
-    page = new SharedMemoryPage<ELEMENT_T>{page_to_look, max_elements_in_page};
-    opened_pages_list.push_back(page);
+    page = new SharedMemoryPage<ELEMENT_T>{get_page_name(page_id), max_elements_in_page, layout};
   }
 
   return page;
 }
 
+//-----------------------------------------------------
+// remove_page | processes holding the page release it on next expiration check
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::remove_page(uint16_t page_id) {
+  if (storage == PageStorage::ARENA) {
+    // page memory is zeroed for everyone, page views stay valid
+    arena->release_region(page_id);
+    return;
+  }
+
+  const auto page = getPageById(page_id);
+  page->shared_pageinfo->unlinked = true;
+  SharedMemoryPage<ELEMENT_T>::unlink(page->page_name);
+}
+
+//-----------------------------------------------------
+// release_page
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::release_page(uint16_t page_id) {
+  auto& page = opened_pages[page_id];
+  if (page != nullptr) {
+    delete page;
+    page = nullptr;
+  }
+}
+
+//-----------------------------------------------------
+// get_page_name | page name is table name and page position in index
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+std::string Table<ELEMENT_T>::get_page_name(uint16_t page_id) const {
+  return table_index.page_name + ":" + std::to_string(page_id);
+}
+
 //------------------------------------------------------------------
 // release_expired_memory_pages | auto release Table expired memory
 //------------------------------------------------------------------
@@ -323,11 +1062,12 @@ void Table<ELEMENT_T>::release_expired_memory_pages() {
   }
   time_to_check_page_expire = current_time + MEMPAGE_CHECK_EXPIRED_PAGES_INTERVAL_SEC;
 
-  lock.enter();
+  // readers don't wait for the lock: if it is taken maintenance is done next time
+  const bool locked = lock.try_enter();
   locks::AutoCloser guard(lock);
 
   // check shared timer, only one process should perform maintenance
-  if (table_index.shared_pageinfo->expiration_check <= current_time) {
+  if (locked && table_index.shared_pageinfo->expiration_check <= current_time) {
     uint16_t idx = 0;
     uint16_t last_data_idx = 0;
 
@@ -355,6 +1095,7 @@ void Table<ELEMENT_T>::release_expired_memory_pages() {
       if (index_record.expire_at == 0) {
         break;
       }
+      commit_stalled_elements(idx);
     }
 
     uint16_t cleared_counter = 0;
@@ -364,11 +1105,13 @@ void Table<ELEMENT_T>::release_expired_memory_pages() {
     if (idx > 0 && last_data_idx < --idx) {
       for (; last_data_idx < idx; idx--) {
         auto& index_record = table_index.shared_elements[idx];
-        const auto page = getPageByName(index_record.page_name);
-        page->shared_pageinfo->unlinked = true;
-        SharedMemoryPage<ELEMENT_T>::unlink(page->page_name);
+        if (!begin_page_reuse(index_record)) {
+          break;
+        }
+        remove_page(idx);
 
         clear_index_record_full(index_record);
+        end_page_change(index_record);
         // clear only certain portion per time;
         if (MEMPAGE_REMOVE_EXPIRED_PAGES_AT_ONCE <= ++cleared_counter) {
           break;
@@ -379,17 +1122,14 @@ void Table<ELEMENT_T>::release_expired_memory_pages() {
 
   lock.exit();
 
-  // clear opened_pages_list from unlinked items, all processes must do that
-  std::vector<SharedMemoryPage<ELEMENT_T>*> new_pages_list;
-  for (auto page : opened_pages_list) {
-    if (page->shared_pageinfo->unlinked) {
+  // release unlinked pages mapped by this process, all processes must do that
+  for (uint16_t page_id = 0; page_id < table_max_pages; ++page_id) {
+    const auto page = opened_pages[page_id];
+    if (page != nullptr && page->shared_pageinfo->unlinked) {
       std::cout << "RELEASING unlinked page:" << page->page_name << std::endl;
-      delete page;
-    } else {
-      new_pages_list.push_back(page);
+      release_page(page_id);
     }
   }
-  opened_pages_list = std::move(new_pages_list);
 }
 
 //-----------------------------------------------------------
@@ -410,8 +1150,9 @@ void Table<ELEMENT_T>::update_global_expire(uint32_t value) {
 // SharedMemoryPage Constructor
 //------------------------------------------------------------
 template <typename ELEMENT_T>
-SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t elements)
-    : page_name(page_name), shared_memory(nullptr) {
+SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t elements,
+                                              PageLayout layout)
+    : page_name(page_name), page_elements(elements), layout(layout), shared_memory(nullptr) {
   //
   if (page_name.length() == 0) {
     std::cout << "ERROR SharedMemoryPage::SharedMemoryPage EMPTY_PAGE_NAME" << std::endl;
@@ -432,9 +1173,7 @@ SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t el
   cslock.enter();  // <= will auto exited on class destruction
 
   bool new_memory_allocated = false;
-  page_memory_size = sizeof(Page_information) + sizeof(ELEMENT_T) * elements;
-  uint32_t aligned_pages = page_memory_size / sysconf(_SC_PAGE_SIZE);
-  page_memory_size = (aligned_pages + 1) * sysconf(_SC_PAGE_SIZE);
+  page_memory_size = get_memory_size(elements, layout);
 
   // try to create page
   int fd = shm_open(page_name.c_str(), O_RDWR | O_CREAT | O_EXCL, (mode_t)0666);
@@ -475,10 +1214,19 @@ SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t el
   fstat(fd, &buf);
   int size = buf.st_size;
 
+  // zero size: creator died before ftruncate, page is not used by anyone
+  if (size == 0) {
+    std::cerr << "ERROR SharedMemoryPage::SharedMemoryPage zero size (" << page_name
+              << ") REMOVING..." << std::endl;
+    shm_unlink(page_name.c_str());
+    close(fd);
+    throw types::Error("ERR_WRONG_SHMEM_PAGE_SIZE\n", types::ErrorCode::InternalError);
+  }
+  // other size: page is used by process with other layout (rolling restart),
+  // it must not be removed under that process
   if (size != page_memory_size) {
     std::cerr << "ERROR SharedMemoryPage::SharedMemoryPage size != page_memory_size (" << page_name
-              << ") " << size << " != " << page_memory_size << " REMOVING..." << std::endl;
-    shm_unlink(page_name.c_str());
+              << ") " << size << " != " << page_memory_size << std::endl;
     close(fd);
     throw types::Error("ERR_WRONG_SHMEM_PAGE_SIZE\n", types::ErrorCode::InternalError);
   }
@@ -499,6 +1247,8 @@ SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t el
   shared_memory = map;
   shared_pageinfo = (Page_information*)shared_memory;
   shared_elements = (ELEMENT_T*)((uint8_t*)shared_memory + sizeof(Page_information));
+  // columns are aligned relative to the page data start
+  static_assert(sizeof(Page_information) % sizeof(uint32_t) == 0, "PAGE DATA ALIGNMENT");
 
   if (new_memory_allocated) {
     memset(shared_memory, 0, page_memory_size);
@@ -507,6 +1257,44 @@ SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t el
   }
 };
 
+//------------------------------------------------------------
+// SharedMemoryPage Constructor (page inside arena)
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t elements,
+                                              PageLayout layout, uint8_t* memory,
+                                              uint32_t memory_size)
+    : page_name(page_name),
+      page_memory_size(memory_size),
+      page_elements(elements),
+      layout(layout),
+      shared_memory(nullptr) {
+  // arena memory is zeroed, so new page has unlinked = false & expiration_check = 0
+  shared_pageinfo = (Page_information*)memory;
+  shared_elements = (ELEMENT_T*)(memory + sizeof(Page_information));
+}
+
+//------------------------------------------------------------
+// get_data_size | page header and elements
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+uint32_t SharedMemoryPage<ELEMENT_T>::get_data_size(uint32_t elements, PageLayout layout) {
+  if (layout == PageLayout::COLUMNS) {
+    return sizeof(Page_information) + PageColumns<ELEMENT_T>::get_page_data_size(elements);
+  }
+  return sizeof(Page_information) + sizeof(ELEMENT_T) * elements;
+}
+
+//------------------------------------------------------------
+// get_memory_size | page header and elements, aligned to system page
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+uint32_t SharedMemoryPage<ELEMENT_T>::get_memory_size(uint32_t elements, PageLayout layout) {
+  uint32_t memory_size = get_data_size(elements, layout);
+  uint32_t aligned_pages = memory_size / sysconf(_SC_PAGE_SIZE);
+  return (aligned_pages + 1) * sysconf(_SC_PAGE_SIZE);
+}
+
 //------------------------------------------------------------
 // SharedMemoryPage Destructor
 //------------------------------------------------------------
@@ -533,13 +1321,280 @@ ELEMENT_T* SharedMemoryPage<ELEMENT_T>::getElements() {
   return shared_elements;
 }
 
+//------------------------------------------------------------
+// exists
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+bool SharedMemoryPage<ELEMENT_T>::exists(std::string page_name) {
+  int fd = shm_open(page_name.c_str(), O_RDONLY, 0);
+  if (fd == -1) {
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+//------------------------------------------------------------
+// getColumns
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+PageColumns<ELEMENT_T> SharedMemoryPage<ELEMENT_T>::getColumns(uint32_t size) {
+  return PageColumns<ELEMENT_T>{(uint8_t*)shared_elements, page_elements, size};
+}
+
+/*-----------------------------------------------------------------
+* PAGE COLUMNS
+*-----------------------------------------------------------------*/
+//------------------------------------------------------------
+// PageColumns Constructor
+//------------------------------------------------------------
+// [column0: max_elements * size0][align][column1: max_elements * size1][align]...
+template <typename ELEMENT_T>
+PageColumns<ELEMENT_T>::PageColumns(uint8_t* page_data, uint32_t max_elements, uint32_t size)
+    : size(size) {
+  static_assert(PageColumnsTraits<ELEMENT_T>::count <= MEMPAGE_MAX_COLUMNS, "TOO MANY COLUMNS");
+  const auto description = PageColumnsTraits<ELEMENT_T>::get_columns();
+  uint32_t offset = 0;
+
+  for (uint16_t column = 0; column < PageColumnsTraits<ELEMENT_T>::count; ++column) {
+    columns[column] = page_data + offset;
+    offset += description[column].size * max_elements;
+    offset = (offset + MEMPAGE_COLUMN_ALIGN - 1) / MEMPAGE_COLUMN_ALIGN * MEMPAGE_COLUMN_ALIGN;
+  }
+}
+
+//------------------------------------------------------------
+// get_page_data_size
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+uint32_t PageColumns<ELEMENT_T>::get_page_data_size(uint32_t max_elements) {
+  const auto description = PageColumnsTraits<ELEMENT_T>::get_columns();
+  uint32_t offset = 0;
+
+  for (uint16_t column = 0; column < PageColumnsTraits<ELEMENT_T>::count; ++column) {
+    offset += description[column].size * max_elements;
+    offset = (offset + MEMPAGE_COLUMN_ALIGN - 1) / MEMPAGE_COLUMN_ALIGN * MEMPAGE_COLUMN_ALIGN;
+  }
+  return offset;
+}
+
+//------------------------------------------------------------
+// get
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+template <typename FIELD_T>
+const FIELD_T* PageColumns<ELEMENT_T>::get(uint16_t column) const {
+  return (const FIELD_T*)columns[column];
+}
+
+//------------------------------------------------------------
+// get_element
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+void PageColumns<ELEMENT_T>::get_element(uint32_t idx, ELEMENT_T& element) const {
+  const auto description = PageColumnsTraits<ELEMENT_T>::get_columns();
+
+  for (uint16_t column = 0; column < PageColumnsTraits<ELEMENT_T>::count; ++column) {
+    const auto& field = description[column];
+    uint8_t* to = (uint8_t*)&element + field.offset;
+    const uint8_t* from = columns[column] + idx * field.size;
+    // constant sizes let compiler replace memcpy with single mov
+    switch (field.size) {
+      case 1:
+        std::memcpy(to, from, 1);
+        break;
+      case 2:
+        std::memcpy(to, from, 2);
+        break;
+      case 4:
+        std::memcpy(to, from, 4);
+        break;
+      case 8:
+        std::memcpy(to, from, 8);
+        break;
+      default:
+        std::memcpy(to, from, field.size);
+    }
+  }
+}
+
+//------------------------------------------------------------
+// set_element
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+void PageColumns<ELEMENT_T>::set_element(uint32_t idx, const ELEMENT_T& element) {
+  const auto description = PageColumnsTraits<ELEMENT_T>::get_columns();
+
+  for (uint16_t column = 0; column < PageColumnsTraits<ELEMENT_T>::count; ++column) {
+    const auto& field = description[column];
+    std::memcpy(columns[column] + idx * field.size, (uint8_t*)&element + field.offset, field.size);
+  }
+}
+
+//------------------------------------------------------------
+// update_element
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+void PageColumns<ELEMENT_T>::update_element(uint32_t idx, const ELEMENT_T& element) {
+  const auto description = PageColumnsTraits<ELEMENT_T>::get_columns();
+
+  for (uint16_t column = 0; column < PageColumnsTraits<ELEMENT_T>::count; ++column) {
+    const auto& field = description[column];
+    atomic_store_field(columns[column] + idx * field.size, (const uint8_t*)&element + field.offset,
+                       field.size);
+  }
+}
+
 /*-----------------------------------------------------------------
 * ElementExtractor get_element_data
 *-----------------------------------------------------------------*/
 template <typename ELEMENT_T>
 ELEMENT_T* ElementExtractor<ELEMENT_T>::get_element_data() {
-  const auto page = table.getPageByName(page_name);
+  if (table.layout == PageLayout::COLUMNS) {
+    throw types::Error("COLUMNS_PAGE_HAS_NO_ELEMENT_POINTER\n", types::ErrorCode::InternalError);
+  }
+  const auto page = table.getPageById(page_id);
   return page->getElements() + index;
 }
 
+/*-----------------------------------------------------------------
+* LEGACY TABLE
+*-----------------------------------------------------------------*/
+
+//------------------------------------------------------------
+// LegacyTable Constructor
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+LegacyTable<ELEMENT_T>::LegacyTable(std::string table_name, uint16_t table_max_pages,
+                                    uint32_t max_elements_in_page)
+    : lock{table_name},
+      table_index{table_name},
+      opened_pages(table_max_pages),
+      table_name{table_name},
+      table_max_pages(table_max_pages),
+      max_elements_in_page(max_elements_in_page) {
+  static_assert(sizeof(IndexElement) == 28, "legacy index layout must not be changed");
+  static_assert(sizeof(PageInformation) == 8, "legacy page layout must not be changed");
+
+  if (!table_index.open(get_memory_size(table_max_pages, sizeof(IndexElement)))) {
+    throw types::Error("LEGACY_TABLE_NOT_FOUND\n", types::ErrorCode::InternalError);
+  }
+  std::cout << "LegacyTable::LegacyTable (" << table_name << ") OK" << std::endl;
+}
+
+//------------------------------------------------------------
+// processRecords
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+void LegacyTable<ELEMENT_T>::processRecords(TableProcessor<ELEMENT_T>& processor,
+                                            uint32_t global_expire_at) {
+  uint32_t timestamp_now = timing::getTimestampSec();
+  // page id and count of its elements
+  std::vector<std::pair<uint16_t, uint32_t>> pages_to_scan;
+
+  lock.enter();
+  locks::AutoCloser guard(lock);
+
+  const auto index = get_index();
+  for (uint16_t idx = 0; idx < table_max_pages; ++idx) {
+    const IndexElement& record = index[idx];
+    if (record.expire_at == 0) {
+      break;
+    }
+    if (record.expire_at > timestamp_now && record.expire_at > global_expire_at &&
+        record.page_elements_available <= max_elements_in_page) {
+      pages_to_scan.emplace_back(idx, max_elements_in_page - record.page_elements_available);
+    }
+  }
+
+  lock.exit();
+
+  for (const auto& page : pages_to_scan) {
+    const auto elements = getRecords(page.first, 0, page.second);
+    if (elements != nullptr) {
+      processor.process_rows(elements, page.second);
+    }
+  }
+}
+
+//------------------------------------------------------------
+// getRecords
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+const ELEMENT_T* LegacyTable<ELEMENT_T>::getRecords(uint16_t page_id, uint32_t index,
+                                                    uint32_t size) {
+  if (page_id >= table_max_pages || (uint64_t)index + size > max_elements_in_page) {
+    return nullptr;
+  }
+
+  auto& page = opened_pages[page_id];
+  if (!page) {
+    page.reset(new SharedMemoryView{get_page_name(page_id)});
+    if (!page->open(get_memory_size(max_elements_in_page, sizeof(ELEMENT_T)))) {
+      page.reset();
+      return nullptr;
+    }
+  }
+
+  const auto page_info = (const PageInformation*)page->get_memory();
+  if (page_info->unlinked) {
+    return nullptr;
+  }
+  return (const ELEMENT_T*)(page->get_memory() + sizeof(PageInformation)) + index;
+}
+
+//------------------------------------------------------------
+// drop
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+void LegacyTable<ELEMENT_T>::drop() {
+  lock.enter();
+  locks::AutoCloser guard(lock);
+
+  const auto index = get_index();
+  for (uint16_t idx = 0; idx < table_max_pages && index[idx].expire_at != 0; ++idx) {
+    const auto page_name = get_page_name(idx);
+    std::cout << "UNLINK: " << page_name << std::endl;
+    shm_unlink(page_name.c_str());
+  }
+  std::cout << "UNLINK: " << table_name << std::endl;
+  shm_unlink(table_name.c_str());
+
+  lock.exit();
+}
+
+//------------------------------------------------------------
+// exists
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+bool LegacyTable<ELEMENT_T>::exists(const std::string& table_name) {
+  return SharedMemoryPage<IndexElement>::exists(table_name);
+}
+
+//------------------------------------------------------------
+// get_memory_size
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+size_t LegacyTable<ELEMENT_T>::get_memory_size(uint32_t elements, size_t element_size) {
+  size_t memory_size = sizeof(PageInformation) + element_size * elements;
+  size_t aligned_pages = memory_size / sysconf(_SC_PAGE_SIZE);
+  return (aligned_pages + 1) * sysconf(_SC_PAGE_SIZE);
+}
+
+//------------------------------------------------------------
+// get_index
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+const typename LegacyTable<ELEMENT_T>::IndexElement* LegacyTable<ELEMENT_T>::get_index() const {
+  return (const IndexElement*)(table_index.get_memory() + sizeof(PageInformation));
+}
+
+//------------------------------------------------------------
+// get_page_name
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+std::string LegacyTable<ELEMENT_T>::get_page_name(uint16_t page_id) const {
+  return table_name + ":" + std::to_string(page_id);
+}
+
 }  // namespace shared_mem
@@ -1,9 +1,35 @@
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
+#include <cerrno>
+#include <cstring>
 
 #include "tcp_server.hpp"
+#include "uring_backend.hpp"
 
 namespace srv {
+namespace {
+bool io_uring = false;
+}  // namespace
+
+void setIoUring(bool enabled) {
+  io_uring = enabled;
+}
+
+/*----------------------------------------------------------------------
+* createNetBackend
+*----------------------------------------------------------------------*/
+std::unique_ptr<NetBackend> createNetBackend() {
+#ifdef __linux__
+  if (io_uring) {
+    std::unique_ptr<NetBackend> backend{UringBackend::create()};
+    if (backend) {
+      return backend;
+    }
+    std::cerr << "WARNING io_uring backend is not available, epoll is used" << std::endl;
+  }
+#endif
+  return std::unique_ptr<NetBackend>{new Poller()};
+}
 
 /*----------------------------------------------------------------------
 * TCPConnection Constructor
@@ -31,6 +57,18 @@ TCPConnection::TCPConnection(const int accept_sockfd)
   connection_alive = true;
 }
 
+/*----------------------------------------------------------------------
+* TCPConnection Constructor (accepted socket)
+*----------------------------------------------------------------------*/
+TCPConnection::TCPConnection(const int sockfd, const struct sockaddr_in &addr)
+    : created_time(timing::getTimestampSec()),
+      last_beat_time(created_time),
+      sockfd(sockfd),
+      cli_addr(addr),
+      clilen(sizeof(addr)),
+      connection_alive(true) {
+}
+
 /*----------------------------------------------------------------------
 * TCPConnection Destructor
 *----------------------------------------------------------------------*/
@@ -44,40 +82,44 @@ TCPConnection::~TCPConnection() {
 /*----------------------------------------------------------------------
 * TCPConnection Read
 *----------------------------------------------------------------------*/
+// short read means the socket is empty, the next data is a new edge
 void TCPConnection::network_read() {
-  int count;
-  int res;
-
-  res = ioctl(sockfd, FIONREAD, &count);
-  if (res != 0) {
-    std::cerr << "ERROR TCPConnection::network_read:: ioctl, errno:" << errno << std::endl;
-    close();  // close connection
-    return;
-  }
-
-  if (count == 0) {
-    std::cerr << "ERROR TCPConnection::network_read:: count == 0" << std::endl;
-    close();  // close connection
-    return;
-  }
+  data_in.clear();
+  char buf[NET_READ_BUFFER_SIZE];
+
+  while (true) {
+    ssize_t res = recv(sockfd, &buf, sizeof(buf), MSG_DONTWAIT);
+
+    if (res > 0) {
+      data_in.append(buf, res);
+      if (res < (ssize_t)sizeof(buf)) {
+        break;
+      }
+      continue;
+    }
 
-  char buf[count];
-  res = recv(sockfd, &buf, count, MSG_DONTWAIT);
+    if (res == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        std::cerr << "ERROR TCPConnection::network_read::recv, errno:" << errno << std::endl;
+        close();  // close connection
+      }
+      break;
+    }
 
-  if (res == -1) {
-    std::cerr << "ERROR TCPConnection::network_read::recv, errno:" << errno << std::endl;
+    // res == 0, request read before is answered anyway
+    if (data_in.size() == 0) {
+      std::cerr << "ERROR TCPConnection::network_read::recv, res == 0:" << std::endl;
+    }
     close();  // close connection
-    return;
+    break;
   }
 
-  if (res == 0) {
-    std::cerr << "ERROR TCPConnection::network_read::recv, res == 0:" << std::endl;
-    close();  // close connection
-    return;
+  if (data_in.size() > 0) {
+    last_beat_time = timing::getTimestampSec();
   }
-
-  last_beat_time = timing::getTimestampSec();
-  data_in = std::string(buf, res);
 }
 
 /*----------------------------------------------------------------------
@@ -126,6 +168,10 @@ void TCPConnection::network_write() {
   // send data without chunking
   ssize_t res = send(sockfd, data_out.c_str(), data_out.length(), MSG_DONTWAIT);
 
+  if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;  // socket buffer is full
+  }
+
   if (res == -1 || res == 0) {
     std::cout << get_client_address()
               << " ERROR on send network_write(), data.length:" << data_out.length()
@@ -135,10 +181,32 @@ void TCPConnection::network_write() {
     return;
   }
 
-  data_out.clear();
+  network_sent(res);
 #endif
 }
 
+/*----------------------------------------------------------------------
+* TCPConnection received
+*----------------------------------------------------------------------*/
+void TCPConnection::network_received(const char *data, size_t size) {
+  data_in.assign(data, size);
+  if (size > 0) {
+    last_beat_time = timing::getTimestampSec();
+  }
+}
+
+/*----------------------------------------------------------------------
+* TCPConnection sent
+*----------------------------------------------------------------------*/
+void TCPConnection::network_sent(size_t size) {
+  last_beat_time = timing::getTimestampSec();
+  data_out.erase(0, size);
+  // closed connection is deleted after the last byte
+  if (data_out.length() == 0 && !connection_alive) {
+    mark_changed();
+  }
+}
+
 /*----------------------------------------------------------------------
 * TCPConnection close
 *----------------------------------------------------------------------*/
@@ -146,6 +214,13 @@ const std::string &TCPConnection::get_data() {
   return data_in;
 }
 
+/*----------------------------------------------------------------------
+* TCPConnection get_output
+*----------------------------------------------------------------------*/
+const std::string &TCPConnection::get_output() {
+  return data_out;
+}
+
 /*----------------------------------------------------------------------
 * TCPConnection is_alive
 *----------------------------------------------------------------------*/
@@ -171,6 +246,7 @@ void TCPConnection::reset() {
 void TCPConnection::close() {
   // dont close right here, because it could be outgoung write data in the buffer
   connection_alive = false;
+  mark_changed();
 }
 
 /*----------------------------------------------------------------------
@@ -186,6 +262,33 @@ void TCPConnection::close(const std::string msg) {
 *----------------------------------------------------------------------*/
 void TCPConnection::write(const std::string out) {
   data_out += out;
+  mark_changed();
+}
+
+/*----------------------------------------------------------------------
+* Connection track_changes
+*----------------------------------------------------------------------*/
+void TCPConnection::track_changes(std::vector<TCPConnection *> *list) {
+  changes = list;
+}
+
+/*----------------------------------------------------------------------
+* Connection mark_changed
+*----------------------------------------------------------------------*/
+void TCPConnection::mark_changed() {
+  if (changes != nullptr && !changed) {
+    changed = true;
+    changes->push_back(this);
+  }
+}
+
+/*----------------------------------------------------------------------
+* Connection expiration_time
+*----------------------------------------------------------------------*/
+uint32_t TCPConnection::expiration_time() const {
+  return std::min(created_time + MAX_CONNECTION_LIFETIME_SEC,
+                  last_beat_time + MAX_CONNECTION_IDLE_TIME_SEC) +
+         1;
 }
 
 /*----------------------------------------------------------------------
@@ -209,6 +312,228 @@ std::string TCPConnection::get_client_address() {
   return inet_addr_to_string(cli_addr);
 }
 
+/*----------------------------------------------------------------------
+* ConnectionTimers constructor
+*----------------------------------------------------------------------*/
+ConnectionTimers::ConnectionTimers() : current(timing::getTimestampSec()) {
+  std::fill(slots, slots + TIMER_WHEEL_SLOTS, nullptr);
+}
+
+/*----------------------------------------------------------------------
+* ConnectionTimers add
+*----------------------------------------------------------------------*/
+void ConnectionTimers::add(TCPConnection &conn) {
+  insert(conn, conn.expiration_time());
+}
+
+/*----------------------------------------------------------------------
+* ConnectionTimers insert
+*----------------------------------------------------------------------*/
+void ConnectionTimers::insert(TCPConnection &conn, uint32_t deadline) {
+  auto &head = slots[deadline % TIMER_WHEEL_SLOTS];
+  conn.timer_deadline = deadline;
+  conn.timer_prev = nullptr;
+  conn.timer_next = head;
+  if (head != nullptr) {
+    head->timer_prev = &conn;
+  }
+  head = &conn;
+}
+
+/*----------------------------------------------------------------------
+* ConnectionTimers remove
+*----------------------------------------------------------------------*/
+void ConnectionTimers::remove(TCPConnection &conn) {
+  if (conn.timer_prev != nullptr) {
+    conn.timer_prev->timer_next = conn.timer_next;
+  } else {
+    slots[conn.timer_deadline % TIMER_WHEEL_SLOTS] = conn.timer_next;
+  }
+  if (conn.timer_next != nullptr) {
+    conn.timer_next->timer_prev = conn.timer_prev;
+  }
+  conn.timer_prev = nullptr;
+  conn.timer_next = nullptr;
+}
+
+/*----------------------------------------------------------------------
+* ConnectionTimers expire
+*----------------------------------------------------------------------*/
+void ConnectionTimers::expire(uint32_t now, const std::string &server_address) {
+  if (now <= current) {
+    return;
+  }
+  // process that stalled for a long time looks through every slot once
+  uint32_t steps = std::min<uint32_t>(now - current, TIMER_WHEEL_SLOTS);
+  current = now;
+
+  for (uint32_t second = now - steps + 1; steps > 0; --steps, ++second) {
+    // connections are moved from slot list, the ones which don't expire come back
+    auto conn = slots[second % TIMER_WHEEL_SLOTS];
+    slots[second % TIMER_WHEEL_SLOTS] = nullptr;
+
+    while (conn != nullptr) {
+      auto &expiring = *conn;
+      conn = conn->timer_next;
+
+      const uint32_t deadline = expiring.expiration_time();
+      if (deadline > now) {
+        insert(expiring, deadline);
+        continue;
+      }
+
+      if (now - expiring.created_time > MAX_CONNECTION_LIFETIME_SEC) {
+        std::cerr << server_address
+                  << " ERROR MAX_CONNECTION_LIFETIME_SEC:" << MAX_CONNECTION_LIFETIME_SEC
+                  << std::endl;
+      } else {
+        std::cerr << server_address
+                  << " ERROR MAX_CONNECTION_IDLE_TIME_SEC:" << MAX_CONNECTION_IDLE_TIME_SEC
+                  << std::endl;
+      }
+      // closed connection which still can't send its response is dropped
+      if (!expiring.connection_alive) {
+        expiring.reset();
+      } else {
+        expiring.close();
+      }
+      // till server deletes it
+      insert(expiring, now + 1);
+    }
+  }
+}
+
+/*----------------------------------------------------------------------
+* Poller constructor
+*----------------------------------------------------------------------*/
+Poller::Poller() {
+#ifdef __linux__
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    std::cerr << "ERROR epoll_create1, errno:" << errno << std::endl;
+    std::exit(-1);
+  }
+#endif
+}
+
+/*----------------------------------------------------------------------
+* Poller destructor
+*----------------------------------------------------------------------*/
+Poller::~Poller() {
+#ifdef __linux__
+  ::close(epoll_fd);
+#endif
+}
+
+/*----------------------------------------------------------------------
+* Poller name
+*----------------------------------------------------------------------*/
+const char *Poller::name() const {
+#ifdef __linux__
+  return "epoll";
+#else
+  return "poll";
+#endif
+}
+
+/*----------------------------------------------------------------------
+* Poller listen
+*----------------------------------------------------------------------*/
+// listen socket is level triggered: one connection is accepted per tick
+void Poller::listen(int fd) {
+  add(fd, nullptr);
+}
+
+/*----------------------------------------------------------------------
+* Poller add
+*----------------------------------------------------------------------*/
+bool Poller::add(TCPConnection &conn) {
+  return add(conn.get_socket(), &conn);
+}
+
+bool Poller::add(int fd, TCPConnection *conn) {
+#ifdef __linux__
+  epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = conn != nullptr ? EPOLLIN | EPOLLOUT | EPOLLET : EPOLLIN;
+  event.data.ptr = conn;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+    std::cerr << "ERROR epoll_ctl(EPOLL_CTL_ADD), errno:" << errno << std::endl;
+    return false;
+  }
+#else
+  pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  fds.push_back(pfd);
+  conns.push_back(conn);
+#endif
+  return true;
+}
+
+/*----------------------------------------------------------------------
+* Poller release
+*----------------------------------------------------------------------*/
+void Poller::release(TCPConnection *conn) {
+#ifdef __linux__
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->get_socket(), nullptr);
+#else
+  for (size_t idx = 0; idx < conns.size(); ++idx) {
+    if (conns[idx] == conn) {
+      fds.erase(fds.begin() + idx);
+      conns.erase(conns.begin() + idx);
+      break;
+    }
+  }
+#endif
+  delete conn;
+}
+
+/*----------------------------------------------------------------------
+* Poller read
+*----------------------------------------------------------------------*/
+void Poller::read(TCPConnection &conn) {
+  conn.network_read();
+}
+
+/*----------------------------------------------------------------------
+* Poller write
+*----------------------------------------------------------------------*/
+void Poller::write(TCPConnection &conn) {
+  conn.network_write();
+}
+
+/*----------------------------------------------------------------------
+* Poller wait
+*----------------------------------------------------------------------*/
+int Poller::wait(std::vector<Event> &events, int timeout_ms) {
+  events.clear();
+#ifdef __linux__
+  int count = epoll_wait(epoll_fd, ready, EPOLL_MAX_EVENTS, timeout_ms);
+  for (int idx = 0; idx < count; ++idx) {
+    const auto flags = ready[idx].events;
+    events.push_back({(TCPConnection *)ready[idx].data.ptr, (flags & EPOLLIN) != 0,
+                      (flags & EPOLLOUT) != 0, (flags & (EPOLLHUP | EPOLLERR)) != 0, -1});
+  }
+#else
+  for (size_t idx = 0; idx < fds.size(); ++idx) {
+    fds[idx].events = POLLIN;
+    if (conns[idx] != nullptr && conns[idx]->has_something_to_send()) {
+      fds[idx].events |= POLLOUT;
+    }
+  }
+  int count = poll(fds.data(), fds.size(), timeout_ms);
+  for (size_t idx = 0; idx < fds.size() && count > 0; ++idx) {
+    const auto flags = fds[idx].revents;
+    if (flags != 0) {
+      events.push_back({conns[idx], (flags & POLLIN) != 0, (flags & POLLOUT) != 0,
+                        (flags & (POLLHUP | POLLERR)) != 0, -1});
+    }
+  }
+#endif
+  return count;
+}
+
 /*----------------------------------------------------------------------
 * inet_addr_to_string (mainly for printing)
 *----------------------------------------------------------------------*/
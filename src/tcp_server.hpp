@@ -1,8 +1,10 @@
 #ifndef SRC_TCP_SERVER_HPP
 #define SRC_TCP_SERVER_HPP
 
+#include <algorithm>
 #include <cinttypes>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include <arpa/inet.h>
@@ -11,6 +13,9 @@
 #include <netinet/in.h>
 #include <poll.h>
 #include <sys/socket.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #include <unistd.h>
 #include <strings.h>
 
@@ -44,19 +49,29 @@ io_handler close() do nothing, if all io_handkers closed -> connection->close()
 #define MAX_CONNECTION_LIFETIME_SEC 10
 #define MAX_CONNECTION_IDLE_TIME_SEC 2
 #define POLL_TIMEOUT_MS 3000
+#define NET_READ_BUFFER_SIZE 16384
+#define EPOLL_MAX_EVENTS 256
+// seconds, more than connection could live
+#define TIMER_WHEEL_SLOTS 16
 
 using NetData = std::string;  // net bytes is an std::string instance
 std::string inet_addr_to_string(struct sockaddr_in& hostaddr);
 
+// connections are served by io_uring backend if kernel allows it, epoll otherwise.
+// disabled by default
+void setIoUring(bool enabled);
+
 /*----------------------------------------------------------------------
 * TCPConnection
 *----------------------------------------------------------------------*/
 class TCPConnection {
  protected:
   TCPConnection(const int sockfd);
+  // socket accepted already (by io_uring)
+  TCPConnection(const int sockfd, const struct sockaddr_in& addr);
 
  public:
-  ~TCPConnection();
+  virtual ~TCPConnection();
 
   void close();
   void close(const std::string);
@@ -68,16 +83,34 @@ class TCPConnection {
   uint16_t get_socket();
 
   // -- actual net send/recv --
-  void network_read();
-  void network_write();
+  void network_read();   // socket is read until it is empty (edge triggered)
+  void network_write();  // the rest is sent on next write event
   void network_data_processed();
+  // same for backends which complete recv/send themselves
+  void network_received(const char* data, size_t size);
+  void network_sent(size_t size);
+  const std::string& get_output();
   std::string get_client_address();
+  // connection is listed in changes when it is written or closed
+  void track_changes(std::vector<TCPConnection*>* changes);
 
   const uint32_t created_time;
   uint32_t last_beat_time;
+  int32_t io_slot = -1;  // connection data of NetBackend
 
  private:
+  void mark_changed();
+  // second when MAX_CONNECTION_LIFETIME_SEC or MAX_CONNECTION_IDLE_TIME_SEC is exceeded
+  uint32_t expiration_time() const;
+
   std::string client_addr;
+  std::vector<TCPConnection*>* changes = nullptr;
+  bool changed = false;  // listed in changes already
+
+  // node of ConnectionTimers slot list
+  TCPConnection* timer_prev = nullptr;
+  TCPConnection* timer_next = nullptr;
+  uint32_t timer_deadline = 0;
 
   NetData data_in;
   NetData data_out;
@@ -86,6 +119,92 @@ class TCPConnection {
   struct sockaddr_in cli_addr;
   socklen_t clilen;
   bool connection_alive;
+
+  friend class ConnectionTimers;
+  template <typename Context>
+  friend class TCPServer;
+};
+
+/*----------------------------------------------------------------------
+* ConnectionTimers  timer wheel of connection limits
+*----------------------------------------------------------------------*/
+// connection is in the slot of the second it could expire at first, last beats
+// don't move it. slot of every passed second is checked: connection is closed
+// or moved to the slot of its actual expiration time
+class ConnectionTimers {
+ public:
+  ConnectionTimers();
+  void add(TCPConnection& conn);
+  void remove(TCPConnection& conn);
+  // close expired connections, server_address is for log
+  void expire(uint32_t now, const std::string& server_address);
+
+ private:
+  void insert(TCPConnection& conn, uint32_t deadline);
+
+  TCPConnection* slots[TIMER_WHEEL_SLOTS];
+  uint32_t current;  // last checked second
+};
+
+/*----------------------------------------------------------------------
+* NetBackend  sockets I/O of TCPServer
+*----------------------------------------------------------------------*/
+class NetBackend {
+ public:
+  struct Event {
+    TCPConnection* conn;  // nullptr for listen socket
+    bool read;
+    bool write;
+    bool hangup;
+    int accepted;  // socket of new connection, -1 if server must accept() it
+    struct sockaddr_in addr;
+  };
+
+  virtual ~NetBackend() {
+  }
+  virtual const char* name() const = 0;
+  virtual void listen(int fd) = 0;
+  // false if connection can't be served
+  virtual bool add(TCPConnection& conn) = 0;
+  // connection is deleted when its I/O is over
+  virtual void release(TCPConnection* conn) = 0;
+  // -1 on error (errno), 0 if nothing happened. events are valid until next wait()
+  virtual int wait(std::vector<Event>& events, int timeout_ms) = 0;
+  // data_in of read event
+  virtual void read(TCPConnection& conn) = 0;
+  // data_out is sent (or queued to be sent)
+  virtual void write(TCPConnection& conn) = 0;
+};
+
+// io_uring backend if it was enabled and works, Poller otherwise
+std::unique_ptr<NetBackend> createNetBackend();
+
+/*----------------------------------------------------------------------
+* Poller  readiness of sockets
+*----------------------------------------------------------------------*/
+// epoll with persistent registrations on Linux: connections are edge triggered,
+// wait() costs O(events). poll() over all sockets elsewhere
+class Poller : public NetBackend {
+ public:
+  Poller();
+  ~Poller();
+  const char* name() const final override;
+  void listen(int fd) final override;
+  bool add(TCPConnection& conn) final override;
+  void release(TCPConnection* conn) final override;
+  int wait(std::vector<Event>& events, int timeout_ms) final override;
+  void read(TCPConnection& conn) final override;
+  void write(TCPConnection& conn) final override;
+
+ private:
+  bool add(int fd, TCPConnection* conn);
+#ifdef __linux__
+  int epoll_fd;
+  epoll_event ready[EPOLL_MAX_EVENTS];
+#else
+  std::vector<pollfd> fds;
+  std::vector<TCPConnection*> conns;
+#endif
 };
 
 template <typename Context>
@@ -100,30 +219,47 @@ class TCPServer {
    public:
     Connection(const int sockfd) : TCPConnection(sockfd) {
     }
+    Connection(const int sockfd, const struct sockaddr_in& addr) : TCPConnection(sockfd, addr) {
+    }
     // connection related context (http::HttpParser for example)
     Context context;
   };
 
   TCPServer(const std::string host, const uint16_t port);
+  // process() returns after that if nothing happens, POLL_TIMEOUT_MS by default
+  void set_poll_timeout(int timeout_ms);
 
  public:
   uint16_t process();  // return number of active connections
   std::string get_server_address();
-  std::vector<Connection*> get_alive_connections();
 
   // must be implemented in derived class
   virtual void on_data(Connection& conn) = 0;
   virtual void on_connect(Connection& conn) = 0;
+  // connection is closed and about to be deleted
+  virtual void on_close(Connection& conn) {
+  }
 
  private:
   void accept_new_connection();
-
-  std::vector<Connection*> connections;
+  void add_connection(Connection* conn);
+  // send responses written since last flush and delete closed connections
+  void flush_changes();
+  void destroy(Connection* conn);
+
+  std::unique_ptr<NetBackend> backend;
+  std::vector<NetBackend::Event> events;
+  ConnectionTimers timers;
+  std::vector<TCPConnection*> changes;
+  uint16_t connections_count = 0;
+  std::string address;  // of server, for log
 
   int srv_sockfd;
   struct sockaddr_in serv_addr;
   const std::string host;
   const uint16_t port;
+  int poll_timeout_ms = POLL_TIMEOUT_MS;
+  int idle_ms = 0;  // "No data" is reported after POLL_TIMEOUT_MS of idle polls
 };
 
 // class templates require to be instantate by every #include
@@ -134,7 +270,7 @@ class TCPServer {
 *----------------------------------------------------------------------*/
 template <typename Context>
 TCPServer<Context>::TCPServer(const std::string host, const uint16_t port)
-    : host{host}, port{port} {
+    : backend{createNetBackend()}, host{host}, port{port} {
   srv_sockfd = socket(AF_INET, SOCK_STREAM, 0);
 
   if (srv_sockfd == -1) {
@@ -172,8 +308,10 @@ TCPServer<Context>::TCPServer(const std::string host, const uint16_t port)
   }
 
   std::cout << "listen on " << get_server_address() << " max_connections:" << ACCEPT_QUEUE_LENGTH
-            << std::endl;
+            << " backend:" << backend->name() << std::endl;
   fcntl(srv_sockfd, F_SETFL, O_NONBLOCK);
+  backend->listen(srv_sockfd);
+  address = get_server_address();
 }
 
 /*----------------------------------------------------------------------
@@ -190,28 +328,60 @@ void TCPServer<Context>::accept_new_connection() {
     return;
   }
 
-  connections.push_back(conn);
+  add_connection(conn);
+}
+
+/*----------------------------------------------------------------------
+* TCPServer add_connection
+*----------------------------------------------------------------------*/
+template <typename Context>
+void TCPServer<Context>::add_connection(Connection* conn) {
+  ++connections_count;
+  conn->track_changes(&changes);
+  timers.add(*conn);
+  if (!backend->add(*conn)) {
+    conn->reset();
+  }
   // call virtual metod to let derived class know about new connection
   // and init connection context
   on_connect(*conn);
 }
 
 /*----------------------------------------------------------------------
-* TCPServer process tick
+* TCPServer set_poll_timeout
+*----------------------------------------------------------------------*/
+template <typename Context>
+void TCPServer<Context>::set_poll_timeout(int timeout_ms) {
+  poll_timeout_ms = timeout_ms;
+}
+
+/*----------------------------------------------------------------------
+* TCPServer flush_changes
 *----------------------------------------------------------------------*/
 template <typename Context>
-std::vector<typename TCPServer<Context>::Connection*> TCPServer<Context>::get_alive_connections() {
-  std::vector<Connection*> alive_connections;
-
-  for (auto& conn : connections) {
-    if (!conn->is_alive()) {
-      delete conn;
-    } else {
-      alive_connections.push_back(conn);
+void TCPServer<Context>::flush_changes() {
+  // connection stays marked while it is flushed, so it is listed once
+  for (size_t idx = 0; idx < changes.size(); ++idx) {
+    auto conn = static_cast<Connection*>(changes[idx]);
+    backend->write(*conn);
+    if (conn->is_alive()) {
+      conn->changed = false;
+      continue;
     }
+    destroy(conn);
   }
+  changes.clear();
+}
 
-  return alive_connections;
+/*----------------------------------------------------------------------
+* TCPServer destroy
+*----------------------------------------------------------------------*/
+template <typename Context>
+void TCPServer<Context>::destroy(Connection* conn) {
+  on_close(*conn);
+  timers.remove(*conn);
+  --connections_count;
+  backend->release(conn);
 }
 
 /*----------------------------------------------------------------------
@@ -219,107 +389,80 @@ std::vector<typename TCPServer<Context>::Connection*> TCPServer<Context>::get_al
 *----------------------------------------------------------------------*/
 template <typename Context>
 uint16_t TCPServer<Context>::process() {
-  uint32_t current_time = timing::getTimestampSec();
-
-  // ------------------------------------------------------
-  // setup descriptors we will be listening for
-  nfds_t nfds = connections.size() + 1;
-  pollfd pfd[nfds];
-  pollfd* pfd_main_socket = &pfd[0];
-  Connection* p_connections[nfds];  // pointer for fast access
-
-  // listening for incoming connection socket
-  pfd_main_socket->fd = srv_sockfd;
-  pfd_main_socket->events = POLLIN;
-
-  // and all reading/writing sockets
-  int i = 1;
-
-  for (const auto& conn : connections) {
-    p_connections[i] = conn;
-
-    pfd[i].fd = conn->get_socket();
-    pfd[i].events = POLLIN;
-
-    if (conn->has_something_to_send()) {
-      pfd[i].events |= POLLOUT;
-    }
-
-    if (current_time - conn->created_time > MAX_CONNECTION_LIFETIME_SEC) {
-      std::cerr << get_server_address()
-                << " ERROR MAX_CONNECTION_LIFETIME_SEC:" << MAX_CONNECTION_LIFETIME_SEC
-                << std::endl;
-      conn->close();
-    } else if (current_time - conn->last_beat_time > MAX_CONNECTION_IDLE_TIME_SEC) {
-      std::cerr << get_server_address()
-                << " ERROR MAX_CONNECTION_IDLE_TIME_SEC:" << MAX_CONNECTION_IDLE_TIME_SEC
-                << std::endl;
-      conn->close();
-    }
-    i++;
-  }
+  // connections written or closed outside of handlers (and expired ones)
+  timers.expire(timing::getTimestampSec(), address);
+  flush_changes();
 
   // ------------------------------------------------------
-  // wait for incoming event
-  int retval = poll(pfd, nfds, POLL_TIMEOUT_MS);
+  // wait for incoming event, timers are checked every second
+  const int timeout_ms =
+      connections_count > 0 ? std::min(poll_timeout_ms, 1000) : poll_timeout_ms;
+  int retval = backend->wait(events, timeout_ms);
 
   if (retval == -1) {
     if (errno != EINTR) {  // if not a signal
-      std::cerr << get_server_address() << " ERROR poll() error retval == -1, errno:" << errno
-                << std::endl;
+      std::cerr << address << " ERROR poll() error retval == -1, errno:" << errno << std::endl;
     }
-    connections = std::move(get_alive_connections());
-    return connections.size();
+    return connections_count;
   }
 
   if (retval == 0) {
-    std::cout << get_server_address()
-              << " No data within (n) seconds. Connections:" << connections.size() << std::endl;
-    connections = std::move(get_alive_connections());
-    return connections.size();
+    idle_ms += timeout_ms;
+    if (idle_ms >= POLL_TIMEOUT_MS) {
+      idle_ms = 0;
+      std::cout << address << " No data within (n) seconds. Connections:" << connections_count
+                << std::endl;
+    }
+    return connections_count;
   }
+  idle_ms = 0;
 
   // ------------------------------------------------------
-  // somebody need to be procesed. let's search this one
-  // i == 0 => main socket listening for new connections
-  for (i = 1; i < nfds; ++i) {
-    if (pfd[i].revents & POLLHUP) {
-      p_connections[i]->reset();
+  // somebody need to be procesed
+  bool new_connections = false;
+  for (const auto& event : events) {
+    if (event.conn == nullptr) {
+      if (event.accepted >= 0) {
+        add_connection(new Connection(event.accepted, event.addr));
+      } else {
+        new_connections = true;
+      }
       continue;
     }
+    auto& conn = static_cast<Connection&>(*event.conn);
 
-    if (pfd[i].revents & POLLIN) {
+    if (event.hangup) {
+      conn.reset();
+      continue;
+    }
+
+    if (event.read) {
       // fill input buffers with data
-      p_connections[i]->network_read();
+      backend->read(conn);
 
       // call virtual method to let parrent class process
       // inboud data with access to custom context
-      on_data(*p_connections[i]);
-
-      // clear input buffers
-      // p_connections[i]->network_data_processed();
+      if (conn.get_data().size() > 0) {
+        on_data(conn);
+      }
     }
 
-    if (pfd[i].revents & POLLOUT) {
-      // write output buffer to network and clear them
-      p_connections[i]->network_write();
+    if (event.write) {
+      // write the rest of output buffer to network
+      backend->write(conn);
     }
   }
 
   // ------------------------------------------------------
   // if there are new connections -> accept them
-  // do it after read/write processing because
-  // accept new connection will add nec connection to the std::list<Connection>
-  if (pfd_main_socket->revents & POLLIN) {
+  if (new_connections) {
     accept_new_connection();
   }
 
   // ------------------------------------------------------
-  // remove all destroyed handlers from polling cycle
-  // should be done after processing
-  // update live connections list
-  connections = std::move(get_alive_connections());
-  return connections.size();
+  // responses are sent right away, closed connections are deleted
+  flush_changes();
+  return connections_count;
 }
 
 /*----------------------------------------------------------------------
@@ -0,0 +1,90 @@
+#include "thread_pool.hpp"
+
+namespace thread_pool {
+//------------------------------------------------------------
+// ThreadPool
+//------------------------------------------------------------
+ThreadPool::ThreadPool(uint32_t threads) {
+  for (uint32_t idx = 0; idx < threads; ++idx) {
+    this->threads.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+  part_ready.notify_all();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+//------------------------------------------------------------
+void ThreadPool::run(uint32_t parts, const std::function<void(uint32_t part)>& task) {
+  std::lock_guard<std::mutex> run_guard(run_lock);
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    this->task = &task;
+    this->parts = parts;
+    next_part = 1;
+    parts_running = parts - 1;
+    error = nullptr;
+  }
+  part_ready.notify_all();
+
+  std::exception_ptr caller_error;
+  try {
+    task(0);
+  } catch (...) {
+    caller_error = std::current_exception();
+  }
+
+  std::unique_lock<std::mutex> guard(lock);
+  parts_done.wait(guard, [this] { return parts_running == 0; });
+  this->task = nullptr;
+  this->parts = 0;
+
+  if (caller_error) {
+    std::rethrow_exception(caller_error);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+//------------------------------------------------------------
+uint32_t ThreadPool::size() const {
+  return threads.size() + 1;
+}
+
+//------------------------------------------------------------
+void ThreadPool::work() {
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    part_ready.wait(guard, [this] { return stop || next_part < parts; });
+    if (stop) {
+      return;
+    }
+
+    const uint32_t part = next_part++;
+    const auto& part_task = *task;
+    guard.unlock();
+    std::exception_ptr part_error;
+    try {
+      part_task(part);
+    } catch (...) {
+      part_error = std::current_exception();
+    }
+    guard.lock();
+
+    if (part_error && !error) {
+      error = part_error;
+    }
+    if (--parts_running == 0) {
+      parts_done.notify_one();
+    }
+  }
+}
+}  // namespace thread_pool
@@ -0,0 +1,48 @@
+#ifndef SRC_THREAD_POOL_HPP
+#define SRC_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace thread_pool {
+//------------------------------------------------------------
+// ThreadPool
+//------------------------------------------------------------
+// threads waiting for parts of one task at a time. threads are not inherited
+// by fork(), pool must be used only by process which created it
+class ThreadPool {
+ public:
+  explicit ThreadPool(uint32_t threads);
+  ~ThreadPool();
+
+  // task(part) for parts 1..parts-1 in pool threads and part 0 in the caller thread,
+  // returns when all parts are done. parts <= size(). the first exception of parts
+  // is thrown after that
+  void run(uint32_t parts, const std::function<void(uint32_t part)>& task);
+  // parts run at once: pool threads + caller
+  uint32_t size() const;
+
+ private:
+  void work();
+
+  std::vector<std::thread> threads;
+  std::mutex run_lock;  // one task at a time
+
+  std::mutex lock;
+  std::condition_variable part_ready;
+  std::condition_variable parts_done;
+  const std::function<void(uint32_t)>* task = nullptr;
+  uint32_t parts = 0;
+  uint32_t next_part = 0;
+  uint32_t parts_running = 0;  // taken or not taken yet by pool threads
+  std::exception_ptr error;
+  bool stop = false;
+};
+}  // namespace thread_pool
+
+#endif
@@ -22,7 +22,7 @@ void TopDstDatabase::addDestination(const types::CountryCode& locale,
                                     const types::IATACode& destination,
                                     const types::Date& departure_date) {
   i::DstInfo info = {locale.get_code(), destination.get_code(), departure_date.get_code()};
-  auto di_result = db_index.addRecord(&info);
+  db_index.addRecord(&info);
 }
 
 // -----------------------------------------------------------------
@@ -124,17 +124,14 @@ std::vector<DstInfo> TopDstSearchQuery::exec() {
 
   // convert result
   std::vector<DstInfo> top_destinations;
+  top_destinations.reserve(grouped_destinations.size());
 
-  for (const auto& v : grouped_destinations) {
-    top_destinations.push_back({v.first, v.second});
-  }
-
-  std::sort(top_destinations.begin(), top_destinations.end(),
-            [](const DstInfo& a, const DstInfo& b) { return a.counter > b.counter; });
+  grouped_destinations.for_each([&top_destinations](uint32_t destination, uint32_t counter) {
+    top_destinations.push_back({destination, counter});
+  });
 
-  if (top_destinations.size() > filter_result_limit) {
-    top_destinations.resize(filter_result_limit);
-  }
+  query::sort_limited(top_destinations, filter_result_limit,
+                      [](const DstInfo& a, const DstInfo& b) { return a.counter > b.counter; });
 
   return top_destinations;
 }
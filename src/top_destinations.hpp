@@ -3,6 +3,7 @@
 
 #include <unordered_map>
 #include "cache.hpp"
+#include "flat_map.hpp"
 #include "search_query.hpp"
 #include "shared_memory.hpp"
 #include "types.hpp"
@@ -11,7 +12,8 @@ namespace top {
 
 #define TOPDST_EXPIRES DEALS_EXPIRES
 
-#define TOPDST_TABLENAME "TopDst"
+// index layout of "TopDst" of previous version differs, tables are not shared with it
+#define TOPDST_TABLENAME "TopDst2"
 #define TOPDST_PAGES 5000
 #define TOPDST_ELEMENTS 10000
 
@@ -89,7 +91,9 @@ class TopDstSearchQuery : public shared_mem::TableProcessor<i::DstInfo>, public
 
  private:
   shared_mem::Table<i::DstInfo>& table;
-  std::unordered_map<uint32_t, uint32_t> grouped_destinations;
+  using Counters = flat_map::FlatMap<uint32_t, uint32_t>;
+  flat_map::ThreadMap<TopDstSearchQuery, Counters> counters;
+  Counters& grouped_destinations = counters.get();
 
   friend class TopDstDatabase;
 };
@@ -186,6 +186,10 @@ uint8_t Date::get_day() const {
   return day;
 }
 
+uint16_t Date::get_days() const {
+  return date_to_days(get_code());
+}
+
 uint32_t Date::days_after(Date const date) const {
   return utils::days_between_dates(date.year, date.month, date.day, this->year, this->month,
                                    this->day);
@@ -398,6 +402,46 @@ std::string int_to_date(uint32_t date) {
   return result;
 };
 
+//--------------------------------------------------
+// date_to_days         20160616 -> days since 1970-01-01
+// https://howardhinnant.github.io/date_algorithms.html
+//--------------------------------------------------
+uint16_t date_to_days(uint32_t date) {
+  int32_t year = date / 10000;
+  const uint32_t month = (date / 100) % 100;
+  const uint32_t day = date % 100;
+
+  year -= month <= 2;
+  const int32_t era = year / 400;
+  const uint32_t year_of_era = year - era * 400;
+  const uint32_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  const int32_t days = era * 146097 + (int32_t)day_of_era - 719468;
+
+  if (days <= 0 || days > UINT16_MAX) {
+    throw Error("date out of range:'" + std::to_string(date) + "'\n");
+  }
+  return days;
+};
+
+//--------------------------------------------------
+// days_to_date         days since 1970-01-01 -> 20160616
+//--------------------------------------------------
+uint32_t days_to_date(uint16_t days) {
+  const uint32_t shifted = days + 719468;
+  const uint32_t era = shifted / 146097;
+  const uint32_t day_of_era = shifted - era * 146097;
+  const uint32_t year_of_era =
+      (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+  const uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  const uint32_t month_shifted = (5 * day_of_year + 2) / 153;
+  const uint32_t day = day_of_year - (153 * month_shifted + 2) / 5 + 1;
+  const uint32_t month = month_shifted < 10 ? month_shifted + 3 : month_shifted - 9;
+  const uint32_t year = year_of_era + era * 400 + (month <= 2);
+
+  return year * 10000 + month * 100 + day;
+};
+
 //-------------------------------------------
 // country_to_code
 //-------------------------------------------
@@ -174,6 +174,7 @@ class Date : public BaseParameter {
   uint32_t days_after(Date const date) const;
   uint8_t day_of_week() const;
   uint32_t get_code() const;
+  uint16_t get_days() const;  // since 1970-01-01, see date_to_days()
   uint16_t get_year() const;
   uint8_t get_month() const;
   uint8_t get_day() const;
@@ -240,6 +241,9 @@ uint32_t origin_to_code(std::string code);
 std::string code_to_origin(uint32_t code);
 uint32_t date_to_int(std::string date);
 std::string int_to_date(uint32_t date);
+// date code <-> days since 1970-01-01, stored by deals instead of date code
+uint16_t date_to_days(uint32_t date);
+uint32_t days_to_date(uint16_t days);
 uint8_t weekdays_bitmask(std::string days_of_week);
 uint8_t country_to_code(std::string country);
 std::string code_to_country(uint8_t code);
@@ -0,0 +1,428 @@
+#ifdef __linux__
+#include "uring_backend.hpp"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+namespace srv {
+namespace {
+// request of user_data: index of slot or accept and operation
+uint64_t request(uint32_t idx, uint8_t op) {
+  return ((uint64_t)idx << 8) | op;
+}
+}  // namespace
+
+/*----------------------------------------------------------------------
+* UringBackend create
+*----------------------------------------------------------------------*/
+UringBackend* UringBackend::create() {
+  UringBackend* backend = new UringBackend();
+  if (!backend->setup()) {
+    delete backend;
+    return nullptr;
+  }
+  return backend;
+}
+
+/*----------------------------------------------------------------------
+* UringBackend setup
+*----------------------------------------------------------------------*/
+bool UringBackend::setup() {
+  std::memset(&params, 0, sizeof(params));
+  ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  if (ring_fd == -1) {
+    std::cerr << "ERROR io_uring_setup, errno:" << errno << std::endl;
+    return false;
+  }
+
+  // rings in one mapping, completions are not dropped, enter() waits with timeout
+  const uint32_t required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+  if ((params.features & required) != required) {
+    std::cerr << "ERROR io_uring features:" << params.features << std::endl;
+    return false;
+  }
+
+  rings_size = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+                                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+  rings = mmap(nullptr, rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+               IORING_OFF_SQ_RING);
+  if (rings == MAP_FAILED) {
+    rings = nullptr;
+    std::cerr << "ERROR io_uring rings mmap, errno:" << errno << std::endl;
+    return false;
+  }
+  sqes = (io_uring_sqe*)mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe),
+                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                             IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    sqes = nullptr;
+    std::cerr << "ERROR io_uring sqes mmap, errno:" << errno << std::endl;
+    return false;
+  }
+
+  char* ring = (char*)rings;
+  sq_head = (uint32_t*)(ring + params.sq_off.head);
+  sq_tail = (uint32_t*)(ring + params.sq_off.tail);
+  sq_mask = (uint32_t*)(ring + params.sq_off.ring_mask);
+  sq_array = (uint32_t*)(ring + params.sq_off.array);
+  cq_head = (uint32_t*)(ring + params.cq_off.head);
+  cq_tail = (uint32_t*)(ring + params.cq_off.tail);
+  cq_mask = (uint32_t*)(ring + params.cq_off.ring_mask);
+  cqes = (io_uring_cqe*)(ring + params.cq_off.cqes);
+
+  // buffers of all slots are registered once (pinned, counted in RLIMIT_MEMLOCK)
+  const size_t buffers_size = (size_t)URING_SLOTS * 2 * URING_BUFFER_SIZE;
+  buffers = (char*)mmap(nullptr, buffers_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (buffers == MAP_FAILED) {
+    buffers = nullptr;
+    std::cerr << "ERROR io_uring buffers mmap, errno:" << errno << std::endl;
+    return false;
+  }
+  struct iovec buffer = {buffers, buffers_size};
+  if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, &buffer, 1) == -1) {
+    std::cerr << "ERROR io_uring_register buffers, errno:" << errno << std::endl;
+    return false;
+  }
+
+  for (uint32_t slot = URING_SLOTS; slot-- > 0;) {
+    free_slots.push_back(slot);
+  }
+  return true;
+}
+
+/*----------------------------------------------------------------------
+* UringBackend destructor
+*----------------------------------------------------------------------*/
+UringBackend::~UringBackend() {
+  if (buffers != nullptr) {
+    munmap(buffers, (size_t)URING_SLOTS * 2 * URING_BUFFER_SIZE);
+  }
+  if (sqes != nullptr) {
+    munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+  }
+  if (rings != nullptr) {
+    munmap(rings, rings_size);
+  }
+  if (ring_fd != -1) {
+    ::close(ring_fd);
+  }
+}
+
+/*----------------------------------------------------------------------
+* UringBackend name
+*----------------------------------------------------------------------*/
+const char* UringBackend::name() const {
+  return "io_uring";
+}
+
+/*----------------------------------------------------------------------
+* UringBackend listen
+*----------------------------------------------------------------------*/
+// accept of non blocking socket would complete with EAGAIN instead of waiting
+void UringBackend::listen(int fd) {
+  listen_fd = fd;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  for (uint32_t idx = 0; idx < URING_ACCEPTS; ++idx) {
+    idle_accepts.push_back(idx);
+  }
+}
+
+/*----------------------------------------------------------------------
+* UringBackend add
+*----------------------------------------------------------------------*/
+bool UringBackend::add(TCPConnection& conn) {
+  if (free_slots.empty()) {
+    std::cerr << "ERROR io_uring no free slot, connections:" << URING_SLOTS << std::endl;
+    return false;
+  }
+  const uint32_t slot = free_slots.back();
+  free_slots.pop_back();
+  slots[slot].conn = &conn;
+  conn.io_slot = slot;
+  submit_recv(slot);
+  return true;
+}
+
+/*----------------------------------------------------------------------
+* UringBackend release
+*----------------------------------------------------------------------*/
+void UringBackend::release(TCPConnection* conn) {
+  if (conn->io_slot < 0) {
+    delete conn;
+    return;
+  }
+  // buffers of requests are in use till they are completed
+  const uint32_t slot = conn->io_slot;
+  slots[slot].released = true;
+  if (slots[slot].recv_pending) {
+    submit_cancel(slot, OP_RECV);
+  }
+  if (slots[slot].send_pending) {
+    submit_cancel(slot, OP_SEND);
+  }
+  free_slot(slot);
+}
+
+/*----------------------------------------------------------------------
+* UringBackend wait
+*----------------------------------------------------------------------*/
+int UringBackend::wait(std::vector<Event>& events, int timeout_ms) {
+  events.clear();
+  for (const auto idx : idle_accepts) {
+    submit_accept(idx);
+  }
+  idle_accepts.clear();
+
+  // completions which are ready already are taken without waiting
+  const bool ready = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) != *cq_head;
+  if (enter(ready || timeout_ms == 0 ? 0 : 1, timeout_ms) == -1 && errno != ETIME) {
+    if (errno != EBUSY) {
+      return -1;
+    }
+  }
+
+  // completions of cancels and failed accepts give no events, but something happened
+  int completed = 0;
+  uint32_t head = *cq_head;
+  while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    complete(cqes[head & *cq_mask], events);
+    ++head;
+    ++completed;
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  return completed;
+}
+
+/*----------------------------------------------------------------------
+* UringBackend read
+*----------------------------------------------------------------------*/
+void UringBackend::read(TCPConnection& conn) {
+  const uint32_t slot = conn.io_slot;
+  const int32_t res = slots[slot].received;
+
+  if (res > 0) {
+    conn.network_received(in_buffer(slot), res);
+    submit_recv(slot);
+    return;
+  }
+
+  conn.network_received(nullptr, 0);
+  if (res == 0) {
+    std::cerr << "ERROR UringBackend::read, res == 0:" << std::endl;
+  } else {
+    std::cerr << "ERROR UringBackend::read, errno:" << -res << std::endl;
+  }
+  conn.close();  // close connection
+}
+
+/*----------------------------------------------------------------------
+* UringBackend write
+*----------------------------------------------------------------------*/
+void UringBackend::write(TCPConnection& conn) {
+  if (conn.io_slot < 0 || !conn.has_something_to_send()) {
+    return;
+  }
+  const uint32_t slot = conn.io_slot;
+  if (slots[slot].send_pending) {
+    return;  // the rest is sent after completion
+  }
+
+  auto sqe = get_sqe();
+  if (sqe == nullptr) {
+    return;  // next write event or flush sends it
+  }
+  const auto& data = conn.get_output();
+  if (data.length() <= URING_BUFFER_SIZE) {
+    std::memcpy(out_buffer(slot), data.data(), data.length());
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->addr = (uint64_t)out_buffer(slot);
+    sqe->buf_index = 0;
+  } else {
+    // data_out could be reallocated by writes till completion
+    slots[slot].sending = data;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->addr = (uint64_t)slots[slot].sending.data();
+  }
+  sqe->fd = conn.get_socket();
+  sqe->len = data.length();
+  sqe->user_data = request(slot, OP_SEND);
+  slots[slot].send_pending = true;
+}
+
+/*----------------------------------------------------------------------
+* UringBackend get_sqe
+*----------------------------------------------------------------------*/
+// full queue is submitted to make room, nullptr if it doesn't help
+io_uring_sqe* UringBackend::get_sqe() {
+  if (*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= params.sq_entries) {
+    enter(0, 0);
+    if (*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= params.sq_entries) {
+      std::cerr << "ERROR io_uring submission queue is full" << std::endl;
+      return nullptr;
+    }
+  }
+
+  const uint32_t tail = *sq_tail;
+  const uint32_t idx = tail & *sq_mask;
+  auto sqe = &sqes[idx];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array[idx] = idx;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+/*----------------------------------------------------------------------
+* UringBackend enter
+*----------------------------------------------------------------------*/
+int UringBackend::enter(uint32_t min_complete, int timeout_ms) {
+  const uint32_t to_submit = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  if (to_submit == 0 && min_complete == 0) {
+    return 0;
+  }
+
+  struct __kernel_timespec ts;
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+  io_uring_getevents_arg arg;
+  std::memset(&arg, 0, sizeof(arg));
+  arg.sigmask_sz = _NSIG / 8;
+  arg.ts = timeout_ms >= 0 ? (uint64_t)&ts : 0;
+
+  const uint32_t flags = min_complete > 0 ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0;
+  return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags,
+                 min_complete > 0 ? &arg : nullptr, sizeof(arg));
+}
+
+/*----------------------------------------------------------------------
+* UringBackend submit_accept
+*----------------------------------------------------------------------*/
+void UringBackend::submit_accept(uint32_t idx) {
+  auto sqe = get_sqe();
+  if (sqe == nullptr) {
+    idle_accepts.push_back(idx);
+    return;
+  }
+  accepts[idx].addr_len = sizeof(accepts[idx].addr);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd;
+  sqe->addr = (uint64_t)&accepts[idx].addr;
+  sqe->addr2 = (uint64_t)&accepts[idx].addr_len;
+  sqe->user_data = request(idx, OP_ACCEPT);
+}
+
+/*----------------------------------------------------------------------
+* UringBackend submit_recv
+*----------------------------------------------------------------------*/
+void UringBackend::submit_recv(uint32_t slot) {
+  auto& conn = *slots[slot].conn;
+  auto sqe = get_sqe();
+  if (sqe == nullptr) {
+    conn.close();
+    return;
+  }
+  sqe->opcode = IORING_OP_READ_FIXED;
+  sqe->fd = conn.get_socket();
+  sqe->addr = (uint64_t)in_buffer(slot);
+  sqe->len = URING_BUFFER_SIZE;
+  sqe->buf_index = 0;
+  sqe->user_data = request(slot, OP_RECV);
+  slots[slot].recv_pending = true;
+}
+
+/*----------------------------------------------------------------------
+* UringBackend submit_cancel
+*----------------------------------------------------------------------*/
+void UringBackend::submit_cancel(uint32_t slot, Op op) {
+  auto sqe = get_sqe();
+  if (sqe == nullptr) {
+    return;  // socket is closed when request completes anyway
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = request(slot, op);
+  sqe->user_data = request(slot, OP_CANCEL);
+}
+
+/*----------------------------------------------------------------------
+* UringBackend complete
+*----------------------------------------------------------------------*/
+void UringBackend::complete(const io_uring_cqe& cqe, std::vector<Event>& events) {
+  const uint32_t idx = cqe.user_data >> 8;
+  const uint8_t op = cqe.user_data & 0xff;
+
+  if (op == OP_ACCEPT) {
+    if (cqe.res >= 0) {
+      Event event{nullptr, false, false, false, cqe.res};
+      event.addr = accepts[idx].addr;
+      events.push_back(event);
+    } else if (cqe.res != -EINTR && cqe.res != -EAGAIN) {
+      std::cerr << "ERROR io_uring accept, errno:" << -cqe.res << std::endl;
+    }
+    idle_accepts.push_back(idx);
+    return;
+  }
+  if (op == OP_CANCEL) {
+    return;
+  }
+
+  auto& slot = slots[idx];
+  if (op == OP_RECV) {
+    slot.recv_pending = false;
+    slot.received = cqe.res;
+  } else {
+    slot.send_pending = false;
+    slot.sending.clear();
+  }
+  if (slot.released) {
+    free_slot(idx);
+    return;
+  }
+
+  auto& conn = *slot.conn;
+  if (op == OP_RECV) {
+    events.push_back({&conn, true, false, false, -1});
+    return;
+  }
+
+  if (cqe.res <= 0) {
+    std::cout << conn.get_client_address()
+              << " ERROR UringBackend send, data.length:" << conn.get_output().length()
+              << ", res:" << cqe.res << std::endl;
+    conn.reset();  // nothing to send, connection is dead
+    return;
+  }
+  conn.network_sent(cqe.res);
+  events.push_back({&conn, false, true, false, -1});
+}
+
+/*----------------------------------------------------------------------
+* UringBackend free_slot
+*----------------------------------------------------------------------*/
+void UringBackend::free_slot(uint32_t idx) {
+  auto& slot = slots[idx];
+  if (!slot.released || slot.recv_pending || slot.send_pending) {
+    return;
+  }
+  delete slot.conn;  // socket is closed
+  slot.conn = nullptr;
+  slot.released = false;
+  free_slots.push_back(idx);
+}
+
+/*----------------------------------------------------------------------
+* UringBackend buffers
+*----------------------------------------------------------------------*/
+char* UringBackend::in_buffer(uint32_t slot) const {
+  return buffers + (size_t)slot * 2 * URING_BUFFER_SIZE;
+}
+
+char* UringBackend::out_buffer(uint32_t slot) const {
+  return in_buffer(slot) + URING_BUFFER_SIZE;
+}
+}  // namespace srv
+#endif
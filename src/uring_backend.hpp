@@ -0,0 +1,94 @@
+#ifndef SRC_URING_BACKEND_HPP
+#define SRC_URING_BACKEND_HPP
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <string>
+#include <vector>
+
+#include "tcp_server.hpp"
+
+#define URING_ENTRIES 256       // submission queue
+#define URING_SLOTS 256         // connections served at once
+#define URING_BUFFER_SIZE 4096  // registered input and output buffers of slot
+#define URING_ACCEPTS 4         // accepts kept submitted
+
+namespace srv {
+/*----------------------------------------------------------------------
+* UringBackend  io_uring sockets I/O
+*----------------------------------------------------------------------*/
+// accepts, recv and send of all connections are submitted with one io_uring_enter()
+// per tick, which waits for completions too. connection gets a slot of registered
+// buffers: recv is always submitted into its input buffer, output is sent from its
+// output buffer (larger one is sent from a copy). kernel io_uring interface is used
+// directly, liburing is not required
+class UringBackend : public NetBackend {
+ public:
+  // nullptr if kernel doesn't allow io_uring
+  static UringBackend* create();
+  ~UringBackend();
+
+  const char* name() const final override;
+  void listen(int fd) final override;
+  bool add(TCPConnection& conn) final override;
+  void release(TCPConnection* conn) final override;
+  int wait(std::vector<Event>& events, int timeout_ms) final override;
+  void read(TCPConnection& conn) final override;
+  void write(TCPConnection& conn) final override;
+
+ private:
+  enum Op : uint8_t { OP_ACCEPT, OP_RECV, OP_SEND, OP_CANCEL };
+
+  struct Slot {
+    TCPConnection* conn = nullptr;
+    bool recv_pending = false;
+    bool send_pending = false;
+    bool released = false;  // conn is deleted when its requests are completed
+    int32_t received = 0;   // result of recv
+    std::string sending;    // output larger than buffer
+  };
+
+  struct Accept {
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+  };
+
+  UringBackend() = default;
+  bool setup();
+
+  io_uring_sqe* get_sqe();
+  // submit queued requests and wait for min_complete completions
+  int enter(uint32_t min_complete, int timeout_ms);
+  void submit_accept(uint32_t idx);
+  void submit_recv(uint32_t slot);
+  void submit_cancel(uint32_t slot, Op op);
+  void complete(const io_uring_cqe& cqe, std::vector<Event>& events);
+  void free_slot(uint32_t slot);
+  char* in_buffer(uint32_t slot) const;
+  char* out_buffer(uint32_t slot) const;
+
+  int ring_fd = -1;
+  io_uring_params params;
+  void* rings = nullptr;
+  size_t rings_size = 0;
+  io_uring_sqe* sqes = nullptr;
+  uint32_t* sq_head;
+  uint32_t* sq_tail;
+  uint32_t* sq_mask;
+  uint32_t* sq_array;
+  uint32_t* cq_head;
+  uint32_t* cq_tail;
+  uint32_t* cq_mask;
+  io_uring_cqe* cqes;
+
+  char* buffers = nullptr;  // registered as one buffer
+  Slot slots[URING_SLOTS];
+  std::vector<uint32_t> free_slots;
+
+  int listen_fd = -1;
+  Accept accepts[URING_ACCEPTS];
+  std::vector<uint32_t> idle_accepts;  // submitted again by next wait()
+};
+}  // namespace srv
+#endif
+#endif